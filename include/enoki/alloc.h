@@ -0,0 +1,218 @@
+/*
+    enoki/alloc.h -- Caching memory allocator for dynamic arrays
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <enoki/fwd.h>
+#include <atomic>
+#include <new>
+
+/// Maximum amount of memory (in bytes) cached by each thread
+#if !defined(ENOKI_DYNAMIC_CACHE_SIZE)
+#  define ENOKI_DYNAMIC_CACHE_SIZE (size_t(256) * 1024 * 1024)
+#endif
+
+NAMESPACE_BEGIN(enoki)
+
+/// Alignment of memory regions returned by dynamic_malloc()
+static constexpr size_t dynamic_malloc_alignment = 64;
+
+/// Largest request (in bytes) that dynamic_malloc() rounds to a size class and caches
+static constexpr size_t dynamic_malloc_max_class_size = size_t(32) * 1024 * 1024;
+
+/// Statistics reported by dynamic_malloc_stats()
+struct DynamicMallocStats {
+    /// Memory currently handed out by dynamic_malloc() (in bytes)
+    size_t used;
+
+    /// Memory held in the free lists of all threads (in bytes)
+    size_t cached;
+
+    /// Number of dynamic_malloc() calls that were served from a free list
+    size_t hits;
+
+    /// Number of dynamic_malloc() calls that had to allocate new memory
+    size_t misses;
+};
+
+NAMESPACE_BEGIN(detail)
+
+/* Allocations of up to 'dynamic_malloc_max_class_size' bytes are rounded up
+   to the next power of two (minimum: 64 bytes) and cached in thread-local
+   singly linked free lists, one per size class. The list pointers are stored
+   within the freed memory regions. Larger allocations have their exact size
+   and are released immediately. */
+static constexpr size_t dynamic_malloc_classes = 20;
+
+static_assert(((size_t) 64 << (dynamic_malloc_classes - 1)) == dynamic_malloc_max_class_size,
+              "dynamic_malloc_classes and dynamic_malloc_max_class_size are inconsistent!");
+
+struct dynamic_malloc_counters {
+    std::atomic<size_t> used { 0 }, cached { 0 }, hits { 0 }, misses { 0 };
+};
+
+/* Exported so that shared libraries built with -fvisibility=hidden (e.g.
+   enoki-autodiff) and the application update the same set of counters */
+#if defined(_MSC_VER)
+inline dynamic_malloc_counters &dynamic_malloc_counters_get() {
+#else
+ENOKI_EXPORT inline dynamic_malloc_counters &dynamic_malloc_counters_get() {
+#endif
+    static dynamic_malloc_counters counters;
+    return counters;
+}
+
+/// Thread-local state. Trivially destructible, hence valid until thread exit
+struct dynamic_malloc_cache {
+    void *head[dynamic_malloc_classes];
+    size_t size;
+    bool initialized, shutdown;
+};
+
+inline dynamic_malloc_cache &dynamic_malloc_cache_get() {
+    static thread_local dynamic_malloc_cache cache { };
+    return cache;
+}
+
+/// Size class of a request (== dynamic_malloc_classes if it is not cacheable)
+inline size_t dynamic_malloc_class(size_t size) {
+    if (size > dynamic_malloc_max_class_size)
+        return dynamic_malloc_classes;
+    size_t index = 6;
+    while (((size_t) 1 << index) < size)
+        ++index;
+    return index - 6;
+}
+
+inline void dynamic_malloc_release(void *ptr) {
+    ::operator delete(ptr, std::align_val_t(dynamic_malloc_alignment));
+}
+
+inline void dynamic_malloc_trim_cache(dynamic_malloc_cache &cache) {
+    size_t freed = 0;
+    for (size_t i = 0; i < dynamic_malloc_classes; ++i) {
+        void *ptr = cache.head[i];
+        while (ptr) {
+            void *next = *(void **) ptr;
+            dynamic_malloc_release(ptr);
+            freed += (size_t) 64 << i;
+            ptr = next;
+        }
+        cache.head[i] = nullptr;
+    }
+    cache.size = 0;
+    dynamic_malloc_counters_get().cached.fetch_sub(freed, std::memory_order_relaxed);
+}
+
+/// Releases the cache of a thread when it exits
+struct dynamic_malloc_guard {
+    ~dynamic_malloc_guard() {
+        dynamic_malloc_cache &cache = dynamic_malloc_cache_get();
+        dynamic_malloc_trim_cache(cache);
+        cache.shutdown = true;
+    }
+};
+
+inline dynamic_malloc_cache &dynamic_malloc_cache_init() {
+    dynamic_malloc_cache &cache = dynamic_malloc_cache_get();
+    if (ENOKI_UNLIKELY(!cache.initialized)) {
+        static thread_local dynamic_malloc_guard guard;
+        (void) guard;
+        cache.initialized = true;
+    }
+    return cache;
+}
+
+NAMESPACE_END(detail)
+
+/// Return the size of the memory region that dynamic_malloc() reserves for a request
+inline size_t dynamic_malloc_size(size_t size) {
+    size_t index = detail::dynamic_malloc_class(size);
+    return index < detail::dynamic_malloc_classes ? ((size_t) 64 << index) : size;
+}
+
+/**
+ * \brief Allocate a memory region aligned to \ref dynamic_malloc_alignment bytes
+ *
+ * Regions of up to \ref dynamic_malloc_max_class_size bytes are recycled via
+ * thread-local free lists organized by size class. The region must be
+ * released using \ref dynamic_free() with the same size (or, for cacheable
+ * regions, any size that maps to the same size class).
+ */
+inline void *dynamic_malloc(size_t size) {
+    if (size == 0)
+        return nullptr;
+
+    size_t index = detail::dynamic_malloc_class(size),
+           rounded = index < detail::dynamic_malloc_classes
+                         ? ((size_t) 64 << index) : size;
+
+    detail::dynamic_malloc_counters &counters = detail::dynamic_malloc_counters_get();
+    counters.used.fetch_add(rounded, std::memory_order_relaxed);
+
+    if (index < detail::dynamic_malloc_classes) {
+        detail::dynamic_malloc_cache &cache = detail::dynamic_malloc_cache_init();
+        void *ptr = cache.head[index];
+        if (ptr) {
+            cache.head[index] = *(void **) ptr;
+            cache.size -= rounded;
+            counters.cached.fetch_sub(rounded, std::memory_order_relaxed);
+            counters.hits.fetch_add(1, std::memory_order_relaxed);
+            return ptr;
+        }
+    }
+
+    counters.misses.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(rounded, std::align_val_t(dynamic_malloc_alignment));
+}
+
+/// Release a memory region allocated via dynamic_malloc()
+inline void dynamic_free(void *ptr, size_t size) {
+    if (!ptr)
+        return;
+
+    size_t index = detail::dynamic_malloc_class(size),
+           rounded = index < detail::dynamic_malloc_classes
+                         ? ((size_t) 64 << index) : size;
+
+    detail::dynamic_malloc_counters &counters = detail::dynamic_malloc_counters_get();
+    counters.used.fetch_sub(rounded, std::memory_order_relaxed);
+
+    detail::dynamic_malloc_cache &cache = detail::dynamic_malloc_cache_get();
+    if (index < detail::dynamic_malloc_classes && !cache.shutdown &&
+        cache.size + rounded <= ENOKI_DYNAMIC_CACHE_SIZE) {
+        detail::dynamic_malloc_cache_init();
+        *(void **) ptr = cache.head[index];
+        cache.head[index] = ptr;
+        cache.size += rounded;
+        counters.cached.fetch_add(rounded, std::memory_order_relaxed);
+    } else {
+        detail::dynamic_malloc_release(ptr);
+    }
+}
+
+/// Release all memory regions cached by the calling thread
+inline void dynamic_malloc_trim() {
+    detail::dynamic_malloc_trim_cache(detail::dynamic_malloc_cache_get());
+}
+
+/// Return allocation statistics (aggregated over all threads)
+inline DynamicMallocStats dynamic_malloc_stats() {
+    detail::dynamic_malloc_counters &counters = detail::dynamic_malloc_counters_get();
+    return DynamicMallocStats{ counters.used.load(std::memory_order_relaxed),
+                               counters.cached.load(std::memory_order_relaxed),
+                               counters.hits.load(std::memory_order_relaxed),
+                               counters.misses.load(std::memory_order_relaxed) };
+}
+
+NAMESPACE_END(enoki)
@@ -430,6 +430,22 @@ template <bool Approx_, bool IsMask_, typename Derived_> struct alignas(32)
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum: scan both 128-bit halves, then carry the low total
+    ENOKI_INLINE Derived psum_() const {
+        __m256 z = _mm256_setzero_ps(),
+               t = _mm256_add_ps(m, _mm256_blend_ps(_mm256_permute_ps(m, _MM_SHUFFLE(2, 1, 0, 0)), z, 0x11));
+        t = _mm256_add_ps(t, _mm256_blend_ps(_mm256_permute_ps(t, _MM_SHUFFLE(1, 0, 0, 0)), z, 0x33));
+        __m256 c = _mm256_permute_ps(t, _MM_SHUFFLE(3, 3, 3, 3));
+        return _mm256_add_ps(t, _mm256_permute2f128_ps(c, c, 0x08));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        __m256 c = _mm256_permute_ps(m, _MM_SHUFFLE(3, 3, 3, 3)),
+               s = _mm256_blend_ps(_mm256_permute_ps(m, _MM_SHUFFLE(2, 1, 0, 0)),
+                                   _mm256_setzero_ps(), 0x11);
+        return Derived(_mm256_blend_ps(s, _mm256_permute2f128_ps(c, c, 0x08), 0x10)).psum_();
+    }
+
     ENOKI_INLINE bool all_()  const { return _mm256_movemask_ps(m) == 0xFF;}
     ENOKI_INLINE bool any_()  const { return _mm256_movemask_ps(m) != 0x0; }
 
@@ -924,6 +940,20 @@ template <bool Approx_, bool IsMask_, typename Derived_> struct alignas(32)
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum: scan both 128-bit halves, then carry the low total
+    ENOKI_INLINE Derived psum_() const {
+        __m256d t = _mm256_add_pd(m, _mm256_blend_pd(_mm256_permute_pd(m, 0b0000),
+                                                     _mm256_setzero_pd(), 0b0101));
+        __m256d c = _mm256_permute_pd(t, 0b1111);
+        return _mm256_add_pd(t, _mm256_permute2f128_pd(c, c, 0x08));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        __m256d c = _mm256_permute_pd(m, 0b1111),
+                s = _mm256_blend_pd(_mm256_permute_pd(m, 0b0000), _mm256_setzero_pd(), 0b0101);
+        return Derived(_mm256_blend_pd(s, _mm256_permute2f128_pd(c, c, 0x08), 0b0100)).psum_();
+    }
+
     ENOKI_INLINE bool all_()  const { return _mm256_movemask_pd(m) == 0xF;}
     ENOKI_INLINE bool any_()  const { return _mm256_movemask_pd(m) != 0x0; }
 
@@ -387,6 +387,19 @@ template <typename Value_, bool IsMask_, typename Derived_> struct alignas(32)
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum: scan both 128-bit halves, then carry the low total
+    ENOKI_INLINE Derived psum_() const {
+        __m256i t = _mm256_add_epi32(m, _mm256_slli_si256(m, 4));
+        t = _mm256_add_epi32(t, _mm256_slli_si256(t, 8));
+        __m256i c = _mm256_shuffle_epi32(t, _MM_SHUFFLE(3, 3, 3, 3));
+        return _mm256_add_epi32(t, _mm256_permute2x128_si256(c, c, 0x08));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        /* Shift the entire register up by one lane */
+        return Derived(_mm256_alignr_epi8(m, _mm256_permute2x128_si256(m, m, 0x08), 12)).psum_();
+    }
+
     ENOKI_INLINE bool all_() const { return _mm256_movemask_ps(_mm256_castsi256_ps(m)) == 0xFF; }
     ENOKI_INLINE bool any_() const { return _mm256_movemask_ps(_mm256_castsi256_ps(m)) != 0; }
 
@@ -969,6 +982,18 @@ template <typename Value_, bool IsMask_, typename Derived_> struct alignas(32)
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum: scan both 128-bit halves, then carry the low total
+    ENOKI_INLINE Derived psum_() const {
+        __m256i t = _mm256_add_epi64(m, _mm256_slli_si256(m, 8));
+        __m256i c = _mm256_shuffle_epi32(t, _MM_SHUFFLE(3, 2, 3, 2));
+        return _mm256_add_epi64(t, _mm256_permute2x128_si256(c, c, 0x08));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        /* Shift the entire register up by one lane */
+        return Derived(_mm256_alignr_epi8(m, _mm256_permute2x128_si256(m, m, 0x08), 8)).psum_();
+    }
+
     ENOKI_INLINE bool all_() const { return _mm256_movemask_pd(_mm256_castsi256_pd(m)) == 0xF; }
     ENOKI_INLINE bool any_() const { return _mm256_movemask_pd(_mm256_castsi256_pd(m)) != 0; }
 
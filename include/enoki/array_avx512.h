@@ -391,6 +391,22 @@ template <bool Approx_, RoundingMode Mode_, bool IsMask_, typename Derived_> str
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum via log-step lane shifts (valignd) and additions
+    ENOKI_INLINE Derived psum_() const {
+        __m512i z = _mm512_setzero_si512();
+        __m512 t = m;
+        t = _mm512_add_ps(t, _mm512_castsi512_ps(_mm512_alignr_epi32(_mm512_castps_si512(t), z, 15)));
+        t = _mm512_add_ps(t, _mm512_castsi512_ps(_mm512_alignr_epi32(_mm512_castps_si512(t), z, 14)));
+        t = _mm512_add_ps(t, _mm512_castsi512_ps(_mm512_alignr_epi32(_mm512_castps_si512(t), z, 12)));
+        t = _mm512_add_ps(t, _mm512_castsi512_ps(_mm512_alignr_epi32(_mm512_castps_si512(t), z, 8)));
+        return t;
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return Derived(_mm512_castsi512_ps(_mm512_alignr_epi32(
+            _mm512_castps_si512(m), _mm512_setzero_si512(), 15))).psum_();
+    }
+
     //! @}
     // -----------------------------------------------------------------------
 
@@ -906,6 +922,21 @@ template <bool Approx_, RoundingMode Mode_, bool IsMask_, typename Derived_> str
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum via log-step lane shifts (valignq) and additions
+    ENOKI_INLINE Derived psum_() const {
+        __m512i z = _mm512_setzero_si512();
+        __m512d t = m;
+        t = _mm512_add_pd(t, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(t), z, 7)));
+        t = _mm512_add_pd(t, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(t), z, 6)));
+        t = _mm512_add_pd(t, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(t), z, 4)));
+        return t;
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return Derived(_mm512_castsi512_pd(_mm512_alignr_epi64(
+            _mm512_castpd_si512(m), _mm512_setzero_si512(), 7))).psum_();
+    }
+
     //! @}
     // -----------------------------------------------------------------------
 
@@ -1323,6 +1354,20 @@ template <typename Value_, bool IsMask_, typename Derived_> struct alignas(64)
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum via log-step lane shifts (valignd) and additions
+    ENOKI_INLINE Derived psum_() const {
+        __m512i z = _mm512_setzero_si512(), t = m;
+        t = _mm512_add_epi32(t, _mm512_alignr_epi32(t, z, 15));
+        t = _mm512_add_epi32(t, _mm512_alignr_epi32(t, z, 14));
+        t = _mm512_add_epi32(t, _mm512_alignr_epi32(t, z, 12));
+        t = _mm512_add_epi32(t, _mm512_alignr_epi32(t, z, 8));
+        return t;
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return Derived(_mm512_alignr_epi32(m, _mm512_setzero_si512(), 15)).psum_();
+    }
+
     //! @}
     // -----------------------------------------------------------------------
     //
@@ -1790,6 +1835,19 @@ template <typename Value_, bool IsMask_, typename Derived_> struct alignas(64)
     ENOKI_INLINE Value hmin_()  const { return hmin(min(low_(), high_())); }
     ENOKI_INLINE Value hmax_()  const { return hmax(max(low_(), high_())); }
 
+    /// Inclusive prefix sum via log-step lane shifts (valignq) and additions
+    ENOKI_INLINE Derived psum_() const {
+        __m512i z = _mm512_setzero_si512(), t = m;
+        t = _mm512_add_epi64(t, _mm512_alignr_epi64(t, z, 7));
+        t = _mm512_add_epi64(t, _mm512_alignr_epi64(t, z, 6));
+        t = _mm512_add_epi64(t, _mm512_alignr_epi64(t, z, 4));
+        return t;
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return Derived(_mm512_alignr_epi64(m, _mm512_setzero_si512(), 7)).psum_();
+    }
+
     //! @}
     // -----------------------------------------------------------------------
 
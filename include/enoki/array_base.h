@@ -59,6 +59,9 @@ template <typename Value_, typename Derived_> struct ArrayBase {
     /// Does this array reside on the GPU? (via CUDA)
     static constexpr bool IsCUDA = is_cuda_array_v<Value_>;
 
+    /// Is this array evaluated by the tracing JIT of the host backend?
+    static constexpr bool IsLLVM = is_llvm_array_v<Value_>;
+
     /// Does this array map operations onto native vector instructions?
     static constexpr bool IsNative = false;
 
@@ -138,7 +138,7 @@ template <typename Storage_> struct call_support_base {
             using Result = typename vectorize_result<Mask, FuncResult>::type;
             Result result = zero<Result>(self.size());
 
-            if constexpr (!is_cuda_array_v<Storage>) {
+            if constexpr (!is_dynamic_array_v<Storage>) {
                 while (any(mask)) {
                     InstancePtr value      = extract(self, mask);
                     Mask active            = mask & eq(self, value);
@@ -146,13 +146,15 @@ template <typename Storage_> struct call_support_base {
                     masked(result, active) = func(value, active, std::get<Indices>(tuple)...);
                 }
             } else {
+                /* Dynamic arrays: group the lanes by instance once, then
+                   invoke each method on a dense batch of gathered arguments */
                 auto partitioned = partition(self & mask);
 
                 if (partitioned.size() == 1 && partitioned[0].first != nullptr) {
                     result = func(partitioned[0].first, true,
                                   std::get<Indices>(tuple)...);
                 } else {
-                    for (auto [value, permutation] : partitioned) {
+                    for (const auto &[value, permutation] : partitioned) {
                         if (value == nullptr)
                             continue;
 
@@ -166,7 +168,7 @@ template <typename Storage_> struct call_support_base {
 
             return result;
         } else {
-            if constexpr (!is_cuda_array_v<Storage>) {
+            if constexpr (!is_dynamic_array_v<Storage>) {
                 while (any(mask)) {
                     InstancePtr value = extract(self, mask);
                     Mask active       = mask & eq(self, value);
@@ -179,7 +181,7 @@ template <typename Storage_> struct call_support_base {
                 if (partitioned.size() == 1 && partitioned[0].first != nullptr) {
                     func(partitioned[0].first, true, std::get<Indices>(tuple)...);
                 } else {
-                    for (auto [value, permutation] : partitioned) {
+                    for (const auto &[value, permutation] : partitioned) {
                         if (value == nullptr)
                             continue;
 
@@ -297,6 +297,12 @@
             return ENOKI_MAP_EXPR_F3(enoki::compress, mem, value,              \
                                      mask, __VA_ARGS__);                       \
         }                                                                      \
+        template <typename Mask>                                               \
+        static ENOKI_INLINE Value compress(const Value &value,                 \
+                                           const Mask &mask) {                 \
+            return Value(ENOKI_MAP_EXPR_F2(enoki::compress, value, mask,       \
+                                           __VA_ARGS__));                      \
+        }                                                                      \
         template <typename Src, typename Index, typename Mask>                 \
         static ENOKI_INLINE Value gather(Src &src, const Index &index,         \
                                          const Mask &mask) {                   \
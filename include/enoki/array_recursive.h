@@ -369,6 +369,15 @@ struct StaticArrayImpl<Value_, Size_, Approx_, Mode_, IsMask_, Derived_,
             return hsum(a1) + hsum(a2);
     }
 
+    ENOKI_INLINE Derived psum_() const {
+        Array1 r1 = psum(a1);
+        return Derived(r1, psum(a2) + Array2(r1.coeff(Size1 - 1)));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return Derived(psum_exclusive(a1), psum_exclusive(a2) + Array2(hsum(a1)));
+    }
+
     ENOKI_INLINE Value hprod_() const {
         if constexpr (Size1 == Size2)
             return hprod(a1 * a2);
@@ -236,6 +236,8 @@ ENOKI_ROUTE_UNARY_SCALAR(hmax,  hmax,  a)
 ENOKI_ROUTE_UNARY_SCALAR(hsum,  hsum,  a)
 ENOKI_ROUTE_UNARY_SCALAR(hprod, hprod, a)
 ENOKI_ROUTE_UNARY_SCALAR(hmean, hmean,  a)
+ENOKI_ROUTE_UNARY_SCALAR(psum,  psum,  a)
+ENOKI_ROUTE_UNARY_SCALAR(psum_exclusive, psum_exclusive, T(0))
 
 ENOKI_ROUTE_UNARY_SCALAR(all_inner,   all_inner,   (bool) a)
 ENOKI_ROUTE_UNARY_SCALAR(any_inner,   any_inner,   (bool) a)
@@ -971,7 +973,8 @@ template <typename... Args> void cuda_printf(const char *fmt, const Args&... arg
     cuda_trace_printf(fmt, (uint32_t) sizeof...(Args), indices);
 }
 
-template <typename T, enable_if_t<!is_diff_array_v<T> && !is_cuda_array_v<T>> = 0>
+template <typename T, enable_if_t<!is_diff_array_v<T> && !is_cuda_array_v<T> &&
+                                  !is_llvm_array_v<T>> = 0>
 ENOKI_INLINE void set_label(T&, const char *) { }
 
 
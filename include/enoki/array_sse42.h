@@ -422,6 +422,18 @@ template <bool Approx_, bool IsMask_, typename Derived_> struct alignas(16)
 
     #undef ENOKI_HORIZONTAL_OP
 
+    /// Inclusive prefix sum via log-step shift-and-add
+    ENOKI_INLINE Derived psum_() const {
+        __m128 t = _mm_add_ps(m, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(m), 4)));
+        return _mm_add_ps(t, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(t), 8)));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        __m128 t = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(m), 4));
+        t = _mm_add_ps(t, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(t), 4)));
+        return _mm_add_ps(t, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(t), 8)));
+    }
+
     ENOKI_INLINE bool all_()  const { return _mm_movemask_ps(m) == 0xF;}
     ENOKI_INLINE bool any_()  const { return _mm_movemask_ps(m) != 0x0; }
 
@@ -907,6 +919,15 @@ template <bool Approx_, bool IsMask_, typename Derived_> struct alignas(16)
     #undef ENOKI_HORIZONTAL_OP
     #undef ENOKI_SHUFFLE_PD
 
+    /// Inclusive prefix sum via shift-and-add
+    ENOKI_INLINE Derived psum_() const {
+        return _mm_add_pd(m, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(m), 8)));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(m), 8));
+    }
+
     ENOKI_INLINE bool all_()  const { return _mm_movemask_pd(m) == 0x3;}
     ENOKI_INLINE bool any_()  const { return _mm_movemask_pd(m) != 0x0; }
 
@@ -1443,6 +1464,18 @@ template <typename Value_, bool IsMask_, typename Derived_> struct alignas(16)
     #undef ENOKI_HORIZONTAL_OP
     #undef ENOKI_HORIZONTAL_OP_SIGNED
 
+    /// Inclusive prefix sum via log-step shift-and-add
+    ENOKI_INLINE Derived psum_() const {
+        __m128i t = _mm_add_epi32(m, _mm_slli_si128(m, 4));
+        return _mm_add_epi32(t, _mm_slli_si128(t, 8));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        __m128i t = _mm_slli_si128(m, 4);
+        t = _mm_add_epi32(t, _mm_slli_si128(t, 4));
+        return _mm_add_epi32(t, _mm_slli_si128(t, 8));
+    }
+
     ENOKI_INLINE bool all_()  const { return _mm_movemask_ps(_mm_castsi128_ps(m)) == 0xF;}
     ENOKI_INLINE bool any_()  const { return _mm_movemask_ps(_mm_castsi128_ps(m)) != 0x0; }
 
@@ -2023,6 +2056,15 @@ template <typename Value_, bool IsMask_, typename Derived_> struct alignas(16)
 
     #undef ENOKI_HORIZONTAL_OP
 
+    /// Inclusive prefix sum via shift-and-add
+    ENOKI_INLINE Derived psum_() const {
+        return _mm_add_epi64(m, _mm_slli_si128(m, 8));
+    }
+
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        return _mm_slli_si128(m, 8);
+    }
+
     ENOKI_INLINE bool all_()  const { return _mm_movemask_pd(_mm_castsi128_pd(m)) == 0x3;}
     ENOKI_INLINE bool any_()  const { return _mm_movemask_pd(_mm_castsi128_pd(m)) != 0x0; }
 
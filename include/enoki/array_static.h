@@ -738,6 +738,31 @@ public:
         return result;
     }
 
+    /// Inclusive prefix sum fallback
+    ENOKI_INLINE Derived psum_() const {
+        ENOKI_CHKSCALAR("psum");
+        Derived result;
+        Value accum = (const Value &) derived().coeff(0);
+        result.coeff(0) = accum;
+        for (size_t i = 1; i < Derived::Size; ++i) {
+            accum += (const Value &) derived().coeff(i);
+            result.coeff(i) = accum;
+        }
+        return result;
+    }
+
+    /// Exclusive prefix sum fallback
+    ENOKI_INLINE Derived psum_exclusive_() const {
+        ENOKI_CHKSCALAR("psum_exclusive");
+        Derived result;
+        Value accum = zero<Value>();
+        for (size_t i = 0; i < Derived::Size; ++i) {
+            result.coeff(i) = accum;
+            accum += (const Value &) derived().coeff(i);
+        }
+        return result;
+    }
+
     /// Horizontal sum over innermost dimension
     ENOKI_INLINE auto hsum_inner_() const {
         if constexpr (is_array_v<Value>) {
@@ -236,6 +236,17 @@ template <typename T> struct is_cuda_array<T, enable_if_array_t<T>> {
 template <typename T> constexpr bool is_cuda_array_v = is_cuda_array<T>::value;
 template <typename T> using enable_if_cuda_t = enable_if_t<is_cuda_array_v<T>>;
 
+/// Is this array evaluated by the tracing JIT of the host backend (via LLVMArray)?
+template <typename T, typename = int> struct is_llvm_array {
+    static constexpr bool value = false;
+};
+
+template <typename T> struct is_llvm_array<T, enable_if_array_t<T>> {
+    static constexpr bool value = std::decay_t<T>::Derived::IsLLVM;
+};
+
+template <typename T> constexpr bool is_llvm_array_v = is_llvm_array<T>::value;
+
 /// Determine the depth of a nested Enoki array (scalars evaluate to zero)
 template <typename T, typename = int> struct array_depth {
     static constexpr size_t value = 0;
@@ -14,6 +14,11 @@
 #pragma once
 
 #include <enoki/array.h>
+#include <enoki/dual.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
 #include <vector>
 
 #define ENOKI_AUTODIFF 1
@@ -29,31 +34,41 @@ private:
     struct Edge;
     struct Special;
     struct SimplificationLock;
+    struct Capture;
+public:
+    struct CustomOp;
+    struct ProfileEntry;
+private:
 
     using Index = uint32_t;
     using Mask = mask_t<Type>;
     using Int64 = int64_array_t<Type>;
 
-    Tape();
-    ~Tape();
-
     // -----------------------------------------------------------------------
     //! @{ \name Append unary/binary/ternary operations to the tape
     // -----------------------------------------------------------------------
 
-    Index append(const char *label, size_t size, Index i1, const Type &w1);
+    /* Edge weights are taken by value so that temporaries are moved into the graph */
+    Index append(const char *label, size_t size, Index i1, Type w1);
 
     Index append(const char *label, size_t size, Index i1, Index i2,
-                 const Type &w1, const Type &w2);
+                 Type w1, Type w2);
 
     Index append(const char *label, size_t size, Index i1, Index i2, Index i3,
-                 const Type &w1, const Type &w2, const Type &w3);
+                 Type w1, Type w2, Type w3);
 
     Index append_gather(const Int64 &offset, const Mask &mask);
 
     void append_scatter(Index index, const Int64 &offset, const Mask &mask,
                         bool scatter_add);
 
+    /**
+     * \brief Record the derivative \c h of the weight of the edge from \c i1
+     * to \c index with respect to the input \c i2 (only when second-order
+     * recording is enabled, see \ref hvp())
+     */
+    void append_hessian(Index index, Index i1, Index i2, const Type &h);
+
     //! @}
     // -----------------------------------------------------------------------
 
@@ -63,7 +78,7 @@ private:
 
     Index append_node(size_t size, const char *label);
     Index append_leaf(size_t size);
-    void append_edge(Index src, Index dst, const Type &weight);
+    void append_edge(Index src, Index dst, Type weight);
     void append_edge_prod(Index src, Index dst, const Type &weight1,
                           const Type &weight2);
 
@@ -79,6 +94,8 @@ private:
     void dec_ref_int(Index index, Index from);
     void inc_ref_int(Index index, Index from);
     void free_node(Index index);
+    /// Release the edges of the nodes scheduled by the last traversal
+    void free_scheduled();
 
     //! @}
     // -----------------------------------------------------------------------
@@ -88,12 +105,45 @@ private:
     // -----------------------------------------------------------------------
 
     void set_scatter_gather_operand(Index *index, size_t size, bool permute);
+
+    /// Computes the input gradients of a checkpointed region from its output gradients
+    using CheckpointCallback =
+        std::function<void(const std::vector<Type> &grad_out,
+                           std::vector<Type> &grad_in)>;
+
+    std::vector<Index> append_checkpoint(const std::vector<Index> &inputs,
+                                         const std::vector<size_t> &output_sizes,
+                                         CheckpointCallback callback);
+
+    std::vector<Index> append_custom(const std::vector<Index> &inputs,
+                                     const std::vector<size_t> &output_sizes,
+                                     std::shared_ptr<CustomOp> op);
+
+    static Capture *capture_create();
+    static void capture_destroy(Capture *capture);
+    void capture_begin(Capture *capture);
+    Index capture_input(size_t size);
+    void capture_end(const std::vector<Index> &outputs, bool success);
+    static void capture_backward(Capture *capture,
+                                 const std::vector<Type> &grad_out,
+                                 std::vector<Type> &grad_in);
     void push_prefix(const char *);
     void pop_prefix();
     void backward(bool free_graph);
     void forward(bool free_graph);
     void backward(Index index, bool free_graph);
     void forward(Index index, bool free_graph);
+    std::vector<Type> backward_batch(const std::vector<Index> &outputs,
+                                     const std::vector<Type> &seeds,
+                                     const std::vector<Index> &inputs,
+                                     bool free_graph);
+    std::vector<Type> hvp(const std::vector<Index> &outputs,
+                          const std::vector<Index> &inputs,
+                          const std::vector<Type> &tangents,
+                          bool free_graph);
+    /// Record the second derivatives of subsequently created nodes (for hvp())
+    void set_second_order(bool);
+    bool second_order() const;
     void set_gradient(Index index, const Type &value,
                       bool backward = true);
     void set_label(Index index, const char *name);
@@ -103,21 +153,130 @@ private:
     void set_log_level(uint32_t);
     uint32_t log_level() const;
     void set_graph_simplification(bool);
+    /// Process independent nodes of CPU dynamic arrays in parallel during backward()
+    void set_parallel_backward(bool);
+    /// Group the lanes of CPU gathers by offset to speed up their backward pass
+    void set_sorted_gather(bool);
+    /// Release the pooled gradient and edge weight buffers of this tape
+    void trim_pool();
+    /// Memory held by the pool of gradient and edge weight buffers (in bytes)
+    size_t pool_size() const;
+    /// Collect per-prefix statistics of the graph and its traversals
+    void set_profiling(bool);
+    std::map<std::string, ProfileEntry> profile();
+    void clear_profile();
     void simplify_graph();
+    /// Collapse queued unreferenced nodes whose elimination is cheap (may throw)
+    void simplify_pending();
+    bool collapse_node(Index index);
     std::string whos() const;
     static void cuda_callback(void*);
 
     //! @}
     // -----------------------------------------------------------------------
 
-    static Tape* get() ENOKI_PURE;
+public:
+    /// Create an independent tape (see \ref TapeScope)
+    Tape();
+    ~Tape();
+
+    Tape(const Tape &) = delete;
+    Tape &operator=(const Tape &) = delete;
+
+    /// Return the tape used by the calling thread
+    static Tape* get();
+
+    /**
+     * \brief Make \c tape the current tape of the calling thread and return
+     * the previous one. \c nullptr selects the global tape that is shared by
+     * all threads.
+     */
+    static Tape *set_current(Tape *tape);
+
+    /**
+     * \brief Differentiable operation with hand-written derivatives
+     *
+     * A custom operation is recorded as a single node, irrespective of the
+     * number of arithmetic operations it performs. Gradients are exchanged
+     * as one array per input/output of the operation (see \ref custom()).
+     * Empty arrays denote zero gradients, and arrays of size 1 are broadcast
+     * to the size of the associated variable.
+     */
+    struct CustomOp {
+        virtual ~CustomOp() = default;
+
+        /// Compute the input gradients from the output gradients (reverse mode)
+        virtual void backward(const std::vector<Type> &grad_out,
+                              std::vector<Type> &grad_in) = 0;
+
+        /// Compute the output gradients from the input gradients (forward mode)
+        virtual void forward(const std::vector<Type> & /* grad_in */,
+                             std::vector<Type> & /* grad_out */) {
+            throw std::runtime_error(
+                std::string(name()) +
+                "(): forward-mode traversal is not supported!");
+        }
+
+        /// Label of the operation in GraphViz output (must have static storage)
+        virtual const char *name() const { return "custom"; }
+    };
 
-private:
+    /**
+     * \brief Differentiation statistics of the nodes created under a common
+     * label prefix (see \ref push_prefix())
+     *
+     * Node, edge and memory counts refer to the graph at the time of the
+     * query. The peak memory usage is sampled at each query and at the
+     * beginning of each traversal.
+     */
+    struct ProfileEntry {
+        /// Number of nodes created in total and currently alive
+        size_t nodes_created = 0, nodes = 0;
+
+        /// Number of edges currently in the graph
+        size_t edges = 0;
+
+        /// Memory used by edge weights (current and peak, in bytes)
+        size_t weight_bytes = 0, weight_bytes_peak = 0;
+
+        /// Number of special edges (gather, scatter, custom, ..) traversed
+        size_t specials = 0;
+
+        /// Time spent propagating gradients (in milliseconds)
+        double backward_ms = 0.0, forward_ms = 0.0;
+    };
 
-    static Tape *s_tape;
+private:
     Detail *d;
 };
 
+/**
+ * \brief Makes a tape current on the calling thread for the lifetime of this
+ * object, so that several threads can record and differentiate computations
+ * concurrently. Each variable keeps a pointer to the tape that was current
+ * when it was created and keeps using that tape after the scope has ended,
+ * hence the tape must outlive its variables.
+ *
+ * \code
+ * FloatD::Tape tape;
+ * {
+ *     TapeScope scope(tape);
+ *     FloatD x = ...;
+ *     ...
+ * }
+ * \endcode
+ */
+template <typename Type> struct TapeScope {
+    TapeScope(Tape<Type> &tape) : m_prev(Tape<Type>::set_current(&tape)) { }
+    ~TapeScope() { Tape<Type>::set_current(m_prev); }
+
+    TapeScope(const TapeScope &) = delete;
+    TapeScope &operator=(const TapeScope &) = delete;
+
+private:
+    Tape<Type> *m_prev;
+};
+
 template <typename Type>
 struct DiffArray : ArrayBase<value_t<Type>, DiffArray<Type>> {
 public:
@@ -153,18 +312,24 @@ public:
     DiffArray() = default;
 
     ~DiffArray() {
-        if constexpr (Enabled)
-            tape()->dec_ref_ext(m_index);
+        if constexpr (Enabled) {
+            if (m_index != 0)
+                m_tape->dec_ref_ext(m_index);
+        }
     }
 
-    DiffArray(const DiffArray &a) : m_value(a.m_value), m_index(a.m_index) {
-        if constexpr (Enabled)
-            tape()->inc_ref_ext(m_index);
+    DiffArray(const DiffArray &a)
+        : m_value(a.m_value), m_index(a.m_index), m_tape(a.m_tape) {
+        if constexpr (Enabled) {
+            if (m_index != 0)
+                m_tape->inc_ref_ext(m_index);
+        }
     }
 
     DiffArray(DiffArray &&a) : m_value(std::move(a.m_value)) {
         if constexpr (Enabled) {
             m_index = a.m_index;
+            m_tape = a.m_tape;
             a.m_index = 0;
         }
     }
@@ -189,18 +354,22 @@ public:
     DiffArray &operator=(const DiffArray &a) {
         m_value = a.m_value;
         if constexpr (Enabled) {
-            auto t = tape();
-            t->inc_ref_ext(a.m_index);
-            t->dec_ref_ext(m_index);
+            if (a.m_index != 0)
+                a.m_tape->inc_ref_ext(a.m_index);
+            if (m_index != 0)
+                m_tape->dec_ref_ext(m_index);
             m_index = a.m_index;
+            m_tape = a.m_tape;
         }
         return *this;
     }
 
     DiffArray &operator=(DiffArray &&a) {
         m_value = std::move(a.m_value);
-        if constexpr (Enabled)
+        if constexpr (Enabled) {
             std::swap(m_index, a.m_index);
+            std::swap(m_tape, a.m_tape);
+        }
         return *this;
     }
 
@@ -216,12 +385,13 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("add_");
         } else {
+            Tape *t = tape(*this, a);
             Index index_new = 0;
             Type result = m_value + a.m_value;
             if constexpr (Enabled)
-                index_new = tape()->append("add", slices(result), m_index,
-                                           a.m_index, 1.f, 1.f);
-            return DiffArray::create(index_new, std::move(result));
+                index_new = t->append("add", slices(result), m_index,
+                                      a.m_index, 1.f, 1.f);
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -229,12 +399,13 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("sub_");
         } else {
+            Tape *t = tape(*this, a);
             Index index_new = 0;
             Type result = m_value - a.m_value;
             if constexpr (Enabled)
-                index_new = tape()->append("sub", slices(result), m_index,
-                                           a.m_index, 1.f, -1.f);
-            return DiffArray::create(index_new, std::move(result));
+                index_new = t->append("sub", slices(result), m_index,
+                                      a.m_index, 1.f, -1.f);
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -242,12 +413,18 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("mul_");
         } else {
+            Tape *t = tape(*this, a);
             Index index_new = 0;
             Type result = m_value * a.m_value;
-            if constexpr (Enabled)
-                index_new = tape()->append("mul", slices(result), m_index,
-                                           a.m_index, a.m_value, m_value);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("mul", slices(result), m_index,
+                                      a.m_index, a.m_value, m_value);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    t->append_hessian(index_new, m_index, a.m_index, 1.f);
+                    t->append_hessian(index_new, a.m_index, m_index, 1.f);
+                }
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -255,15 +432,23 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("div_");
         } else {
+            Tape *t = tape(*this, a);
             Index index_new = 0;
             Type result = m_value / a.m_value;
             if constexpr (Enabled) {
                 Type rcp_a = rcp(a.m_value);
-                index_new = tape()->append("div", slices(result),
-                                           m_index, a.m_index, rcp_a,
-                                           -m_value * sqr(rcp_a));
+                index_new = t->append("div", slices(result),
+                                      m_index, a.m_index, rcp_a,
+                                      -m_value * sqr(rcp_a));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    Type rcp_a_2 = sqr(rcp_a);
+                    t->append_hessian(index_new, m_index, a.m_index, -rcp_a_2);
+                    t->append_hessian(index_new, a.m_index, m_index, -rcp_a_2);
+                    t->append_hessian(index_new, a.m_index, a.m_index,
+                                      2.f * m_value * rcp_a_2 * rcp_a);
+                }
             }
-            return DiffArray::create(index_new, std::move(result));
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -271,13 +456,19 @@ public:
         if constexpr (is_mask_v<Type>) {
             fail_unsupported("fmadd_");
         } else {
+            Tape *t = tape(*this, a, b);
             Index index_new = 0;
             Type result = fmadd(m_value, a.m_value, b.m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("fmadd", slices(result),
-                                           m_index, a.m_index, b.m_index,
-                                           a.m_value, m_value, 1);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("fmadd", slices(result),
+                                      m_index, a.m_index, b.m_index,
+                                      a.m_value, m_value, 1);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    t->append_hessian(index_new, m_index, a.m_index, 1.f);
+                    t->append_hessian(index_new, a.m_index, m_index, 1.f);
+                }
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -286,12 +477,18 @@ public:
             fail_unsupported("fmsub_");
         } else {
             Type result = fmsub(m_value, a.m_value, b.m_value);
+            Tape *t = tape(*this, a, b);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("fmsub", slices(result),
-                                           m_index, a.m_index, b.m_index,
-                                           a.m_value, m_value, -1);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("fmsub", slices(result),
+                                      m_index, a.m_index, b.m_index,
+                                      a.m_value, m_value, -1);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    t->append_hessian(index_new, m_index, a.m_index, 1.f);
+                    t->append_hessian(index_new, a.m_index, m_index, 1.f);
+                }
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -300,12 +497,18 @@ public:
             fail_unsupported("fnmadd_");
         } else {
             Type result = fnmadd(m_value, a.m_value, b.m_value);
+            Tape *t = tape(*this, a, b);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("fnmadd", slices(result),
-                                           m_index, a.m_index, b.m_index,
-                                           -a.m_value, -m_value, 1);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("fnmadd", slices(result),
+                                      m_index, a.m_index, b.m_index,
+                                      -a.m_value, -m_value, 1);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    t->append_hessian(index_new, m_index, a.m_index, -1.f);
+                    t->append_hessian(index_new, a.m_index, m_index, -1.f);
+                }
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -313,13 +516,19 @@ public:
         if constexpr (is_mask_v<Type>) {
             fail_unsupported("fnmsub_");
         } else {
+            Tape *t = tape(*this, a, b);
             Index index_new = 0;
             Type result = fnmsub(m_value, a.m_value, b.m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("fnmsub", slices(result),
-                                           m_index, a.m_index, b.m_index,
-                                           -a.m_value, -m_value, -1);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("fnmsub", slices(result),
+                                      m_index, a.m_index, b.m_index,
+                                      -a.m_value, -m_value, -1);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    t->append_hessian(index_new, m_index, a.m_index, -1.f);
+                    t->append_hessian(index_new, a.m_index, m_index, -1.f);
+                }
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -327,10 +536,11 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("neg_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             if constexpr (Enabled)
-                index_new = tape()->append("neg", slices(m_value), m_index, -1.f);
-            return DiffArray::create(index_new, -m_value);
+                index_new = t->append("neg", slices(m_value), m_index, -1.f);
+            return DiffArray::create(t, index_new, -m_value);
         }
     }
 
@@ -338,11 +548,12 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("abs_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             if constexpr (Enabled)
-                index_new = tape()->append("abs", slices(m_value), m_index,
-                                           sign(m_value));
-            return DiffArray::create(index_new, abs(m_value));
+                index_new = t->append("abs", slices(m_value), m_index,
+                                      sign(m_value));
+            return DiffArray::create(t, index_new, abs(m_value));
         }
     }
 
@@ -350,12 +561,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("sqrt_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = sqrt(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("sqrt", slices(result), m_index,
-                                           .5f / result);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("sqrt", slices(result), m_index,
+                                      .5f / result);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -.25f / (result * m_value));
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -363,12 +579,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("cbrt_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = cbrt(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("cbrt", slices(result), m_index,
-                                           1.f / (3 * sqr(result)));
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("cbrt", slices(result), m_index,
+                                      1.f / (3 * sqr(result)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -2.f / (9 * sqr(result) * m_value));
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -376,12 +597,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("rcp_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = rcp(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("rcp", slices(result), m_index,
-                                           -sqr(result));
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("rcp", slices(result), m_index,
+                                      -sqr(result));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      2.f * result * sqr(result));
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -389,14 +615,18 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("rsqrt_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = rsqrt(m_value);
             if constexpr (Enabled) {
                 Type rsqrt_2 = sqr(result), rsqrt_3 = result * rsqrt_2;
-                index_new = tape()->append("rsqrt", slices(result), m_index,
-                                           -.5f * rsqrt_3);
+                index_new = t->append("rsqrt", slices(result), m_index,
+                                      -.5f * rsqrt_3);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      .75f * rsqrt_3 * rsqrt_2);
             }
-            return DiffArray::create(index_new, std::move(result));
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -404,16 +634,17 @@ public:
         if constexpr (is_mask_v<Type>) {
             fail_unsupported("min_");
         } else {
+            Tape *t = tape(*this, a);
             Index index_new = 0;
             Type result = min(m_value, a.m_value);
             if constexpr (Enabled) {
                 mask_t<Type> m = m_value < a.m_value;
-                index_new = tape()->append("min", slices(result),
-                                           m_index, a.m_index,
-                                           select(m, Type(1), Type(0)),
-                                           select(m, Type(0), Type(1)));
+                index_new = t->append("min", slices(result),
+                                      m_index, a.m_index,
+                                      select(m, Type(1), Type(0)),
+                                      select(m, Type(0), Type(1)));
             }
-            return DiffArray::create(index_new, std::move(result));
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -421,31 +652,33 @@ public:
         if constexpr (is_mask_v<Type>) {
             fail_unsupported("max_");
         } else {
+            Tape *t = tape(*this, a);
             Index index_new = 0;
             Type result = max(m_value, a.m_value);
             if constexpr (Enabled) {
                 mask_t<Type> m = m_value > a.m_value;
-                index_new = tape()->append("max", slices(result),
-                                           m_index, a.m_index,
-                                           select(m, Type(1), Type(0)),
-                                           select(m, Type(0), Type(1)));
+                index_new = t->append("max", slices(result),
+                                      m_index, a.m_index,
+                                      select(m, Type(1), Type(0)),
+                                      select(m, Type(0), Type(1)));
             }
-            return DiffArray::create(index_new, std::move(result));
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
     static DiffArray select_(const DiffArray<mask_t<Type>> &m,
                              const DiffArray &t,
                              const DiffArray &f) {
+        Tape *tp = tape(t, f);
         Index index_new = 0;
         Type result = select(m.value_(), t.m_value, f.m_value);
         if constexpr (Enabled) {
             index_new =
-                tape()->append("select", slices(result), t.m_index, f.m_index,
-                               select(m.value_(), Type(1), Type(0)),
-                               select(m.value_(), Type(0), Type(1)));
+                tp->append("select", slices(result), t.m_index, f.m_index,
+                           select(m.value_(), Type(1), Type(0)),
+                           select(m.value_(), Type(0), Type(1)));
         }
-        return DiffArray::create(index_new, std::move(result));
+        return DiffArray::create(tp, index_new, std::move(result));
     }
 
     DiffArray floor_() const {
@@ -488,11 +721,15 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("sin_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             auto [s, c] = sincos(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("sin", slices(m_value), m_index, c);
-            return DiffArray::create(index_new, std::move(s));
+            if constexpr (Enabled) {
+                index_new = t->append("sin", slices(m_value), m_index, c);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index, -s);
+            }
+            return DiffArray::create(t, index_new, std::move(s));
         }
     }
 
@@ -500,11 +737,15 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("cos_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             auto [s, c] = sincos(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("cos", slices(m_value), m_index, -s);
-            return DiffArray::create(index_new, std::move(c));
+            if constexpr (Enabled) {
+                index_new = t->append("cos", slices(m_value), m_index, -s);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index, -c);
+            }
+            return DiffArray::create(t, index_new, std::move(c));
         }
     }
 
@@ -512,15 +753,20 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("sincos_");
         } else {
+            Tape *t = tape(*this);
             Index index_new_s = 0, index_new_c = 0;
             auto [s, c] = sincos(m_value);
             if constexpr (Enabled) {
-                index_new_s = tape()->append("sin", slices(m_value), m_index,  c);
-                index_new_c = tape()->append("cos", slices(m_value), m_index, -s);
+                index_new_s = t->append("sin", slices(m_value), m_index,  c);
+                index_new_c = t->append("cos", slices(m_value), m_index, -s);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new_s))) {
+                    t->append_hessian(index_new_s, m_index, m_index, -s);
+                    t->append_hessian(index_new_c, m_index, m_index, -c);
+                }
             }
             return {
-                DiffArray::create(index_new_s, std::move(s)),
-                DiffArray::create(index_new_c, std::move(c))
+                DiffArray::create(t, index_new_s, std::move(s)),
+                DiffArray::create(t, index_new_c, std::move(c))
             };
         }
     }
@@ -529,11 +775,16 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("tan_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("tan", slices(m_value), m_index,
-                                           sqr(sec(m_value)));
-            return DiffArray::create(index_new, tan(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("tan", slices(m_value), m_index,
+                                      sqr(sec(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      2.f * tan(m_value) * sqr(sec(m_value)));
+            }
+            return DiffArray::create(t, index_new, tan(m_value));
         }
     }
 
@@ -541,12 +792,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("csc_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type csc_value = csc(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("csc", slices(m_value), m_index,
-                                           -csc_value * cot(m_value));
-            return DiffArray::create(index_new, std::move(csc_value));
+            if constexpr (Enabled) {
+                index_new = t->append("csc", slices(m_value), m_index,
+                                      -csc_value * cot(m_value));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      csc_value * (sqr(cot(m_value)) + sqr(csc_value)));
+            }
+            return DiffArray::create(t, index_new, std::move(csc_value));
         }
     }
 
@@ -554,12 +810,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("sec_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type sec_value = sec(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("sec", slices(m_value), m_index,
-                                           sec_value * tan(m_value));
-            return DiffArray::create(index_new, std::move(sec_value));
+            if constexpr (Enabled) {
+                index_new = t->append("sec", slices(m_value), m_index,
+                                      sec_value * tan(m_value));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      sec_value * (sqr(tan(m_value)) + sqr(sec_value)));
+            }
+            return DiffArray::create(t, index_new, std::move(sec_value));
         }
     }
 
@@ -567,11 +828,16 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("cot_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("cot", slices(m_value), m_index,
-                                           -sqr(csc(m_value)));
-            return DiffArray::create(index_new, cot(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("cot", slices(m_value), m_index,
+                                      -sqr(csc(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      2.f * sqr(csc(m_value)) * cot(m_value));
+            }
+            return DiffArray::create(t, index_new, cot(m_value));
         }
     }
 
@@ -579,11 +845,18 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("asin_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("asin", slices(m_value), m_index,
-                                           rsqrt(1 - sqr(m_value)));
-            return DiffArray::create(index_new, asin(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("asin", slices(m_value), m_index,
+                                      rsqrt(1 - sqr(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    Type r = rsqrt(1 - sqr(m_value));
+                    t->append_hessian(index_new, m_index, m_index,
+                                      m_value * r * sqr(r));
+                }
+            }
+            return DiffArray::create(t, index_new, asin(m_value));
         }
     }
 
@@ -591,11 +864,18 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("acos_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("acos", slices(m_value), m_index,
-                                           -rsqrt(1 - sqr(m_value)));
-            return DiffArray::create(index_new, acos(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("acos", slices(m_value), m_index,
+                                      -rsqrt(1 - sqr(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    Type r = rsqrt(1 - sqr(m_value));
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -m_value * r * sqr(r));
+                }
+            }
+            return DiffArray::create(t, index_new, acos(m_value));
         }
     }
 
@@ -603,11 +883,16 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("atan_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("atan", slices(m_value), m_index,
-                                           rcp(1 + sqr(m_value)));
-            return DiffArray::create(index_new, atan(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("atan", slices(m_value), m_index,
+                                      rcp(1 + sqr(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -2.f * m_value * sqr(rcp(1 + sqr(m_value))));
+            }
+            return DiffArray::create(t, index_new, atan(m_value));
         }
     }
 
@@ -615,16 +900,25 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("atan2_");
         } else {
+            Tape *t = tape(*this, x);
             Index index_new = 0;
 
             if constexpr (Enabled) {
                 Type il2 = rcp(sqr(m_value) + sqr(x.m_value));
-                index_new = tape()->append("atan2", slices(il2),
-                                           m_index, x.m_index,
-                                           il2 * x.m_value, -il2 * m_value);
+                index_new = t->append("atan2", slices(il2),
+                                      m_index, x.m_index,
+                                      il2 * x.m_value, -il2 * m_value);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    Type il4 = sqr(il2), xy = 2.f * x.m_value * m_value * il4;
+                    t->append_hessian(index_new, m_index, m_index, -xy);
+                    t->append_hessian(index_new, x.m_index, x.m_index, xy);
+                    Type cross = (sqr(m_value) - sqr(x.m_value)) * il4;
+                    t->append_hessian(index_new, m_index, x.m_index, cross);
+                    t->append_hessian(index_new, x.m_index, m_index, cross);
+                }
             }
 
-            return DiffArray::create(index_new, atan2(m_value, x.m_value));
+            return DiffArray::create(t, index_new, atan2(m_value, x.m_value));
         }
     }
 
@@ -632,11 +926,15 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("sinh_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             auto [s, c] = sincosh(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("sinh", slices(m_value), m_index, c);
-            return DiffArray::create(index_new, std::move(s));
+            if constexpr (Enabled) {
+                index_new = t->append("sinh", slices(m_value), m_index, c);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index, s);
+            }
+            return DiffArray::create(t, index_new, std::move(s));
         }
     }
 
@@ -644,11 +942,15 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("cosh_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             auto [s, c] = sincosh(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("cosh", slices(m_value), m_index, s);
-            return DiffArray::create(index_new, std::move(c));
+            if constexpr (Enabled) {
+                index_new = t->append("cosh", slices(m_value), m_index, s);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index, c);
+            }
+            return DiffArray::create(t, index_new, std::move(c));
         }
     }
 
@@ -656,12 +958,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("csch_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = csch(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("csch", slices(m_value), m_index,
-                                           -result * coth(m_value));
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("csch", slices(m_value), m_index,
+                                      -result * coth(m_value));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      result * (sqr(coth(m_value)) + sqr(result)));
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -669,12 +976,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("sech_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = sech(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("sech", slices(m_value), m_index,
-                                           -result * tanh(m_value));
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("sech", slices(m_value), m_index,
+                                      -result * tanh(m_value));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      result * (sqr(tanh(m_value)) - sqr(result)));
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -682,12 +994,17 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("tanh_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = tanh(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("index", slices(m_value), m_index,
-                                           sqr(sech(m_value)));
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("index", slices(m_value), m_index,
+                                      sqr(sech(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -2.f * result * sqr(sech(m_value)));
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -695,11 +1012,18 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("asinh_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("asinh", slices(m_value), m_index,
-                                           rsqrt((Scalar) 1 + sqr(m_value)));
-            return DiffArray::create(index_new, asinh(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("asinh", slices(m_value), m_index,
+                                      rsqrt((Scalar) 1 + sqr(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    Type r = rsqrt((Scalar) 1 + sqr(m_value));
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -m_value * r * sqr(r));
+                }
+            }
+            return DiffArray::create(t, index_new, asinh(m_value));
         }
     }
 
@@ -707,11 +1031,18 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("acosh_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("acosh", slices(m_value), m_index,
-                                           rsqrt(sqr(m_value) - (Scalar) 1));
-            return DiffArray::create(index_new, acosh(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("acosh", slices(m_value), m_index,
+                                      rsqrt(sqr(m_value) - (Scalar) 1));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new))) {
+                    Type r = rsqrt(sqr(m_value) - (Scalar) 1);
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -m_value * r * sqr(r));
+                }
+            }
+            return DiffArray::create(t, index_new, acosh(m_value));
         }
     }
 
@@ -719,11 +1050,16 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("atanh_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("atanh", slices(m_value), m_index,
-                                           rcp((Scalar) 1 - sqr(m_value)));
-            return DiffArray::create(index_new, atanh(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("atanh", slices(m_value), m_index,
+                                      rcp((Scalar) 1 - sqr(m_value)));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      2.f * m_value * sqr(rcp((Scalar) 1 - sqr(m_value))));
+            }
+            return DiffArray::create(t, index_new, atanh(m_value));
         }
     }
 
@@ -731,12 +1067,16 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("exp_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = exp(m_value);
-            if constexpr (Enabled)
-                index_new = tape()->append("exp", slices(m_value),
-                                           m_index, result);
-            return DiffArray::create(index_new, std::move(result));
+            if constexpr (Enabled) {
+                index_new = t->append("exp", slices(m_value),
+                                      m_index, result);
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index, result);
+            }
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -744,11 +1084,16 @@ public:
         if constexpr (is_mask_v<Type> || !std::is_floating_point_v<Scalar>) {
             fail_unsupported("log_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
-            if constexpr (Enabled)
-                index_new = tape()->append("log", slices(m_value), m_index,
-                                           rcp(m_value));
-            return DiffArray::create(index_new, log(m_value));
+            if constexpr (Enabled) {
+                index_new = t->append("log", slices(m_value), m_index,
+                                      rcp(m_value));
+                if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                    t->append_hessian(index_new, m_index, m_index,
+                                      -sqr(rcp(m_value)));
+            }
+            return DiffArray::create(t, index_new, log(m_value));
         }
     }
 
@@ -760,10 +1105,11 @@ public:
     }
 
     template <typename Mask> DiffArray or_(const Mask &m) const {
+        Tape *t = tape(*this);
         Index index_new = 0;
         if constexpr (Enabled && is_mask_v<Mask>)
-            index_new = tape()->append("or", slices(m_value), m_index, 1);
-        return DiffArray::create(index_new, m_value | m.value_());
+            index_new = t->append("or", slices(m_value), m_index, 1);
+        return DiffArray::create(t, index_new, m_value | m.value_());
     }
 
     DiffArray and_(const DiffArray &m) const {
@@ -775,11 +1121,12 @@ public:
 
     template <typename Mask>
     DiffArray and_(const Mask &m) const {
+        Tape *t = tape(*this);
         Index index_new = 0;
         if constexpr (Enabled && is_mask_v<Mask>)
-            index_new = tape()->append("and", slices(m_value), m_index,
-                                       select(m.value_(), Type(1), Type(0)));
-        return DiffArray::create(index_new, m_value & m.value_());
+            index_new = t->append("and", slices(m_value), m_index,
+                                  select(m.value_(), Type(1), Type(0)));
+        return DiffArray::create(t, index_new, m_value & m.value_());
     }
 
     DiffArray xor_(const DiffArray &m) const {
@@ -968,7 +1315,7 @@ public:
         if constexpr (Enabled)
             index_new = tape()->append_gather(offset.value_(), mask.value_());
 
-        return DiffArray::create(index_new, std::move(result));
+        return DiffArray::create(tape(), index_new, std::move(result));
     }
 
     template <size_t Stride, typename Offset, typename Mask>
@@ -978,8 +1325,10 @@ public:
 
         scatter<Stride>(ptr, m_value, offset.value_(), mask.value_());
 
-        if constexpr (Enabled)
+        if constexpr (Enabled) {
+            assert(m_index == 0 || m_tape == Tape::get());
             tape()->append_scatter(m_index, offset.value_(), mask.value_(), false);
+        }
     }
 
     template <size_t Stride, typename Offset, typename Mask>
@@ -989,8 +1338,10 @@ public:
 
         scatter_add<Stride>(ptr, m_value, offset.value_(), mask.value_());
 
-        if constexpr (Enabled)
+        if constexpr (Enabled) {
+            assert(m_index == 0 || m_tape == Tape::get());
             tape()->append_scatter(m_index, offset.value_(), mask.value_(), true);
+        }
     }
 
     //! @}
@@ -1025,11 +1376,12 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("hsum_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             if constexpr (Enabled)
-                index_new = tape()->append("hsum", 1, m_index, 1.f);
+                index_new = t->append("hsum", 1, m_index, 1.f);
 
-            return DiffArray::create(index_new, hsum(m_value));
+            return DiffArray::create(t, index_new, hsum(m_value));
         }
     }
 
@@ -1037,13 +1389,16 @@ public:
         if constexpr (is_mask_v<Type> || std::is_pointer_v<Scalar>) {
             fail_unsupported("hprod_");
         } else {
+            Tape *t = tape(*this);
             Index index_new = 0;
             Type result = hprod(m_value);
             if constexpr (Enabled)
-                index_new = tape()->append(
-                    "hprod", 1, m_index,
-                    select(eq(m_value, (Scalar) 0), (Scalar) 0, result / m_value));
-            return DiffArray::create(index_new, std::move(result));
+                index_new = t->append(
+               "hprod", 1, m_index,
+               select(eq(m_value, (Scalar) 0), (Scalar) 0, result / m_value));
+            if (ENOKI_UNLIKELY(record_hessian(t, index_new)))
+                fail_unsupported("hprod_: second-order derivatives are not implemented!");
+            return DiffArray::create(t, index_new, std::move(result));
         }
     }
 
@@ -1087,15 +1442,22 @@ public:
     //! @{ \name Access to internals
     // -----------------------------------------------------------------------
 
-    void set_index_(Index index) {
+    /// Attach to the node \c index of \c tape (the current tape by default)
+    void set_index_(Index index, Tape *tape = nullptr) {
         if constexpr (Enabled) {
-            auto t = tape();
-            t->inc_ref_ext(index);
-            t->dec_ref_ext(m_index);
+            if (tape == nullptr)
+                tape = Tape::get();
+            if (index != 0)
+                tape->inc_ref_ext(index);
+            if (m_index != 0)
+                m_tape->dec_ref_ext(m_index);
+            m_tape = tape;
         }
         m_index = index;
     }
     Index index_() const { return m_index; }
+    /// Return the tape that owns this variable (or the current one, if detached)
+    Tape *tape_() const { return tape(*this); }
     Type &value_() { return m_value; }
     const Type &value_() const { return m_value; }
 
@@ -1162,7 +1524,7 @@ public:
         if constexpr (!Enabled)
             fail_unsupported("gradient_");
         else
-            return tape()->gradient(m_index);
+            return tape(*this)->gradient(m_index);
     }
 
     static const Type &gradient_static_(Index index) {
@@ -1176,7 +1538,7 @@ public:
         if constexpr (!Enabled)
             fail_unsupported("set_gradient_");
         else
-            return tape()->set_gradient(m_index, value, backward);
+            return tape(*this)->set_gradient(m_index, value, backward);
     }
 
     //! @}
@@ -1205,9 +1567,10 @@ public:
             fail_unsupported("set_requires_gradient_");
         } else {
             if (value && m_index == 0) {
-                m_index = tape()->append_leaf(slices(m_value));
+                m_tape = Tape::get();
+                m_index = m_tape->append_leaf(slices(m_value));
             } else if (!value && m_index != 0) {
-                tape()->dec_ref_ext(m_index);
+                m_tape->dec_ref_ext(m_index);
                 m_index = 0;
             }
         }
@@ -1220,7 +1583,7 @@ public:
     void set_label_(const char *label) const {
         ENOKI_MARK_USED(label);
         if constexpr (Enabled)
-            tape()->set_label(m_index, label);
+            tape(*this)->set_label(m_index, label);
         set_label(m_value, label);
     }
 
@@ -1228,7 +1591,7 @@ public:
         if constexpr (!Enabled) {
             fail_unsupported("backward_");
         } else {
-            tape()->backward(m_index, free_graph);
+            tape(*this)->backward(m_index, free_graph);
         }
     }
 
@@ -1236,7 +1599,7 @@ public:
         if constexpr (!Enabled) {
             fail_unsupported("forward_");
         } else {
-            tape()->forward(m_index, free_graph);
+            tape(*this)->forward(m_index, free_graph);
         }
     }
 
@@ -1248,6 +1611,38 @@ public:
         tape()->forward(free_graph);
     }
 
+    static std::vector<Type> backward_batch_(const std::vector<Index> &outputs,
+                                             const std::vector<Type> &seeds,
+                                             const std::vector<Index> &inputs,
+                                             bool free_graph) {
+        if constexpr (!Enabled)
+            fail_unsupported("backward_batch_");
+        else
+            return tape()->backward_batch(outputs, seeds, inputs, free_graph);
+    }
+
+    static std::vector<Type> hvp_(const std::vector<Index> &outputs,
+                                  const std::vector<Index> &inputs,
+                                  const std::vector<Type> &tangents,
+                                  bool free_graph) {
+        if constexpr (!Enabled)
+            fail_unsupported("hvp_");
+        else
+            return tape()->hvp(outputs, inputs, tangents, free_graph);
+    }
+
+    static void set_second_order_(bool value) {
+        if constexpr (Enabled)
+            tape()->set_second_order(value);
+    }
+
+    static bool second_order_() {
+        if constexpr (Enabled)
+            return tape()->second_order();
+        else
+            return false;
+    }
+
     static std::string graphviz_(const std::vector<Index> &indices) {
         if constexpr (!Enabled)
             fail_unsupported("graphviz_");
@@ -1278,9 +1673,59 @@ public:
     static void set_scatter_gather_operand_(const DiffArray &v, bool permute) {
         ENOKI_MARK_USED(v);
         ENOKI_MARK_USED(permute);
+        if constexpr (Enabled) {
+            /* Scatters attach the target to a new node of the current tape */
+            Tape *t = tape();
+            assert(v.m_index == 0 || v.m_tape == t);
+            const_cast<DiffArray &>(v).m_tape = t;
+            t->set_scatter_gather_operand(const_cast<Index *>(&v.m_index),
+                                          v.size(), permute);
+        }
+    }
+
+    static std::vector<Index>
+    append_checkpoint_(const std::vector<Index> &inputs,
+                       const std::vector<size_t> &output_sizes,
+                       typename Tape::CheckpointCallback callback) {
+        if constexpr (Enabled)
+            return tape()->append_checkpoint(inputs, output_sizes, std::move(callback));
+        else
+            return std::vector<Index>(output_sizes.size(), 0);
+    }
+
+    static std::vector<Index>
+    append_custom_(const std::vector<Index> &inputs,
+                   const std::vector<size_t> &output_sizes,
+                   std::shared_ptr<typename Tape::CustomOp> op) {
         if constexpr (Enabled)
-            tape()->set_scatter_gather_operand(const_cast<Index *>(&v.m_index),
-                                               v.size(), permute);
+            return tape()->append_custom(inputs, output_sizes, std::move(op));
+        else
+            return std::vector<Index>(output_sizes.size(), 0);
+    }
+
+    using Capture = typename Tape::Capture;
+
+    static Capture *capture_create_() { return Tape::capture_create(); }
+    static void capture_destroy_(Capture *capture) { Tape::capture_destroy(capture); }
+    static void capture_begin_(Capture *capture) { tape()->capture_begin(capture); }
+
+    static void capture_end_(const std::vector<Index> &outputs, bool success) {
+        tape()->capture_end(outputs, success);
+    }
+
+    static void capture_backward_(Capture *capture,
+                                  const std::vector<Type> &grad_out,
+                                  std::vector<Type> &grad_in) {
+        Tape::capture_backward(capture, grad_out, grad_in);
+    }
+
+    void set_capture_input_() {
+        if constexpr (!Enabled) {
+            fail_unsupported("set_capture_input_");
+        } else {
+            m_tape = Tape::get();
+            m_index = m_tape->capture_input(slices(m_value));
+        }
     }
 
     static void clear_scatter_gather_operand_() {
@@ -1306,6 +1751,45 @@ public:
             tape()->set_graph_simplification(level);
     }
 
+    static void set_parallel_backward_(bool value) {
+        if constexpr (Enabled)
+            tape()->set_parallel_backward(value);
+    }
+
+    static void set_sorted_gather_(bool value) {
+        if constexpr (Enabled)
+            tape()->set_sorted_gather(value);
+    }
+
+    static void trim_pool_() {
+        if constexpr (Enabled)
+            tape()->trim_pool();
+    }
+
+    static size_t pool_size_() {
+        if constexpr (Enabled)
+            return tape()->pool_size();
+        else
+            return 0;
+    }
+
+    static void set_profiling_(bool value) {
+        if constexpr (Enabled)
+            tape()->set_profiling(value);
+    }
+
+    static std::map<std::string, typename Tape::ProfileEntry> profile_() {
+        if constexpr (!Enabled)
+            fail_unsupported("profile");
+        else
+            return tape()->profile();
+    }
+
+    static void clear_profile_() {
+        if constexpr (Enabled)
+            tape()->clear_profile();
+    }
+
     static void simplify_graph_() {
         if constexpr (Enabled)
             tape()->simplify_graph();
@@ -1344,13 +1828,41 @@ public:
     }
 
 private:
-    ENOKI_INLINE static Tape* tape() { return Tape::get(); }
+    /**
+     * \brief Return the tape that records operations on the given operands:
+     * the tape owning the first one that is attached to the graph, or the
+     * current tape if there is none. Mixing variables of different tapes
+     * is an error.
+     */
+    template <typename... Args>
+    ENOKI_INLINE static Tape *tape(const Args &... args) {
+        if constexpr (!Enabled) {
+            return nullptr;
+        } else {
+            Tape *result = nullptr;
+            ((result = (result == nullptr && args.m_index != 0) ? args.m_tape : result), ...);
+            assert(((args.m_index == 0 || args.m_tape == result) && ...) &&
+                   "DiffArray: operands were recorded on different tapes!");
+            return result != nullptr ? result : Tape::get();
+        }
+    }
+
+    /// Should the second derivatives of the new node \c index be recorded? (see hvp())
+    ENOKI_INLINE static bool record_hessian(Tape *tape, Index index) {
+        return index != 0 && tape->second_order();
+    }
 
     using Arg = std::conditional_t<std::is_scalar_v<Type>, Type, Type&&>;
 
     ENOKI_INLINE static DiffArray create(Index index, Arg value) {
+        return create(nullptr, index, std::move(value));
+    }
+
+    /// Wrap \c value and attach it to the (new) node \c index of \c tape
+    ENOKI_INLINE static DiffArray create(Tape *tape, Index index, Arg value) {
         DiffArray result(std::move(value));
         result.m_index = index;
+        result.m_tape = tape;
         return result;
     }
 
@@ -1362,6 +1874,8 @@ private:
 
     Type m_value;
     Index m_index = 0;
+    /// Tape that owns the node \c m_index (only valid when \c m_index != 0)
+    Tape *m_tape = nullptr;
 };
 
 template <typename T, enable_if_t<is_diff_array_v<T>> = 0>
@@ -1430,7 +1944,7 @@ template <typename T1> void reattach(T1 &a, const T1 &b) {
         for (size_t i = 0; i < array_size_v<T1>; ++i)
             reattach(a[i], b[i]);
     } else if constexpr (is_diff_array_v<T1>) {
-        a.set_index_(b.index_());
+        a.set_index_(b.index_(), b.tape_());
     } else {
         static_assert(detail::false_v<T1>, "The given array does not support derivatives.");
     }
@@ -1483,6 +1997,541 @@ template <typename T> std::string graphviz(const T &value) {
     return detail::diff_type_t<T>::graphviz_(indices);
 }
 
+namespace detail {
+    /// Invoke 'func' on each differentiable array (of depth 1) within 'value'
+    template <typename T, typename Func>
+    void for_each_diff(T &value, Func &&func) {
+        if constexpr (array_depth_v<std::decay_t<T>> == 1) {
+            func(value);
+        } else {
+            for (size_t i = 0; i < std::decay_t<T>::Size; ++i)
+                for_each_diff(value.coeff(i), func);
+        }
+    }
+};
+
+/**
+ * \brief Evaluate <tt>func(input)</tt> as a checkpointed region
+ *
+ * The operations performed by \c func are not recorded on the tape. Instead,
+ * only the value of \c input is retained, and \c func is evaluated a second
+ * time when gradients are propagated through the region during the backward
+ * pass. This bounds the memory usage of large computations (which is
+ * otherwise dominated by edge weights) at the cost of additional arithmetic.
+ *
+ * \c input and the return value can be differentiable arrays or arrays
+ * thereof (e.g. <tt>Array<FloatD, 3></tt>). \c func must be deterministic
+ * and may only depend on differentiable variables via \c input. Checkpointed
+ * regions don't support forward-mode traversal.
+ */
+template <typename Func, typename Input> auto checkpoint(Func func, const Input &input) {
+    using Output = std::decay_t<decltype(func(input))>;
+    using Diff   = detail::diff_type_t<Input>;
+    using Value  = typename Diff::UnderlyingType;
+    using Index  = typename Diff::Index;
+    static_assert(std::is_same_v<detail::diff_type_t<Output>, Diff>,
+                  "checkpoint(): input and output types are incompatible!");
+
+    std::vector<Index> input_indices;
+    std::vector<Value> input_values;
+    detail::for_each_diff(input, [&](const Diff &v) {
+        input_indices.push_back(v.index_());
+        input_values.push_back(v.value_());
+    });
+
+    /* Evaluate the region without recording it on the tape */
+    Input input_detached = input;
+    detail::for_each_diff(input_detached, [](Diff &v) {
+        v = Diff(Value(v.value_()));
+    });
+    Output output = func(input_detached);
+
+    std::vector<size_t> output_sizes;
+    detail::for_each_diff(output, [&](const Diff &v) {
+        output_sizes.push_back(v.size());
+    });
+
+    auto callback = [func, input_values = std::move(input_values)](
+                        const std::vector<Value> &grad_out,
+                        std::vector<Value> &grad_in) {
+        /* Record the region on a separate tape (the outer tape is busy) */
+        typename Diff::Tape tape;
+        TapeScope<Value> scope(tape);
+        Diff::set_log_level_(0);
+
+        Input in;
+        size_t i = 0;
+        detail::for_each_diff(in, [&](Diff &v) {
+            v = Diff(Value(input_values[i++]));
+            set_requires_gradient(v);
+        });
+
+        Output out = func(in);
+
+        size_t j = 0;
+        bool seeded = false;
+        detail::for_each_diff(out, [&](Diff &v) {
+            const Value &grad = grad_out[j++];
+            if constexpr (is_dynamic_v<Value>) {
+                if (grad.empty())
+                    return;
+            }
+            if (v.index_() != 0) {
+                v.set_gradient_(grad);
+                seeded = true;
+            }
+        });
+
+        if (seeded)
+            backward<Diff>();
+
+        grad_in.clear();
+        detail::for_each_diff(in, [&](Diff &v) {
+            grad_in.push_back(v.gradient_());
+        });
+    };
+
+    std::vector<Index> output_indices = Diff::append_checkpoint_(
+        input_indices, output_sizes, std::move(callback));
+
+    size_t j = 0;
+    detail::for_each_diff(output, [&](Diff &v) {
+        Index index = output_indices[j++];
+        v.set_index_(index);
+        Diff::dec_ref_ext_(index);
+    });
+
+    return output;
+}
+
+/**
+ * \brief Attach a custom operation with hand-written derivatives to the graph
+ *
+ * \c output must contain the result of the operation, evaluated without
+ * recording it on the tape (e.g. using \ref detach()). The function returns a
+ * copy of \c output that depends on the differentiable arrays \c inputs via a
+ * single node, whose derivatives are computed by \c op (an instance of a
+ * subclass of <tt>Tape<Value>::CustomOp</tt>). The gradient arrays passed to
+ * \c op follow the order of the arrays of depth 1 within \c inputs and
+ * \c output (e.g. <tt>x, y, z</tt> for an <tt>Array<FloatD, 3></tt>).
+ */
+template <typename Output, typename Op, typename... Inputs>
+Output custom(std::shared_ptr<Op> op, Output output, const Inputs &... inputs) {
+    using Diff  = detail::diff_type_t<Output>;
+    using Index = typename Diff::Index;
+    static_assert((std::is_same_v<detail::diff_type_t<Inputs>, Diff> && ...),
+                  "custom(): input and output types are incompatible!");
+
+    std::vector<Index> input_indices;
+    auto collect = [&](const Diff &v) { input_indices.push_back(v.index_()); };
+    (detail::for_each_diff(inputs, collect), ...);
+
+    std::vector<size_t> output_sizes;
+    detail::for_each_diff(output, [&](const Diff &v) {
+        if (v.index_() != 0)
+            throw std::runtime_error(
+                "custom(): the output must not be attached to the graph!");
+        output_sizes.push_back(v.size());
+    });
+
+    std::vector<Index> output_indices =
+        Diff::append_custom_(input_indices, output_sizes, std::move(op));
+
+    size_t j = 0;
+    detail::for_each_diff(output, [&](Diff &v) {
+        Index index = output_indices[j++];
+        v.set_index_(index);
+        Diff::dec_ref_ext_(index);
+    });
+
+    return output;
+}
+
+namespace detail {
+    /// Replace the arrays of depth 1 within a (nested) array type by \c Leaf
+    template <typename T, typename Leaf, typename = int> struct replace_leaf {
+        using type = Leaf;
+    };
+    template <typename T, typename Leaf>
+    struct replace_leaf<T, Leaf, enable_if_t<(array_depth_v<T> > 1)>> {
+        using type = typename T::template ReplaceValue<
+            typename replace_leaf<value_t<T>, Leaf>::type>;
+    };
+    template <typename T, typename Leaf>
+    using replace_leaf_t = typename replace_leaf<std::decay_t<T>, Leaf>::type;
+
+    /// Number of arrays of depth 1 within a (nested) array type
+    template <typename T> constexpr size_t leaf_count() {
+        if constexpr (array_depth_v<T> > 1)
+            return array_size_v<T> * leaf_count<value_t<T>>();
+        else
+            return 1;
+    }
+
+    /**
+     * \brief Shared implementation of vectorize_diff() and
+     * vectorize_diff_custom()
+     *
+     * <tt>backward_packet(i, grad_out, inputs, grad_in)</tt> must accumulate
+     * the gradients of the inputs of packet \c i into \c grad_in. Absent
+     * output gradients are passed as null pointers.
+     */
+    template <typename Func, typename Backward, typename... Args>
+    auto vectorize_diff(Func &&func, Backward &&backward_packet, const Args &... args) {
+        using Diff    = diff_type_t<std::tuple_element_t<0, std::tuple<Args...>>>;
+        using Value   = typename Diff::UnderlyingType;
+        using Index   = typename Diff::Index;
+        using Packet  = typename Value::Packet;
+        using OutputP = std::decay_t<decltype(func(std::declval<replace_leaf_t<Args, Packet>>()...))>;
+        using Output  = replace_leaf_t<OutputP, Diff>;
+
+        static_assert(is_dynamic_v<Value> && !is_cuda_array_v<Value>,
+                      "vectorize_diff(): requires differentiable CPU dynamic arrays!");
+        static_assert(std::conjunction_v<std::is_same<diff_type_t<Args>, Diff>...>,
+                      "vectorize_diff(): all arguments must use the same differentiable type!");
+
+        std::vector<Index> input_indices;
+        std::vector<Value> inputs;
+        size_t size = 1;
+        auto collect = [&](const Diff &v) {
+            input_indices.push_back(v.index_());
+            inputs.push_back(v.value_());
+            size = std::max(size, v.size());
+        };
+        (for_each_diff(args, collect), ...);
+
+        for (Value &v : inputs) {
+            if (v.size() == 1 && size != 1)
+                set_slices(v, size);
+            else if (v.size() != size)
+                throw std::runtime_error(
+                    "vectorize_diff(): vector arguments have incompatible lengths");
+        }
+
+        /* Evaluate the kernel without recording its operations */
+        std::vector<Value> outputs(leaf_count<OutputP>(), empty<Value>(size));
+        for (size_t i = 0; i < packets(inputs[0]); ++i) {
+            size_t j = 0;
+            auto load = [&](Packet &p) { p = inputs[j++].packet(i); };
+            std::tuple<replace_leaf_t<Args, Packet>...> in;
+            std::apply([&](auto &... a) { (for_each_diff(a, load), ...); }, in);
+
+            OutputP out = std::apply(func, in);
+
+            size_t k = 0;
+            for_each_diff(out, [&](const Packet &p) { outputs[k++].packet(i) = p; });
+        }
+
+        std::vector<size_t> output_sizes(outputs.size(), size);
+        auto callback = [backward_packet = std::forward<Backward>(backward_packet),
+                         inputs](const std::vector<Value> &grad_out,
+                                 std::vector<Value> &grad_in) {
+            size_t size = inputs[0].size();
+            grad_in.clear();
+            for (size_t j = 0; j < inputs.size(); ++j)
+                grad_in.push_back(zero<Value>(size));
+
+            /* Broadcast scalar gradients, skip absent ones */
+            std::vector<Value> broadcast(grad_out.size());
+            std::vector<const Value *> grad_out_p(grad_out.size(), nullptr);
+            for (size_t k = 0; k < grad_out.size(); ++k) {
+                if (grad_out[k].empty())
+                    continue;
+                grad_out_p[k] = &grad_out[k];
+                if (grad_out[k].size() == 1 && size != 1) {
+                    broadcast[k] = grad_out[k];
+                    set_slices(broadcast[k], size);
+                    grad_out_p[k] = &broadcast[k];
+                }
+            }
+
+            for (size_t i = 0; i < packets(inputs[0]); ++i)
+                backward_packet(i, grad_out_p, inputs, grad_in);
+        };
+
+        std::vector<Index> output_indices = Diff::append_checkpoint_(
+            input_indices, output_sizes, std::move(callback));
+
+        Output output;
+        size_t k = 0;
+        for_each_diff(output, [&](Diff &v) {
+            Index index = output_indices[k];
+            v = Diff(std::move(outputs[k++]));
+            v.set_index_(index);
+            Diff::dec_ref_ext_(index);
+        });
+        return output;
+    }
+}
+
+/**
+ * \brief Evaluate a packet kernel over differentiable CPU arrays and record
+ * it as a single node of the computation graph
+ *
+ * \c func is invoked with one packet (or array of packets) per argument,
+ * like the function passed to \ref vectorize(). It must be a generic function
+ * (e.g. a lambda with \c auto parameters), since the backward pass evaluates
+ * it a second time using \ref Dual numbers that carry one tangent per packet
+ * input. Instead of one node per arithmetic operation, the tape thus only
+ * contains a node per output and retains the values of the inputs.
+ *
+ * All arguments must be differentiable arrays (or arrays thereof) of equal
+ * size or size 1. Forward-mode traversal of the resulting nodes is not
+ * supported.
+ */
+template <typename Func, typename... Args>
+auto vectorize_diff(Func func, const Args &... args) {
+    using Value   = typename detail::diff_type_t<std::tuple_element_t<0, std::tuple<Args...>>>::UnderlyingType;
+    using Packet  = typename Value::Packet;
+    using OutputP = std::decay_t<decltype(func(std::declval<detail::replace_leaf_t<Args, Packet>>()...))>;
+    constexpr size_t Inputs  = (detail::leaf_count<Args>() + ...);
+    using DualP = Dual<Packet, Inputs>;
+
+    auto backward_packet = [func](size_t i, const std::vector<const Value *> &grad_out,
+                                  const std::vector<Value> &inputs,
+                                  std::vector<Value> &grad_in) {
+        size_t j = 0;
+        auto load = [&](DualP &p) {
+            p = DualP(inputs[j].packet(i));
+            p.set_tangent_(j++, Packet(1));
+        };
+        std::tuple<detail::replace_leaf_t<Args, DualP>...> in;
+        std::apply([&](auto &... a) { (detail::for_each_diff(a, load), ...); }, in);
+
+        detail::replace_leaf_t<OutputP, DualP> out = std::apply(func, in);
+
+        size_t k = 0;
+        detail::for_each_diff(out, [&](const DualP &p) {
+            const Value *g = grad_out[k++];
+            if (!g)
+                return;
+            Packet gp = g->packet(i);
+            for (size_t l = 0; l < Inputs; ++l)
+                grad_in[l].packet(i) = fmadd(gp, p.tangent_(l), grad_in[l].packet(i));
+        });
+    };
+
+    return detail::vectorize_diff(func, backward_packet, args...);
+}
+
+/**
+ * \brief Variant of \ref vectorize_diff() with a user-provided backward pass
+ *
+ * <tt>func_backward(grad_out, args...)</tt> is invoked with the gradient of
+ * the output packet and the input packets. It must return a \c std::tuple
+ * containing the gradients of the input packets (using the same types).
+ * \c func need not be generic in this case.
+ */
+template <typename Func, typename FuncBackward, typename... Args>
+auto vectorize_diff_custom(Func func, FuncBackward func_backward, const Args &... args) {
+    using Value   = typename detail::diff_type_t<std::tuple_element_t<0, std::tuple<Args...>>>::UnderlyingType;
+    using Packet  = typename Value::Packet;
+    using OutputP = std::decay_t<decltype(func(std::declval<detail::replace_leaf_t<Args, Packet>>()...))>;
+
+    auto backward_packet = [func_backward](size_t i, const std::vector<const Value *> &grad_out,
+                                           const std::vector<Value> &inputs,
+                                           std::vector<Value> &grad_in) {
+        size_t j = 0;
+        auto load = [&](Packet &p) { p = inputs[j++].packet(i); };
+        std::tuple<detail::replace_leaf_t<Args, Packet>...> in;
+        std::apply([&](auto &... a) { (detail::for_each_diff(a, load), ...); }, in);
+
+        size_t k = 0;
+        OutputP go;
+        detail::for_each_diff(go, [&](Packet &p) {
+            const Value *g = grad_out[k++];
+            p = g ? g->packet(i) : zero<Packet>();
+        });
+
+        std::tuple<detail::replace_leaf_t<Args, Packet>...> gi = std::apply(
+            [&](const auto &... a) { return func_backward(go, a...); }, in);
+
+        size_t l = 0;
+        std::apply([&](auto &... a) {
+            (detail::for_each_diff(a, [&](const Packet &p) {
+                 grad_in[l].packet(i) += p;
+                 l++;
+             }), ...);
+        }, gi);
+    };
+
+    return detail::vectorize_diff(func, backward_packet, args...);
+}
+
+/**
+ * \brief Differentiable function whose computation graph is recorded once
+ * and replayed during subsequent evaluations
+ *
+ * The first call records the graph of <tt>func(input)</tt> into a compact
+ * representation that is owned by this object and independent of the tape.
+ * Subsequent calls evaluate \c func again but merely overwrite the edge
+ * weights, skipping the creation, simplification, and destruction of graph
+ * nodes. The structure of the graph (i.e. the sequence of differentiable
+ * operations) must not change between calls; violations raise an exception.
+ *
+ * Unlike ordinary differentiable functions, the call operator returns
+ * detached values. Gradients are instead computed using \ref backward(),
+ * which maps gradients of the outputs to gradients of the inputs. \c func
+ * may only depend on differentiable variables through its argument and
+ * cannot use differentiable gather/scatter operations.
+ */
+template <typename Input, typename Func> struct CapturedFunction {
+    using Diff   = detail::diff_type_t<Input>;
+    using Value  = typename Diff::UnderlyingType;
+    using Index  = typename Diff::Index;
+    using Output = std::decay_t<decltype(std::declval<Func &>()(std::declval<const Input &>()))>;
+
+    CapturedFunction(Func func)
+        : m_func(std::move(func)), m_capture(Diff::capture_create_()) { }
+
+    ~CapturedFunction() { Diff::capture_destroy_(m_capture); }
+
+    CapturedFunction(const CapturedFunction &) = delete;
+    CapturedFunction &operator=(const CapturedFunction &) = delete;
+
+    /// Evaluate the function and record/replay its graph
+    Output operator()(const Input &input) {
+        Input in = input;
+        Diff::capture_begin_(m_capture);
+        std::vector<Index> outputs;
+        try {
+            detail::for_each_diff(in, [](Diff &v) {
+                v = Diff(Value(v.value_()));
+                v.set_capture_input_();
+            });
+
+            Output out = m_func(in);
+            detail::for_each_diff(out, [&](Diff &v) {
+                outputs.push_back(v.index_());
+                v = Diff(std::move(v.value_()));
+            });
+
+            Diff::capture_end_(outputs, true);
+            return out;
+        } catch (...) {
+            Diff::capture_end_(outputs, false);
+            throw;
+        }
+    }
+
+    /// Propagate gradients of the outputs to the inputs of the last evaluation
+    Input backward(const Output &grad_output) const {
+        std::vector<Value> grad_out, grad_in;
+        detail::for_each_diff(grad_output, [&](const Diff &v) {
+            grad_out.push_back(v.value_());
+        });
+
+        Diff::capture_backward_(m_capture, grad_out, grad_in);
+
+        Input result;
+        size_t i = 0;
+        detail::for_each_diff(result, [&](Diff &v) {
+            v = Diff(std::move(grad_in[i++]));
+        });
+        return result;
+    }
+
+private:
+    Func m_func;
+    typename Diff::Capture *m_capture;
+};
+
+/// Create a \ref CapturedFunction that takes an argument of type \c Input
+template <typename Input, typename Func> CapturedFunction<Input, Func> capture(Func func) {
+    return CapturedFunction<Input, Func>(std::move(func));
+}
+
+/**
+ * \brief Compute several vector-Jacobian products within a single traversal
+ * of the graph
+ *
+ * Entry \c k of the result holds the gradient of \c input when the gradient
+ * of \c output is set to <tt>seeds[k]</tt>. For instance, seeds that select
+ * individual components of \c output produce the rows of the Jacobian. This
+ * is equivalent to (but considerably faster than) calling \ref set_gradient()
+ * and \ref backward() once per seed. The gradients stored in the graph are
+ * left unchanged.
+ */
+template <typename Output, typename Input>
+std::vector<Input> backward_batch(const Output &output, const std::vector<Output> &seeds,
+                                  const Input &input, bool free_graph = true) {
+    using Diff  = detail::diff_type_t<Output>;
+    using Value = typename Diff::UnderlyingType;
+    using Index = typename Diff::Index;
+
+    std::vector<Index> outputs, inputs;
+    std::vector<Value> seed_values;
+    detail::for_each_diff(output, [&](const Diff &v) { outputs.push_back(v.index_()); });
+    detail::for_each_diff(input, [&](const Diff &v) { inputs.push_back(v.index_()); });
+    for (const Output &seed : seeds)
+        detail::for_each_diff(seed, [&](const Diff &v) { seed_values.push_back(v.value_()); });
+
+    std::vector<Value> grad =
+        Diff::backward_batch_(outputs, seed_values, inputs, free_graph);
+
+    std::vector<Input> result(seeds.size());
+    size_t i = 0;
+    for (Input &r : result)
+        detail::for_each_diff(r, [&](Diff &v) { v = Diff(std::move(grad[i++])); });
+    return result;
+}
+
+/**
+ * \brief Compute the Hessian-vector product <tt>H * v</tt> of \c func at
+ * \c input
+ *
+ * \c H denotes the Hessian of the sum of all entries of
+ * <tt>func(input)</tt>. While \c func is evaluated, each operation records
+ * the derivatives of its edge weights in addition to the weights themselves.
+ * A forward traversal then computes the tangents of all nodes along \c v,
+ * and a single backward traversal propagates both the adjoints and their
+ * directional derivatives (forward-over-reverse). The cost is thus comparable
+ * to that of a gradient evaluation.
+ *
+ * \c input, \c v and the return value can be differentiable arrays or arrays
+ * thereof (e.g. <tt>Array<FloatD, 3></tt>). \c func may only depend on
+ * differentiable variables via \c input. Graph simplification is suspended
+ * until the traversal has finished, and custom operations, checkpoints,
+ * captured functions and \c hprod() are not supported within \c func.
+ */
+template <typename Func, typename Input>
+Input hvp(Func func, const Input &input, const Input &v) {
+    using Diff  = detail::diff_type_t<Input>;
+    using Value = typename Diff::UnderlyingType;
+    using Index = typename Diff::Index;
+
+    Input in = input;
+    std::vector<Index> inputs;
+    std::vector<Value> tangents;
+    detail::for_each_diff(in, [&](Diff &x) {
+        x = Diff(Value(x.value_()));
+        set_requires_gradient(x);
+        inputs.push_back(x.index_());
+    });
+    detail::for_each_diff(v, [&](const Diff &x) { tangents.push_back(x.value_()); });
+
+    bool second_order = Diff::second_order_();
+    Diff::set_second_order_(true);
+    std::vector<Index> outputs;
+    std::vector<Value> result;
+    try {
+        auto out = func(in);
+        static_assert(std::is_same_v<detail::diff_type_t<decltype(out)>, Diff>,
+                      "hvp(): input and output types are incompatible!");
+        detail::for_each_diff(out, [&](const Diff &y) { outputs.push_back(y.index_()); });
+        result = Diff::hvp_(outputs, inputs, tangents, true);
+    } catch (...) {
+        Diff::set_second_order_(second_order);
+        throw;
+    }
+    Diff::set_second_order_(second_order);
+
+    Input hv;
+    size_t i = 0;
+    detail::for_each_diff(hv, [&](Diff &x) { x = Diff(std::move(result[i++])); });
+    return hv;
+}
+
 #if defined(ENOKI_AUTODIFF_BUILD)
 #  define ENOKI_AUTODIFF_EXTERN extern
 #  define ENOKI_AUTODIFF_EXPORT ENOKI_EXPORT
@@ -0,0 +1,531 @@
+/*
+    enoki/dual.h -- Forward-mode automatic differentiation using dual numbers
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <enoki/array.h>
+
+NAMESPACE_BEGIN(enoki)
+
+/// SFINAE helper for dual numbers
+template <typename T> using is_dual_helper = enable_if_t<std::decay_t<T>::IsDual>;
+template <typename T> constexpr bool is_dual_v = is_detected_v<is_dual_helper, T>;
+template <typename T> using enable_if_dual_t = enable_if_t<is_dual_v<T>>;
+
+NAMESPACE_BEGIN(detail)
+template <typename T> struct is_dual : std::false_type { };
+template <typename T, size_t N> struct is_dual<Dual<T, N>> : std::true_type { };
+NAMESPACE_END(detail)
+
+/**
+ * \brief Dual number that propagates \c N tangents (directional derivatives)
+ * alongside a value
+ *
+ * \c Type can be a scalar or a static Enoki array (e.g. <tt>Array<float,
+ * 8></tt>). All operations evaluate the chain rule immediately and store the
+ * tangents by value, hence no tape or heap memory is involved. This makes
+ * \c Dual an efficient alternative to \ref DiffArray when only a few
+ * directional derivatives of a small kernel are needed.
+ *
+ * Like \ref DiffArray, \c Dual plugs into the operator routing of Enoki
+ * arrays: it can be nested within other arrays (e.g. <tt>Array<Dual<float, 3>,
+ * 3></tt>) and is accepted by the standard math functions.
+ */
+template <typename Type_, size_t N_>
+struct Dual : ArrayBase<value_t<Type_>, Dual<Type_, N_>> {
+public:
+    using Base = ArrayBase<value_t<Type_>, Dual<Type_, N_>>;
+    using typename Base::Scalar;
+
+    using Type = Type_;
+    using UnderlyingType = Type;
+    using ArrayType = Dual;
+    using MaskType = Dual<mask_t<Type>, N_>;
+
+    static constexpr size_t Size = is_scalar_v<Type> ? 1 : array_size_v<Type>;
+    static constexpr size_t Depth = is_scalar_v<Type> ? 1 : array_depth_v<Type>;
+    static constexpr bool Approx = array_approx_v<Type>;
+    static constexpr bool IsMask = is_mask_v<Type>;
+    static constexpr bool IsDual = true;
+
+    /// Are tangents tracked? (only for floating point values)
+    static constexpr bool Enabled =
+        std::is_floating_point_v<scalar_t<Type>> && !is_mask_v<Type>;
+
+    /// Number of tangents
+    static constexpr size_t Tangents = Enabled ? N_ : 0;
+
+    template <typename T>
+    using ReplaceValue = Dual<replace_scalar_t<Type, T, false>, N_>;
+
+    static_assert(array_depth_v<Type> <= 1 && !is_dynamic_v<Type>,
+                  "Dual requires a scalar or (non-nested) static Enoki array "
+                  "as template parameter.");
+    static_assert(N_ > 0, "Dual: the number of tangents must be positive!");
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Constructors
+    // -----------------------------------------------------------------------
+
+    Dual() = default;
+    Dual(const Dual &) = default;
+    Dual(Dual &&) = default;
+    Dual &operator=(const Dual &) = default;
+    Dual &operator=(Dual &&) = default;
+
+    template <typename T>
+    Dual(const Dual<T, N_> &v, detail::reinterpret_flag)
+        : m_value(v.value_(), detail::reinterpret_flag()) { clear_tangents_(); }
+
+    template <typename Type2, enable_if_t<!std::is_same_v<Type, Type2>> = 0>
+    Dual(const Dual<Type2, N_> &a) : m_value(a.value_()) {
+        if constexpr (Enabled && Dual<Type2, N_>::Enabled) {
+            for (size_t i = 0; i < Tangents; ++i)
+                m_tangent[i] = Type(a.tangent_(i));
+        } else {
+            clear_tangents_();
+        }
+    }
+
+    template <typename... Args,
+             enable_if_t<sizeof...(Args) != 0 && std::conjunction_v<
+                  std::negation<detail::is_dual<std::decay_t<Args>>>...>> = 0>
+    Dual(Args&&... args) : m_value(std::forward<Args>(args)...) {
+        clear_tangents_();
+    }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Vertical operations
+    // -----------------------------------------------------------------------
+
+    Dual add_(const Dual &a) const {
+        Dual r(m_value + a.m_value, no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = m_tangent[i] + a.m_tangent[i];
+        return r;
+    }
+
+    Dual sub_(const Dual &a) const {
+        Dual r(m_value - a.m_value, no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = m_tangent[i] - a.m_tangent[i];
+        return r;
+    }
+
+    Dual mul_(const Dual &a) const {
+        Dual r(m_value * a.m_value, no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fmadd(m_tangent[i], a.m_value, m_value * a.m_tangent[i]);
+        return r;
+    }
+
+    Dual div_(const Dual &a) const {
+        Type rcp_a = rcp(a.m_value);
+        Dual r(m_value * rcp_a, no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fnmadd(r.m_value, a.m_tangent[i], m_tangent[i]) * rcp_a;
+        return r;
+    }
+
+    Dual fmadd_(const Dual &a, const Dual &b) const {
+        Dual r(fmadd(m_value, a.m_value, b.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fmadd(m_tangent[i], a.m_value,
+                                   fmadd(m_value, a.m_tangent[i], b.m_tangent[i]));
+        return r;
+    }
+
+    Dual fmsub_(const Dual &a, const Dual &b) const {
+        Dual r(fmsub(m_value, a.m_value, b.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fmadd(m_tangent[i], a.m_value,
+                                   fmsub(m_value, a.m_tangent[i], b.m_tangent[i]));
+        return r;
+    }
+
+    Dual fnmadd_(const Dual &a, const Dual &b) const {
+        Dual r(fnmadd(m_value, a.m_value, b.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fnmadd(m_tangent[i], a.m_value,
+                                    fnmadd(m_value, a.m_tangent[i], b.m_tangent[i]));
+        return r;
+    }
+
+    Dual fnmsub_(const Dual &a, const Dual &b) const {
+        Dual r(fnmsub(m_value, a.m_value, b.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fnmadd(m_tangent[i], a.m_value,
+                                    fnmsub(m_value, a.m_tangent[i], b.m_tangent[i]));
+        return r;
+    }
+
+    Dual neg_() const {
+        Dual r(-m_value, no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = -m_tangent[i];
+        return r;
+    }
+
+    Dual abs_() const { return chain_(abs(m_value), sign(m_value)); }
+
+    Dual sqrt_() const {
+        Type result = sqrt(m_value);
+        Type d = .5f * rcp(result);
+        return chain_(std::move(result), d);
+    }
+
+    Dual cbrt_() const {
+        Type result = cbrt(m_value);
+        Type d = (1.f / 3.f) * rcp(sqr(result));
+        return chain_(std::move(result), d);
+    }
+
+    Dual rcp_() const {
+        Type result = rcp(m_value);
+        Type d = -sqr(result);
+        return chain_(std::move(result), d);
+    }
+
+    Dual rsqrt_() const {
+        Type result = rsqrt(m_value);
+        Type d = -.5f * result * sqr(result);
+        return chain_(std::move(result), d);
+    }
+
+    Dual min_(const Dual &a) const {
+        mask_t<Type> m = m_value < a.m_value;
+        Dual r(select(m, m_value, a.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = select(m, m_tangent[i], a.m_tangent[i]);
+        return r;
+    }
+
+    Dual max_(const Dual &a) const {
+        mask_t<Type> m = m_value > a.m_value;
+        Dual r(select(m, m_value, a.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = select(m, m_tangent[i], a.m_tangent[i]);
+        return r;
+    }
+
+    static Dual select_(const MaskType &m, const Dual &t, const Dual &f) {
+        Dual r(select(m.value_(), t.m_value, f.m_value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = select(m.value_(), t.m_tangent[i], f.m_tangent[i]);
+        return r;
+    }
+
+    Dual floor_() const { return Dual(floor(m_value)); }
+    Dual ceil_()  const { return Dual(ceil(m_value)); }
+    Dual trunc_() const { return Dual(trunc(m_value)); }
+    Dual round_() const { return Dual(round(m_value)); }
+
+    template <typename T> T floor2int_() const { return T(floor2int<typename T::Type>(m_value)); }
+    template <typename T> T ceil2int_() const { return T(ceil2int<typename T::Type>(m_value)); }
+
+    Dual exp_() const {
+        Type result = exp(m_value);
+        return chain_(result, result);
+    }
+
+    Dual log_() const { return chain_(log(m_value), rcp(m_value)); }
+
+    Dual sin_() const {
+        auto [s, c] = sincos(m_value);
+        return chain_(std::move(s), c);
+    }
+
+    Dual cos_() const {
+        auto [s, c] = sincos(m_value);
+        return chain_(std::move(c), -s);
+    }
+
+    std::pair<Dual, Dual> sincos_() const {
+        auto [s, c] = sincos(m_value);
+        return { chain_(s, c), chain_(c, -s) };
+    }
+
+    Dual tan_() const {
+        Type result = tan(m_value);
+        return chain_(result, fmadd(result, result, 1.f));
+    }
+
+    Dual asin_() const {
+        return chain_(asin(m_value), rsqrt(fnmadd(m_value, m_value, 1.f)));
+    }
+
+    Dual acos_() const {
+        return chain_(acos(m_value), -rsqrt(fnmadd(m_value, m_value, 1.f)));
+    }
+
+    Dual atan_() const {
+        return chain_(atan(m_value), rcp(fmadd(m_value, m_value, 1.f)));
+    }
+
+    /// atan2(*this, x)
+    Dual atan2_(const Dual &x) const {
+        Type il2 = rcp(fmadd(m_value, m_value, sqr(x.m_value)));
+        return chain_(atan2(m_value, x.m_value), x.m_value * il2,
+                      x, -m_value * il2);
+    }
+
+    Dual sinh_() const {
+        auto [s, c] = sincosh(m_value);
+        return chain_(std::move(s), c);
+    }
+
+    Dual cosh_() const {
+        auto [s, c] = sincosh(m_value);
+        return chain_(std::move(c), s);
+    }
+
+    std::pair<Dual, Dual> sincosh_() const {
+        auto [s, c] = sincosh(m_value);
+        return { chain_(s, c), chain_(c, s) };
+    }
+
+    Dual tanh_() const {
+        Type result = tanh(m_value);
+        return chain_(result, fnmadd(result, result, 1.f));
+    }
+
+    Dual asinh_() const {
+        return chain_(asinh(m_value), rsqrt(fmadd(m_value, m_value, 1.f)));
+    }
+
+    Dual acosh_() const {
+        return chain_(acosh(m_value), rsqrt(fmsub(m_value, m_value, 1.f)));
+    }
+
+    Dual atanh_() const {
+        return chain_(atanh(m_value), rcp(fnmadd(m_value, m_value, 1.f)));
+    }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Comparisons and mask operations
+    // -----------------------------------------------------------------------
+
+    auto eq_ (const Dual &d) const { return MaskType(eq(m_value, d.m_value)); }
+    auto neq_(const Dual &d) const { return MaskType(neq(m_value, d.m_value)); }
+    auto lt_ (const Dual &d) const { return MaskType(m_value < d.m_value); }
+    auto le_ (const Dual &d) const { return MaskType(m_value <= d.m_value); }
+    auto gt_ (const Dual &d) const { return MaskType(m_value > d.m_value); }
+    auto ge_ (const Dual &d) const { return MaskType(m_value >= d.m_value); }
+
+    Dual or_(const Dual &m) const { return Dual(m_value | m.m_value); }
+    Dual and_(const Dual &m) const { return Dual(m_value & m.m_value); }
+    Dual xor_(const Dual &m) const { return Dual(m_value ^ m.m_value); }
+    Dual andnot_(const Dual &m) const { return Dual(andnot(m_value, m.m_value)); }
+    Dual not_() const { return Dual(~m_value); }
+
+    /// Mask the value and tangents (e.g. <tt>x & (x > 0)</tt>)
+    template <typename Mask, enable_if_t<is_mask_v<Mask>> = 0>
+    Dual and_(const Mask &m) const {
+        Dual r(m_value & m.value_(), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = m_tangent[i] & m.value_();
+        return r;
+    }
+
+    template <typename Mask, enable_if_t<is_mask_v<Mask>> = 0>
+    Dual andnot_(const Mask &m) const {
+        Dual r(andnot(m_value, m.value_()), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = andnot(m_tangent[i], m.value_());
+        return r;
+    }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Horizontal operations
+    // -----------------------------------------------------------------------
+
+    auto all_() const { return all(m_value); }
+    auto any_() const { return any(m_value); }
+    auto count_() const { return count(m_value); }
+
+    auto hsum_() const {
+        Dual<scalar_t<Type>, N_> r(hsum(m_value));
+        for (size_t i = 0; i < Tangents; ++i)
+            r.set_tangent_(i, hsum(m_tangent[i]));
+        return r;
+    }
+
+    auto dot_(const Dual &a) const { return mul_(a).hsum_(); }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Access to internals
+    // -----------------------------------------------------------------------
+
+    Type &value_() { return m_value; }
+    const Type &value_() const { return m_value; }
+
+    /// Return the tangent with index \c i
+    const Type &tangent_(size_t i) const { return m_tangent[i]; }
+
+    /// Set the tangent with index \c i
+    void set_tangent_(size_t i, const Type &value) { m_tangent[i] = value; }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Coefficient access
+    // -----------------------------------------------------------------------
+
+    ENOKI_INLINE size_t size() const { return Size; }
+
+    ENOKI_INLINE Scalar *data() {
+        if constexpr (is_scalar_v<Type>)
+            return &m_value;
+        else
+            return m_value.data();
+    }
+
+    ENOKI_INLINE const Scalar *data() const {
+        if constexpr (is_scalar_v<Type>)
+            return &m_value;
+        else
+            return m_value.data();
+    }
+
+    /// Access a coefficient of the value (tangents are not included)
+    template <typename... Args>
+    ENOKI_INLINE decltype(auto) coeff(Args... args) {
+        static_assert(sizeof...(Args) == Depth, "coeff(): Invalid number of arguments!");
+        if constexpr (is_scalar_v<Type>)
+            return m_value;
+        else
+            return m_value.coeff((size_t) args...);
+    }
+
+    template <typename... Args>
+    ENOKI_INLINE decltype(auto) coeff(Args... args) const {
+        static_assert(sizeof...(Args) == Depth, "coeff(): Invalid number of arguments!");
+        if constexpr (is_scalar_v<Type>)
+            return m_value;
+        else
+            return m_value.coeff((size_t) args...);
+    }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------
+    //! @{ \name Standard initializers
+    // -----------------------------------------------------------------------
+
+    template <typename... Args>
+    static Dual empty_(Args... args) { return enoki::empty<Type>(args...); }
+    template <typename... Args>
+    static Dual zero_(Args... args) { return zero<Type>(args...); }
+    template <typename... Args>
+    static Dual arange_(Args... args) { return arange<Type>(args...); }
+    template <typename... Args>
+    static Dual linspace_(Args... args) { return linspace<Type>(args...); }
+    template <typename... Args>
+    static Dual full_(Args... args) { return full<Type>(args...); }
+
+    //! @}
+    // -----------------------------------------------------------------------
+
+private:
+    struct no_init_t { };
+    static constexpr no_init_t no_init { };
+
+    /// Create a dual number with uninitialized tangents
+    Dual(Type &&value, no_init_t) : m_value(std::move(value)) { }
+
+    void clear_tangents_() {
+        for (size_t i = 0; i < Tangents; ++i)
+            m_tangent[i] = zero<Type>();
+    }
+
+    /// Chain rule for unary operations: tangent = d * tangent(this)
+    Dual chain_(Type value, const Type &d) const {
+        Dual r(std::move(value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = d * m_tangent[i];
+        return r;
+    }
+
+    /// Chain rule for binary operations: tangent = d1 * tangent(this) + d2 * tangent(a)
+    Dual chain_(Type value, const Type &d1, const Dual &a, const Type &d2) const {
+        Dual r(std::move(value), no_init);
+        for (size_t i = 0; i < Tangents; ++i)
+            r.m_tangent[i] = fmadd(d1, m_tangent[i], d2 * a.m_tangent[i]);
+        return r;
+    }
+
+    Type m_value;
+    std::array<Type, Tangents> m_tangent;
+};
+
+/// Return the value of a dual number (or an array of dual numbers)
+template <typename T> decltype(auto) primal(const T &a) {
+    if constexpr (is_dual_v<T> && array_depth_v<T> == 1) {
+        return a.value_();
+    } else if constexpr (is_dual_v<value_t<T>> || array_depth_v<T> >= 2) {
+        using Entry = std::decay_t<decltype(primal(a.coeff(0)))>;
+        Array<Entry, array_size_v<T>> result;
+        for (size_t i = 0; i < array_size_v<T>; ++i)
+            result.coeff(i) = primal(a.coeff(i));
+        return result;
+    } else {
+        return a;
+    }
+}
+
+/// Return the tangent with index \c i of a dual number (or an array of dual numbers)
+template <typename T> auto tangent(const T &a, size_t i = 0) {
+    if constexpr (is_dual_v<T> && array_depth_v<T> == 1) {
+        return a.tangent_(i);
+    } else {
+        static_assert(array_depth_v<T> >= 2,
+                      "tangent(): the given array does not consist of dual numbers!");
+        using Entry = decltype(tangent(a.coeff(0), i));
+        Array<Entry, array_size_v<T>> result;
+        for (size_t j = 0; j < array_size_v<T>; ++j)
+            result.coeff(j) = tangent(a.coeff(j), i);
+        return result;
+    }
+}
+
+/// Set the tangent with index \c i of a dual number (or an array of dual numbers)
+template <typename T1, typename T2> void set_tangent(T1 &a, const T2 &value, size_t i = 0) {
+    if constexpr (is_dual_v<T1> && array_depth_v<T1> == 1) {
+        a.set_tangent_(i, typename T1::Type(value));
+    } else {
+        static_assert(array_depth_v<T1> >= 2,
+                      "set_tangent(): the given array does not consist of dual numbers!");
+        for (size_t j = 0; j < array_size_v<T1>; ++j) {
+            if constexpr (is_array_v<T2>)
+                set_tangent(a.coeff(j), value.coeff(j), i);
+            else
+                set_tangent(a.coeff(j), value, i);
+        }
+    }
+}
+
+NAMESPACE_END(enoki)
@@ -14,6 +14,9 @@
 #pragma once
 
 #include <enoki/array.h>
+#include <enoki/alloc.h>
+#include <enoki/parallel.h>
+#include <tuple>
 
 #if defined(__GNUC__) && !defined(__clang__)
 #  pragma GCC diagnostic push
@@ -24,6 +27,13 @@
 
 NAMESPACE_BEGIN(enoki)
 
+/// Deferred dynamic array expression (see \ref lazy())
+template <typename Node> struct Lazy;
+
+template <typename T> struct is_lazy : std::false_type { };
+template <typename Node> struct is_lazy<Lazy<Node>> : std::true_type { };
+template <typename T> constexpr bool is_lazy_v = is_lazy<std::decay_t<T>>::value;
+
 template <typename Packet_>
 struct DynamicArrayReference : ArrayBase<value_t<Packet_>, DynamicArrayReference<Packet_>> {
     using Base = ArrayBase<value_t<Packet_>, DynamicArrayReference<Packet_>>;
@@ -53,6 +63,310 @@ private:
     Packet *m_packets;
 };
 
+NAMESPACE_BEGIN(detail)
+
+/// Open addressing hash table that maps keys to consecutive bucket indices
+template <typename Key> struct key_buckets {
+    /// Distinct keys, in order of their first occurrence
+    std::vector<Key> keys;
+    /// Number of entries per bucket
+    std::vector<uint32_t> counts;
+    /// Bucket index + 1 for each slot, or 0 if unused
+    std::vector<uint32_t> table;
+
+    uint32_t lookup(Key key) {
+        if (ENOKI_UNLIKELY(2 * (keys.size() + 1) > table.size()))
+            rehash(std::max(table.size() * 2, (size_t) 16));
+
+        size_t mask = table.size() - 1, i = hash(key) & mask;
+        while (true) {
+            uint32_t bucket = table[i];
+            if (bucket == 0) {
+                table[i] = (uint32_t) keys.size() + 1;
+                keys.push_back(key);
+                counts.push_back(0);
+                return (uint32_t) keys.size() - 1;
+            } else if (keys[bucket - 1] == key) {
+                return bucket - 1;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+private:
+    static size_t hash(Key key) {
+        uint64_t h = (uint64_t) key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return (size_t) h;
+    }
+
+    void rehash(size_t size) {
+        table.assign(size, 0u);
+        for (size_t j = 0; j < keys.size(); ++j) {
+            size_t i = hash(keys[j]) & (size - 1);
+            while (table[i] != 0)
+                i = (i + 1) & (size - 1);
+            table[i] = (uint32_t) j + 1;
+        }
+    }
+};
+
+/**
+ * \brief Assign a bucket to each entry of <tt>keys[start, end)</tt>
+ *
+ * Runs of a single key that span an entire packet (the common case for
+ * coherent arrays) are handled using one vector comparison and store.
+ */
+template <size_t PacketSize, typename Key>
+void partition_count(const Key *keys, size_t start, size_t end,
+                     key_buckets<Key> &buckets, uint32_t *ids) {
+    using KeyP  = Packet<Key, PacketSize>;
+    using IdP   = Packet<uint32_t, PacketSize>;
+
+    if (start == end)
+        return;
+
+    Key last_key = keys[start];
+    uint32_t last_id = buckets.lookup(last_key);
+
+    size_t i = start;
+    for (; i + PacketSize <= end; i += PacketSize) {
+        if (all(eq(load_unaligned<KeyP>(keys + i), KeyP(last_key)))) {
+            store_unaligned(ids + i, IdP(last_id));
+            buckets.counts[last_id] += (uint32_t) PacketSize;
+            continue;
+        }
+
+        for (size_t j = i; j < i + PacketSize; ++j) {
+            Key key = keys[j];
+            if (key != last_key) {
+                last_key = key;
+                last_id = buckets.lookup(key);
+            }
+            buckets.counts[last_id]++;
+            ids[j] = last_id;
+        }
+    }
+
+    for (; i < end; ++i) {
+        Key key = keys[i];
+        if (key != last_key) {
+            last_key = key;
+            last_id = buckets.lookup(key);
+        }
+        buckets.counts[last_id]++;
+        ids[i] = last_id;
+    }
+}
+
+/**
+ * \brief Group the entries of a key array by value in linear time
+ *
+ * The input is split into chunks that are processed in parallel: the first
+ * pass assigns each entry a chunk-local bucket and counts the bucket sizes.
+ * After merging the (typically few) distinct keys of all chunks, the second
+ * pass writes the entry indices to their final positions using per-chunk
+ * offsets. Groups are returned in ascending order of their keys, and the
+ * indices within each group are sorted.
+ */
+template <typename Value, size_t PacketSize, typename Key>
+std::vector<std::pair<Value, DynamicArray<Packet<uint32_t, PacketSize>>>>
+partition_keys(const Key *keys, size_t size) {
+    using UInt32X = DynamicArray<Packet<uint32_t, PacketSize>>;
+
+    size_t chunk_size = std::max((size_t) ENOKI_PARALLEL_CHUNK_SIZE / sizeof(Key),
+                                 PacketSize),
+           chunk_count = (size + chunk_size - 1) / chunk_size;
+
+    std::unique_ptr<uint32_t[]> ids(new uint32_t[size]);
+    std::vector<key_buckets<Key>> chunks(chunk_count);
+
+    parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+        for (size_t c = start; c < end; ++c)
+            partition_count<PacketSize>(keys, c * chunk_size,
+                                        std::min((c + 1) * chunk_size, size),
+                                        chunks[c], ids.get());
+    });
+
+    /* Merge the chunk-local buckets (their 'table' is no longer needed and
+       is reused to map local bucket indices to global ones) */
+    key_buckets<Key> global;
+    for (auto &chunk : chunks) {
+        chunk.table.resize(chunk.keys.size());
+        for (size_t j = 0; j < chunk.keys.size(); ++j) {
+            uint32_t id = global.lookup(chunk.keys[j]);
+            global.counts[id] += chunk.counts[j];
+            chunk.table[j] = id;
+        }
+    }
+
+    /* Order the groups by key and allocate their permutation arrays */
+    size_t group_count = global.keys.size();
+    std::vector<uint32_t> order(group_count);
+    for (size_t j = 0; j < group_count; ++j)
+        order[j] = (uint32_t) j;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return global.keys[a] < global.keys[b];
+    });
+
+    std::vector<std::pair<Value, UInt32X>> result;
+    std::vector<uint32_t *> targets(group_count);
+    result.reserve(group_count);
+    for (uint32_t id : order) {
+        UInt32X perm;
+        perm.resize(global.counts[id]);
+        targets[id] = perm.data();
+        result.emplace_back((Value) global.keys[id], std::move(perm));
+    }
+
+    /* Per-chunk write positions, in chunk order to keep the indices sorted */
+    std::vector<std::vector<uint32_t *>> cursors(chunk_count);
+    for (size_t c = 0; c < chunk_count; ++c) {
+        const key_buckets<Key> &chunk = chunks[c];
+        cursors[c].resize(chunk.keys.size());
+        for (size_t j = 0; j < chunk.keys.size(); ++j) {
+            uint32_t *&target = targets[chunk.table[j]];
+            cursors[c][j] = target;
+            target += chunk.counts[j];
+        }
+    }
+
+    parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+        for (size_t c = start; c < end; ++c) {
+            uint32_t **cursor = cursors[c].data();
+            for (size_t i = c * chunk_size, i_end = std::min(i + chunk_size, size);
+                 i < i_end; ++i)
+                *cursor[ids[i]]++ = (uint32_t) i;
+        }
+    });
+
+    return result;
+}
+
+/**
+ * \brief Blocked prefix sum over an array of \c n_packets packets
+ *
+ * The first parallel pass computes the total of every chunk except for the
+ * last one. A short serial scan turns these totals into per-chunk offsets,
+ * and a second parallel pass then rescans each chunk starting from its offset.
+ */
+template <bool Exclusive, typename Packet>
+void psum_packets(const Packet *in, Packet *out, size_t n_packets) {
+    using Value = value_t<Packet>;
+
+    size_t chunk_size = std::max((size_t) ENOKI_PARALLEL_CHUNK_SIZE / sizeof(Packet),
+                                 (size_t) 1),
+           chunk_count = (n_packets + chunk_size - 1) / chunk_size;
+
+    std::unique_ptr<Value[]> offsets(new Value[chunk_count + 1]);
+    offsets[0] = Value(0);
+
+    if (chunk_count > 1) {
+        parallel_for(chunk_count - 1, 1, [&](size_t start, size_t end) {
+            for (size_t c = start; c < end; ++c) {
+                Packet accum = zero<Packet>();
+                for (size_t i = c * chunk_size; i < (c + 1) * chunk_size; ++i)
+                    accum += in[i];
+                offsets[c + 1] = hsum(accum);
+            }
+        });
+
+        for (size_t c = 1; c < chunk_count; ++c)
+            offsets[c] += offsets[c - 1];
+    }
+
+    parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+        for (size_t c = start; c < end; ++c) {
+            Packet carry(offsets[c]);
+            for (size_t i = c * chunk_size, i_end = std::min(i + chunk_size, n_packets);
+                 i < i_end; ++i) {
+                Packet value = in[i];
+                if constexpr (Exclusive)
+                    out[i] = psum_exclusive(value) + carry;
+                else
+                    out[i] = psum(value) + carry;
+                carry += Packet(hsum(value));
+            }
+        }
+    });
+}
+
+/**
+ * \brief Parallel stream compaction of the entries selected by \c mask
+ *
+ * \c func(i) provides the i-th packet of values. The first parallel pass
+ * counts the active entries of each chunk, and a short serial scan turns the
+ * counts into output offsets. The second pass then compresses every chunk
+ * into its own region of the output. Static \c compress() may store a full
+ * packet, hence packets close to the end of a region are staged through a
+ * temporary buffer to avoid clobbering the neighboring chunk.
+ */
+template <typename Result, typename Mask, typename Func>
+Result compress_packets(const Mask &mask, Func &&func) {
+    using Scalar      = scalar_t<Result>;
+    using MaskPacket  = mask_t<typename Result::Packet>;
+    using IndexPacket = typename Mask::IndexPacket;
+    using IndexScalar = scalar_t<IndexPacket>;
+    constexpr size_t PacketSize = Mask::PacketSize;
+    static_assert(Result::PacketSize == PacketSize,
+                  "compress(): the values and mask must have the same packet size!");
+
+    size_t size = mask.size(), n_packets = mask.packets(),
+           chunk_size = std::max((size_t) ENOKI_PARALLEL_CHUNK_SIZE /
+                                     (PacketSize * sizeof(Scalar)), (size_t) 1),
+           chunk_count = (n_packets + chunk_size - 1) / chunk_size;
+
+    /* Disable the padding lanes of the last packet */
+    auto packet_mask = [&](size_t i) -> MaskPacket {
+        if (PacketSize > 1 && i + 1 == n_packets)
+            return reinterpret_array<MaskPacket>(
+                mask.packet(i) & (arange<IndexPacket>() <= IndexScalar((size - 1) % PacketSize)));
+        else
+            return reinterpret_array<MaskPacket>(mask.packet(i));
+    };
+
+    std::vector<size_t> offsets(chunk_count + 1, 0);
+    parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+        for (size_t c = start; c < end; ++c) {
+            size_t total = 0;
+            for (size_t i = c * chunk_size, i_end = std::min(i + chunk_size, n_packets);
+                 i < i_end; ++i)
+                total += count(packet_mask(i));
+            offsets[c + 1] = total;
+        }
+    });
+
+    for (size_t c = 0; c < chunk_count; ++c)
+        offsets[c + 1] += offsets[c];
+
+    Result result;
+    result.resize(offsets[chunk_count]);
+
+    parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+        for (size_t c = start; c < end; ++c) {
+            Scalar *ptr = result.data() + offsets[c],
+                   *ptr_end = result.data() + offsets[c + 1];
+            for (size_t i = c * chunk_size, i_end = std::min(i + chunk_size, n_packets);
+                 i < i_end; ++i) {
+                if (ptr + PacketSize <= ptr_end) {
+                    compress(ptr, func(i), packet_mask(i));
+                } else {
+                    Scalar tmp[PacketSize], *tmp_ptr = tmp;
+                    size_t n = compress(tmp_ptr, func(i), packet_mask(i));
+                    memcpy(ptr, tmp, n * sizeof(Scalar));
+                    ptr += n;
+                }
+            }
+        }
+    });
+
+    return result;
+}
+
+NAMESPACE_END(detail)
+
 template <typename Packet_, typename Derived_>
 struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
     // -----------------------------------------------------------------------
@@ -116,6 +430,12 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
         operator=(value);
     }
 
+    /// Evaluate a deferred expression (see \ref lazy())
+    template <typename Node>
+    DynamicArrayImpl(const Lazy<Node> &expr) {
+        operator=(expr);
+    }
+
     template <typename Packet2, typename Derived2>
     DynamicArrayImpl(const DynamicArrayImpl<Packet2, Derived2> &other,
                      detail::reinterpret_flag) {
@@ -186,6 +506,24 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
         return derived();
     }
 
+    /// Evaluate a deferred expression using a single pass over the packets
+    template <typename Node>
+    ENOKI_NOINLINE DynamicArrayImpl &operator=(const Lazy<Node> &expr) {
+        size_t size = expr.size();
+
+        if (size != (size_t) m_size) {
+            /* The expression may reference this array -- evaluate into a
+               separate buffer if the latter would have to be reallocated */
+            Derived result;
+            result.resize(size);
+            result.assign_lazy_(expr);
+            return operator=(std::move(result));
+        }
+
+        assign_lazy_(expr);
+        return derived();
+    }
+
     ENOKI_INLINE DynamicArrayImpl &operator=(DynamicArrayImpl &&other) {
         m_packets.swap(other.m_packets);
         std::swap(m_packets_allocated, other.m_packets_allocated);
@@ -194,12 +532,10 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
     }
 
     void reset() {
-        if (is_mapped()) {
+        if (is_mapped())
             m_packets.release();
-        } else if (m_packets.get()) {
-            ENOKI_TRACK_DEALLOC(m_packets.get(), packets_allocated() * sizeof(Packet));
-            m_packets.reset();
-        }
+        else
+            free_packets_();
 
         m_size = m_packets_allocated = 0;
     }
@@ -214,7 +550,7 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
     bool is_mapped() const { return (m_packets_allocated & 0x80000000u) != 0; }
     size_t size() const { return (size_t) m_size; }
     size_t packets() const { return ((size_t) m_size + PacketSize - 1) / PacketSize; }
-    size_t packets_allocated() const { return (size_t) (m_packets_allocated & 0x7fffffffu); }
+    size_t packets_allocated() const { return (size_t) (m_packets_allocated & 0x3fffffffu); }
     size_t capacity() const { return packets_allocated() * Packet::Size; }
 
     bool empty() const { return m_size == 0; }
@@ -560,14 +896,35 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
     }
 
     template <typename Mask>
-    ENOKI_INLINE size_t compress_(float *&ptr, const Mask &mask) const {
+    ENOKI_INLINE size_t compress_(Scalar *&ptr, const Mask &mask) const {
         assert(mask.size() == size());
         size_t count = 0;
-        for (size_t i = 0; i < packets(); ++i)
+        for (size_t i = 0, n = packets() - (PacketSize > 1 ? 1 : 0); i < n; ++i)
             count += compress(ptr, packet(i), mask.packet(i));
+
+        if constexpr (PacketSize > 1) {
+            if (!empty()) {
+                /* Stage the last packet, whose padding lanes must not be stored */
+                Scalar tmp[PacketSize], *tmp_ptr = tmp;
+                size_t n = compress(tmp_ptr, packet(packets() - 1),
+                                   mask.packet(packets() - 1) &
+                                   (arange<IndexPacket>() <= IndexScalar((size() - 1) % PacketSize)));
+                memcpy(ptr, tmp, n * sizeof(Scalar));
+                ptr += n;
+                count += n;
+            }
+        }
         return count;
     }
 
+    /// Parallel stream compaction: return the entries whose mask bit is set
+    template <typename Mask> Derived compress_(const Mask &mask) const {
+        if (mask.size() != size())
+            throw std::runtime_error("DynamicArray::compress_(): size mismatch!");
+        return detail::compress_packets<Derived>(
+            mask, [&](size_t i) -> const Packet & { return packet(i); });
+    }
+
 
     template <typename T> T ceil2int_() const {
         T result;
@@ -720,6 +1077,24 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
         return result;
     }
 
+    /// Inclusive prefix sum (parallel blocked scan)
+    template <typename T = Value, enable_if_t<!IsMask && std::is_arithmetic_v<T>> = 0>
+    Derived psum_() const {
+        Derived result;
+        result.resize(size());
+        detail::psum_packets<false>(packet_ptr(), result.packet_ptr(), packets());
+        return result;
+    }
+
+    /// Exclusive prefix sum (parallel blocked scan)
+    template <typename T = Value, enable_if_t<!IsMask && std::is_arithmetic_v<T>> = 0>
+    Derived psum_exclusive_() const {
+        Derived result;
+        result.resize(size());
+        detail::psum_packets<true>(packet_ptr(), result.packet_ptr(), packets());
+        return result;
+    }
+
     //! @}
     // -----------------------------------------------------------------------
 
@@ -749,13 +1124,8 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
         size_t n_packets = (size + PacketSize - 1) / PacketSize;
 
         if (n_packets > packets_allocated()) {
-            if (!empty()) {
-                ENOKI_TRACK_DEALLOC(m_packets.get(), packets_allocated() * sizeof(Packet));
-            }
-            m_packets = PacketHolder(new Packet[n_packets]);
-            m_packets_allocated = (Size) n_packets;
-            ENOKI_TRACK_ALLOC(m_packets.get(),
-                              n_packets * sizeof(Packet));
+            free_packets_();
+            alloc_packets_(n_packets);
         }
 
         if (m_size == 1) {
@@ -779,7 +1149,7 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
     void clean_trailing_() {
         IndexScalar remainder = (IndexScalar) (m_size % PacketSize);
         if (remainder > 0 && m_size != 1) {
-            void *addr = m_packets.get() + packets_allocated() - 1;
+            void *addr = m_packets.get() + packets() - 1;
             auto mask = arange<IndexPacket>() < IndexScalar(remainder);
             store(addr, load<Packet>(addr) & mask);
         }
@@ -794,18 +1164,17 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
         r.m_packets_allocated =
             (Size) ((size + PacketSize - 1) / PacketSize);
 
-        if (!dealloc)
-            r.m_packets_allocated |= 0x80000000u;
+        /* Memory that is not owned by Enoki's allocator is released using
+           'delete[]' (flag 0x40000000) or not at all (flag 0x80000000) */
+        r.m_packets_allocated |= dealloc ? 0x40000000u : 0x80000000u;
 
         return r;
     }
 
     static Derived copy(const void *ptr, size_t size) {
         Derived r;
+        r.alloc_packets_((size + PacketSize - 1) / PacketSize);
         r.m_size = (Size) size;
-        r.m_packets_allocated =
-            (Size) ((size + PacketSize - 1) / PacketSize);
-        r.m_packets = PacketHolder(new Packet[r.m_packets_allocated]);
         memcpy(r.m_packets.get(), ptr, size * sizeof(Value));
         return r;
     }
@@ -816,7 +1185,48 @@ struct DynamicArrayImpl : ArrayBase<value_t<Packet_>, Derived_> {
         resize(check_size(args...));
     }
 
+    template <typename T> void assign_lazy_(const T &expr) {
+        Packet *pr = packet_ptr();
+        for (size_t i = 0, n = packets(); i < n; ++i)
+            pr[i] = expr.packet(i);
+    }
+
 private:
+    /// Can the packets be stored in memory provided by dynamic_malloc()?
+    static constexpr bool CachedAlloc =
+        std::is_trivially_destructible_v<Packet> &&
+        alignof(Packet) <= dynamic_malloc_alignment;
+
+    /// Allocate storage for (at least) the specified number of packets
+    void alloc_packets_(size_t n_packets) {
+        Packet *ptr;
+        if constexpr (CachedAlloc) {
+            /* dynamic_free() maps the size back to the same size class */
+            ptr = (Packet *) dynamic_malloc(n_packets * sizeof(Packet));
+            m_packets_allocated = (Size) n_packets;
+        } else {
+            ptr = new Packet[n_packets];
+            m_packets_allocated = (Size) n_packets | 0x40000000u;
+        }
+        m_packets = PacketHolder(ptr);
+        ENOKI_TRACK_ALLOC(ptr, n_packets * sizeof(Packet));
+    }
+
+    /// Release the storage of a non-mapped array
+    void free_packets_() {
+        Packet *ptr = m_packets.release();
+        if (!ptr)
+            return;
+
+        ENOKI_TRACK_DEALLOC(ptr, packets_allocated() * sizeof(Packet));
+        if constexpr (CachedAlloc) {
+            if ((m_packets_allocated & 0x40000000u) == 0) {
+                dynamic_free(ptr, packets_allocated() * sizeof(Packet));
+                return;
+            }
+        }
+        delete[] ptr;
+    }
 
 #if defined(__GNUC__)
 // GCC 8.2: quench nonsensical warning in parameter pack expansion
@@ -920,6 +1330,14 @@ public:
         return zero<Value>();
     }
 
+    /// Group the entries by value, returning (value, permutation) pairs
+    template <typename T = Value, enable_if_t<!IsMask && (std::is_pointer_v<T> ||
+                                                         std::is_integral_v<T>)> = 0>
+    auto partition_() const {
+        using Key = std::conditional_t<std::is_pointer_v<T>, uintptr_t, T>;
+        return detail::partition_keys<Value, PacketSize>((const Key *) data(), size());
+    }
+
     DynamicArrayReference<Packet> ref_wrap_() const {
         return m_packets.get();
     }
@@ -966,85 +1384,646 @@ struct DynamicMask : DynamicArrayImpl<Packet_, DynamicMask<Packet_>> {
         : Base(std::forward<T>(value), detail::reinterpret_flag()) { }
 };
 
+// -----------------------------------------------------------------------
+//! @{ \name Deferred evaluation of element-wise dynamic array expressions
+// -----------------------------------------------------------------------
+
+NAMESPACE_BEGIN(detail)
+
+/// Leaf node of a deferred expression: reference to a dynamic array
+template <typename Array> struct lazy_array {
+    using Packet = typename Array::Packet;
+
+    lazy_array(const Array &array) : m_array(array) { }
+
+    size_t size() const { return m_array.size(); }
+
+    ENOKI_INLINE Packet packet(size_t i) const {
+        return m_array.packet_ptr()[m_array.size() == 1 ? 0 : i];
+    }
+
+private:
+    const Array &m_array;
+};
+
+/// Leaf node of a deferred expression: broadcasted scalar
+template <typename Packet_> struct lazy_scalar {
+    using Packet = Packet_;
+
+    lazy_scalar(const Packet &value) : m_value(value) { }
+
+    size_t size() const { return 1; }
+
+    ENOKI_INLINE const Packet &packet(size_t) const { return m_value; }
+
+private:
+    Packet m_value;
+};
+
+/// Interior node of a deferred expression: element-wise operation
+template <typename Func, typename... Args> struct lazy_op {
+    using Packet = typename std::tuple_element_t<0, std::tuple<Args...>>::Packet;
+
+    lazy_op(const Args &... args) : m_args(args...) { }
+
+    size_t size() const { return size_(std::index_sequence_for<Args...>()); }
+
+    ENOKI_INLINE Packet packet(size_t i) const {
+        return packet_(i, std::index_sequence_for<Args...>());
+    }
+
+private:
+    template <size_t... Is> size_t size_(std::index_sequence<Is...>) const {
+        size_t sizes[] = { std::get<Is>(m_args).size()... },
+               max_size = *std::max_element(std::begin(sizes), std::end(sizes));
+        for (size_t s : sizes) {
+            if (s != max_size && s != 1)
+                throw std::runtime_error(
+                    "Incompatible sizes in dynamic array operation");
+        }
+        return max_size;
+    }
+
+    template <size_t... Is>
+    ENOKI_INLINE Packet packet_(size_t i, std::index_sequence<Is...>) const {
+        return Func::eval(std::get<Is>(m_args).packet(i)...);
+    }
+
+    std::tuple<Args...> m_args;
+};
+
+NAMESPACE_END(detail)
+
+template <typename Node_> struct Lazy : Node_ {
+    using Node = Node_;
+    using Node::Node;
+    Lazy(const Node &node) : Node(node) { }
+};
+
+/**
+ * \brief Defer the evaluation of element-wise arithmetic involving a dynamic array
+ *
+ * Arithmetic involving the returned expression (and further dynamic arrays or
+ * scalars) builds up an expression tree rather than computing temporary
+ * arrays. The expression is evaluated in a single pass over the packets once
+ * it is assigned to a dynamic array:
+ *
+ * \code
+ * FloatX result = lazy(a) * b + c * d - e;
+ * \endcode
+ *
+ * The first argument of the supported functions (\c min(), \c fmadd(), etc.)
+ * must be a deferred expression. Expressions only store references to their
+ * dynamic array operands and should not be kept around beyond the statement
+ * that evaluates them (e.g. via \c auto).
+ */
+template <typename T, enable_if_dynamic_array_t<T> = 0>
+Lazy<detail::lazy_array<T>> lazy(const T &array) { return array; }
+
+NAMESPACE_BEGIN(detail)
+
+template <typename T>
+constexpr bool is_lazy_operand_v =
+    is_lazy_v<T> || is_dynamic_array_v<T> || std::is_arithmetic_v<T>;
+
+/* Deferred expressions are not arrays: prevent routing functions from
+   array_router.h that compute expr_t<> in their signature from matching */
+template <typename N, typename T> struct expr<Lazy<N>, T> { };
+template <typename T, typename N> struct expr<T, Lazy<N>> { };
+template <typename N1, typename N2> struct expr<Lazy<N1>, Lazy<N2>> { };
+
+template <typename T, typename = int> struct lazy_packet { using type = void; };
+template <typename T> struct lazy_packet<T, enable_if_t<is_lazy_v<T> || is_dynamic_array_v<T>>> {
+    using type = typename T::Packet;
+};
+
+template <typename... Ts> struct lazy_packet_any;
+template <typename T, typename... Ts> struct lazy_packet_any<T, Ts...> {
+    using type = std::conditional_t<!std::is_void_v<typename lazy_packet<T>::type>,
+                                    typename lazy_packet<T>::type,
+                                    typename lazy_packet_any<Ts...>::type>;
+};
+template <> struct lazy_packet_any<> { using type = void; };
+
+template <typename Packet, typename T> auto lazy_node(const T &value) {
+    if constexpr (is_lazy_v<T>)
+        return (const typename T::Node &) value;
+    else if constexpr (is_dynamic_array_v<T>)
+        return lazy_array<T>(value);
+    else
+        return lazy_scalar<Packet>(Packet(scalar_t<Packet>(value)));
+}
+
+template <typename Func, typename... Ts> auto lazy_expr(const Ts &... args) {
+    using Packet = typename lazy_packet_any<Ts...>::type;
+    using Node = lazy_op<Func, decltype(lazy_node<Packet>(args))...>;
+    return Lazy<Node>(lazy_node<Packet>(args)...);
+}
+
+NAMESPACE_END(detail)
+
+/* The overloads below are more specialized than the generic routing functions
+   in array_router.h, which therefore never see deferred expressions */
+
+#define ENOKI_LAZY_UNARY_OPERATION(name, func, expr)                           \
+    NAMESPACE_BEGIN(detail)                                                    \
+    struct lazy_##name {                                                       \
+        template <typename T> static ENOKI_INLINE auto eval(const T &a) {      \
+            return expr;                                                       \
+        }                                                                      \
+    };                                                                         \
+    NAMESPACE_END(detail)                                                      \
+    template <typename N>                                                      \
+    ENOKI_INLINE auto func(const Lazy<N> &a) {                                 \
+        return detail::lazy_expr<detail::lazy_##name>(a);                      \
+    }
+
+#define ENOKI_LAZY_BINARY_OPERATION(name, func, expr)                          \
+    NAMESPACE_BEGIN(detail)                                                    \
+    struct lazy_##name {                                                       \
+        template <typename T>                                                  \
+        static ENOKI_INLINE auto eval(const T &a1, const T &a2) {              \
+            return expr;                                                       \
+        }                                                                      \
+    };                                                                         \
+    NAMESPACE_END(detail)                                                      \
+    template <typename N1, typename N2>                                        \
+    ENOKI_INLINE auto func(const Lazy<N1> &a1, const Lazy<N2> &a2) {           \
+        return detail::lazy_expr<detail::lazy_##name>(a1, a2);                 \
+    }                                                                          \
+    template <typename N1, typename T2,                                        \
+              enable_if_t<detail::is_lazy_operand_v<T2>> = 0>                  \
+    ENOKI_INLINE auto func(const Lazy<N1> &a1, const T2 &a2) {                 \
+        return detail::lazy_expr<detail::lazy_##name>(a1, a2);                 \
+    }                                                                          \
+    template <typename T1, typename N2,                                        \
+              enable_if_t<detail::is_lazy_operand_v<T1>> = 0>                  \
+    ENOKI_INLINE auto func(const T1 &a1, const Lazy<N2> &a2) {                 \
+        return detail::lazy_expr<detail::lazy_##name>(a1, a2);                 \
+    }
+
+#define ENOKI_LAZY_TERNARY_OPERATION(name, func, expr)                         \
+    NAMESPACE_BEGIN(detail)                                                    \
+    struct lazy_##name {                                                       \
+        template <typename T>                                                  \
+        static ENOKI_INLINE auto eval(const T &a1, const T &a2, const T &a3) { \
+            return expr;                                                       \
+        }                                                                      \
+    };                                                                         \
+    NAMESPACE_END(detail)                                                      \
+    template <typename N1, typename T2, typename T3,                           \
+              enable_if_t<detail::is_lazy_operand_v<T2> &&                     \
+                          detail::is_lazy_operand_v<T3>> = 0>                  \
+    ENOKI_INLINE auto func(const Lazy<N1> &a1, const T2 &a2, const T3 &a3) {   \
+        return detail::lazy_expr<detail::lazy_##name>(a1, a2, a3);             \
+    }
+
+ENOKI_LAZY_UNARY_OPERATION(neg,   operator-, -a)
+ENOKI_LAZY_UNARY_OPERATION(abs,   abs,   enoki::abs(a))
+ENOKI_LAZY_UNARY_OPERATION(sqrt,  sqrt,  enoki::sqrt(a))
+ENOKI_LAZY_UNARY_OPERATION(rcp,   rcp,   enoki::rcp(a))
+ENOKI_LAZY_UNARY_OPERATION(rsqrt, rsqrt, enoki::rsqrt(a))
+ENOKI_LAZY_UNARY_OPERATION(floor, floor, enoki::floor(a))
+ENOKI_LAZY_UNARY_OPERATION(ceil,  ceil,  enoki::ceil(a))
+ENOKI_LAZY_UNARY_OPERATION(round, round, enoki::round(a))
+ENOKI_LAZY_UNARY_OPERATION(trunc, trunc, enoki::trunc(a))
+
+ENOKI_LAZY_BINARY_OPERATION(add, operator+, a1 + a2)
+ENOKI_LAZY_BINARY_OPERATION(sub, operator-, a1 - a2)
+ENOKI_LAZY_BINARY_OPERATION(mul, operator*, a1 * a2)
+ENOKI_LAZY_BINARY_OPERATION(div, operator/, a1 / a2)
+ENOKI_LAZY_BINARY_OPERATION(min, min, enoki::min(a1, a2))
+ENOKI_LAZY_BINARY_OPERATION(max, max, enoki::max(a1, a2))
+
+ENOKI_LAZY_TERNARY_OPERATION(fmadd,  fmadd,  enoki::fmadd(a1, a2, a3))
+ENOKI_LAZY_TERNARY_OPERATION(fmsub,  fmsub,  enoki::fmsub(a1, a2, a3))
+ENOKI_LAZY_TERNARY_OPERATION(fnmadd, fnmadd, enoki::fnmadd(a1, a2, a3))
+ENOKI_LAZY_TERNARY_OPERATION(fnmsub, fnmsub, enoki::fnmsub(a1, a2, a3))
+
+#undef ENOKI_LAZY_UNARY_OPERATION
+#undef ENOKI_LAZY_BINARY_OPERATION
+#undef ENOKI_LAZY_TERNARY_OPERATION
+
+//! @}
+// -----------------------------------------------------------------------
+
 namespace detail {
     template <typename T> struct mutable_ref { using type = std::add_lvalue_reference_t<T>; };
     template <typename T> struct mutable_ref<const T &> { using type = T &; };
     template <typename T> using mutable_ref_t = typename mutable_ref<T>::type;
 
-    /// Vectorized inner loop (void return value)
+    /// Vectorized inner loop over the packet range [start, end) (void return value)
     template <typename Func, typename... Args, size_t... Index>
     ENOKI_INLINE void vectorize_inner_1(std::index_sequence<Index...>, Func &&f,
-                                        size_t packet_count, Args &&... args) {
-        ENOKI_NOUNROLL ENOKI_IVDEP for (size_t i = 0; i < packet_count; ++i)
+                                        size_t start, size_t end, Args &&... args) {
+        ENOKI_NOUNROLL ENOKI_IVDEP for (size_t i = start; i < end; ++i)
             f(packet(args, i)...);
     }
 
-    /// Vectorized inner loop (non-void return value)
+    /// Vectorized inner loop over the packet range [start, end) (non-void return value)
     template <typename Func, typename Out, typename... Args, size_t... Index>
     ENOKI_INLINE void vectorize_inner_2(std::index_sequence<Index...>, Func &&f,
-                                        size_t packet_count, Out &&out, Args &&... args) {
-        ENOKI_NOUNROLL ENOKI_IVDEP for (size_t i = 0; i < packet_count; ++i)
+                                        size_t start, size_t end, Out &&out, Args &&... args) {
+        ENOKI_NOUNROLL ENOKI_IVDEP for (size_t i = start; i < end; ++i)
             packet(out, i) = f(packet(args, i)...);
     }
-}
 
-template <bool Resize = false, typename Func, typename... Args>
-auto vectorize(Func &&f, Args &&... args)
-    -> make_dynamic_t<decltype(f(packet(args, 0)...))> /* LLVM bug #39326 */ {
+    template <bool Resize, bool Parallel, typename Func, typename... Args>
+    auto vectorize(Func &&f, Args &&... args)
+        -> make_dynamic_t<decltype(f(packet(args, 0)...))> /* LLVM bug #39326 */ {
 #if defined(NDEBUG)
-    constexpr bool Check = false;
+        constexpr bool Check = false;
 #else
-    constexpr bool Check = true;
+        constexpr bool Check = true;
 #endif
 
-    /** Determine the number of slices and packets of the input arrays,
-        and broadcast scalar input arrays if requested */
-    size_t packet_count = 0, slice_count = 0;
-
-    bool unused1[] = { ((packet_count = !is_dynamic_v<Args> ? packet_count
-        : (Resize ? std::max(packet_count, packets(args)) : packets(args))), false)... };
+        /** Determine the number of slices and packets of the input arrays,
+            and broadcast scalar input arrays if requested */
+        size_t packet_count = 0, slice_count = 0;
 
-    bool unused2[] = { ((slice_count = !is_dynamic_v<Args> ? slice_count
-        : (Resize ? std::max(slice_count, slices(args)) : slices(args))), false)... };
+        bool unused1[] = { ((packet_count = !is_dynamic_v<Args> ? packet_count
+            : (Resize ? std::max(packet_count, packets(args)) : packets(args))), false)... };
 
-    (void) unused1; (void) unused2;
+        bool unused2[] = { ((slice_count = !is_dynamic_v<Args> ? slice_count
+            : (Resize ? std::max(slice_count, slices(args)) : slices(args))), false)... };
 
-    if constexpr (Check || Resize) {
-        size_t status[] = { (
-            !is_dynamic_v<Args> ||
-            ((slice_count != 1 && slices(args) == 1 && Resize)
-                 ? (set_slices((detail::mutable_ref_t<decltype(args)>) args, slice_count), true)
-                 : (slices(args) == slice_count)))... };
+        (void) unused1; (void) unused2;
 
-        bool status_combined = true;
-        for (bool s : status)
-            status_combined &= s;
+        if constexpr (Check || Resize) {
+            size_t status[] = { (
+                !is_dynamic_v<Args> ||
+                ((slice_count != 1 && slices(args) == 1 && Resize)
+                     ? (set_slices((detail::mutable_ref_t<decltype(args)>) args, slice_count), true)
+                     : (slices(args) == slice_count)))... };
 
-        if (!status_combined)
-            throw std::runtime_error("vectorize(): vector arguments have incompatible lengths");
-    }
+            bool status_combined = true;
+            for (bool s : status)
+                status_combined &= s;
 
-    using Result = make_dynamic_t<decltype(f(packet(args, 0)...))>;
-    if constexpr (std::is_void_v<Result>) {
-        detail::vectorize_inner_1(std::make_index_sequence<sizeof...(Args)>(),
-                                  f, packet_count, ref_wrap(args)...);
-    } else {
-        Result result;
-        set_slices(result, slice_count);
+            if (!status_combined)
+                throw std::runtime_error("vectorize(): vector arguments have incompatible lengths");
+        }
 
-        detail::vectorize_inner_2(std::make_index_sequence<sizeof...(Args)>(),
-                                  f, packet_count, ref_wrap(result),
+        /* Split the packet range into work items that touch roughly
+           ENOKI_PARALLEL_CHUNK_SIZE bytes per array argument */
+        constexpr size_t grain = std::max(
+            (size_t) ENOKI_PARALLEL_CHUNK_SIZE / max_packet_size, (size_t) 1);
+
+        using Result = make_dynamic_t<decltype(f(packet(args, 0)...))>;
+        if constexpr (std::is_void_v<Result>) {
+            if constexpr (Parallel) {
+                parallel_for(packet_count, grain, [&](size_t start, size_t end) {
+                    vectorize_inner_1(std::make_index_sequence<sizeof...(Args)>(),
+                                      f, start, end, ref_wrap(args)...);
+                });
+            } else {
+                vectorize_inner_1(std::make_index_sequence<sizeof...(Args)>(),
+                                  f, 0, packet_count, ref_wrap(args)...);
+            }
+        } else {
+            Result result;
+            set_slices(result, slice_count);
+
+            if constexpr (Parallel) {
+                parallel_for(packet_count, grain, [&](size_t start, size_t end) {
+                    vectorize_inner_2(std::make_index_sequence<sizeof...(Args)>(),
+                                      f, start, end, ref_wrap(result),
+                                      ref_wrap(args)...);
+                });
+            } else {
+                vectorize_inner_2(std::make_index_sequence<sizeof...(Args)>(),
+                                  f, 0, packet_count, ref_wrap(result),
                                   ref_wrap(args)...);
-        return result;
+            }
+            return result;
+        }
     }
 }
 
+template <bool Resize = false, typename Func, typename... Args>
+auto vectorize(Func &&f, Args &&... args)
+    -> decltype(detail::vectorize<Resize, false>(f, args...)) /* LLVM bug #39326 */ {
+    return detail::vectorize<Resize, false>(f, args...);
+}
+
 template <typename Func, typename... Args>
 auto vectorize_safe(Func &&f, Args &&... args)
     -> decltype(vectorize<true>(f, args...)) /* LLVM bug #39326 */ {
     return vectorize<true>(f, args...);
 }
 
+/**
+ * \brief Multithreaded version of vectorize()
+ *
+ * The packets of the input arrays are split into cache-sized chunks that are
+ * processed in parallel using the thread pool of \ref parallel_for().
+ * \c f must be safe to call concurrently on different packets. Broadcasting
+ * (\c Resize) and length checks are performed on the calling thread before
+ * any work is dispatched.
+ */
+template <bool Resize = false, typename Func, typename... Args>
+auto vectorize_parallel(Func &&f, Args &&... args)
+    -> decltype(detail::vectorize<Resize, true>(f, args...)) /* LLVM bug #39326 */ {
+    return detail::vectorize<Resize, true>(f, args...);
+}
+
+template <typename Func, typename... Args>
+auto vectorize_parallel_safe(Func &&f, Args &&... args)
+    -> decltype(vectorize_parallel<true>(f, args...)) /* LLVM bug #39326 */ {
+    return vectorize_parallel<true>(f, args...);
+}
+
+// -----------------------------------------------------------------------
+//! @{ \name Sorting of dynamic arrays
+// -----------------------------------------------------------------------
+
+NAMESPACE_BEGIN(detail)
+
+/// Dynamic arrays that reside in host memory (i.e. not CUDA/differentiable arrays)
+template <typename T> constexpr bool is_host_dynamic_v =
+    is_dynamic_array_v<T> && !is_cuda_array_v<T> && !is_diff_array_v<T>;
+
+template <typename T> using radix_uint_t =
+    std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+
+template <typename T> constexpr bool is_radix_sortable_v =
+    std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+    (sizeof(T) == 4 || sizeof(T) == 8);
+
+/// Number of entries per work item of the sorting routines
+template <typename UInt, size_t PacketSize> size_t radix_chunk_size(size_t size) {
+    size_t chunk_size = std::max((size_t) ENOKI_PARALLEL_CHUNK_SIZE / sizeof(UInt),
+                                 (size + 4 * parallel_thread_count() - 1) /
+                                     (4 * parallel_thread_count()));
+    return (chunk_size + PacketSize - 1) / PacketSize * PacketSize;
+}
+
+/**
+ * \brief Map keys to unsigned integers (and back) such that the integer order
+ * matches the order of the keys
+ *
+ * Floating point values flip all bits when negative and only the sign bit
+ * otherwise; signed integers flip the sign bit.
+ */
+template <typename T, size_t PacketSize> struct radix_codec {
+    using UInt  = radix_uint_t<T>;
+    using UIntP = Packet<UInt, PacketSize>;
+    using IntP  = Packet<std::make_signed_t<UInt>, PacketSize>;
+    static constexpr size_t Bits = sizeof(UInt) * 8;
+    static constexpr UInt SignBit = UInt(1) << (Bits - 1);
+
+    static ENOKI_INLINE UIntP encode(const UIntP &u) {
+        if constexpr (std::is_floating_point_v<T>)
+            return u ^ (reinterpret_array<UIntP>(sr<Bits - 1>(reinterpret_array<IntP>(u))) | SignBit);
+        else if constexpr (std::is_signed_v<T>)
+            return u ^ SignBit;
+        else
+            return u;
+    }
+
+    static ENOKI_INLINE UIntP decode(const UIntP &u) {
+        if constexpr (std::is_floating_point_v<T>)
+            return u ^ (~reinterpret_array<UIntP>(sr<Bits - 1>(reinterpret_array<IntP>(u))) | SignBit);
+        else
+            return encode(u);
+    }
+
+    /// Apply \c encode or \c decode to <tt>in[start, end)</tt>
+    template <bool Encode>
+    static void transform(const UInt *in, UInt *out, size_t start, size_t end) {
+        size_t i = start;
+        for (; i + PacketSize <= end; i += PacketSize) {
+            UIntP value = load_unaligned<UIntP>(in + i);
+            store_unaligned(out + i, Encode ? encode(value) : decode(value));
+        }
+
+        if (i < end) {
+            UInt tmp[PacketSize] { };
+            memcpy(tmp, in + i, (end - i) * sizeof(UInt));
+            UIntP value = load_unaligned<UIntP>(tmp);
+            store_unaligned(tmp, Encode ? encode(value) : decode(value));
+            memcpy(out + i, tmp, (end - i) * sizeof(UInt));
+        }
+    }
+};
+
+/// Count the occurrences of each 8-bit digit of <tt>keys[start, end)</tt>
+template <size_t PacketSize, typename UInt>
+void radix_histogram(const UInt *keys, size_t start, size_t end, UInt shift,
+                     uint32_t *hist) {
+    using UIntP = Packet<UInt, PacketSize>;
+
+    /* Two interleaved sub-histograms reduce stalls on runs of equal digits */
+    uint32_t h[2][256] { };
+
+    size_t i = start;
+    UInt digit[PacketSize];
+    for (; i + PacketSize <= end; i += PacketSize) {
+        store_unaligned(digit, (load_unaligned<UIntP>(keys + i) >> shift) & UInt(0xFF));
+        for (size_t j = 0; j < PacketSize; ++j)
+            h[j & 1][(size_t) digit[j]]++;
+    }
+
+    for (; i < end; ++i)
+        h[0][(size_t) ((keys[i] >> shift) & 0xFF)]++;
+
+    for (size_t d = 0; d < 256; ++d)
+        hist[d] = h[0][d] + h[1][d];
+}
+
+/**
+ * \brief Stable LSD radix sort of \c keys (8 bits per pass), optionally
+ * permuting \c values along with them
+ *
+ * Each pass computes per-chunk digit histograms in parallel, turns them into
+ * per-chunk write offsets, and then scatters the chunks in parallel. Passes
+ * where all keys share the same digit are skipped.
+ */
+template <size_t PacketSize, typename UInt, typename Payload = void>
+void radix_sort(UInt *keys, identity_t<Payload> *values, size_t size) {
+    constexpr bool HasValues = !std::is_void_v<Payload>;
+    using PayloadStorage = std::conditional_t<HasValues, Payload, uint8_t>;
+
+    if (size <= 1)
+        return;
+
+    size_t chunk_size  = radix_chunk_size<UInt, PacketSize>(size),
+           chunk_count = (size + chunk_size - 1) / chunk_size;
+
+    std::unique_ptr<UInt[]> keys_tmp(new UInt[size]);
+    std::unique_ptr<PayloadStorage[]> values_tmp(HasValues ? new PayloadStorage[size] : nullptr);
+    std::vector<uint32_t> hist(chunk_count * 256);
+
+    UInt *src_k = keys, *dst_k = keys_tmp.get();
+    PayloadStorage *src_v = (PayloadStorage *) values, *dst_v = values_tmp.get();
+
+    for (size_t pass = 0; pass < sizeof(UInt); ++pass) {
+        UInt shift = UInt(pass * 8);
+
+        parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+            for (size_t c = start; c < end; ++c)
+                radix_histogram<PacketSize>(src_k, c * chunk_size,
+                                            std::min((c + 1) * chunk_size, size),
+                                            shift, hist.data() + c * 256);
+        });
+
+        /* Exclusive prefix sum over (digit, chunk) */
+        uint32_t sum = 0;
+        bool trivial = false;
+        for (size_t d = 0; d < 256; ++d) {
+            uint32_t digit_start = sum;
+            for (size_t c = 0; c < chunk_count; ++c) {
+                uint32_t &h = hist[c * 256 + d];
+                uint32_t count = h;
+                h = sum;
+                sum += count;
+            }
+            trivial |= sum - digit_start == size;
+        }
+
+        if (trivial)
+            continue;
+
+        parallel_for(chunk_count, 1, [&](size_t start, size_t end) {
+            for (size_t c = start; c < end; ++c) {
+                uint32_t *offset = hist.data() + c * 256;
+                for (size_t i = c * chunk_size, i_end = std::min(i + chunk_size, size);
+                     i < i_end; ++i) {
+                    UInt key = src_k[i];
+                    uint32_t pos = offset[(size_t) ((key >> shift) & 0xFF)]++;
+                    dst_k[pos] = key;
+                    if constexpr (HasValues)
+                        dst_v[pos] = src_v[i];
+                }
+            }
+        });
+
+        std::swap(src_k, dst_k);
+        std::swap(src_v, dst_v);
+    }
+
+    if (src_k != keys) {
+        memcpy(keys, src_k, size * sizeof(UInt));
+        if constexpr (HasValues)
+            memcpy(values, src_v, size * sizeof(Payload));
+    }
+}
+
+/// Encode the keys of a dynamic array for radix_sort()
+template <typename Array, typename UInt = radix_uint_t<scalar_t<Array>>>
+std::unique_ptr<UInt[]> radix_encode(const Array &a) {
+    using Codec = radix_codec<scalar_t<Array>, Array::PacketSize>;
+    size_t size = a.size();
+    std::unique_ptr<UInt[]> keys(new UInt[size]);
+    const UInt *in = (const UInt *) a.data();
+    parallel_for(size, radix_chunk_size<UInt, Array::PacketSize>(size),
+                 [&](size_t start, size_t end) {
+        Codec::template transform<true>(in, keys.get(), start, end);
+    });
+    return keys;
+}
+
+/// Decode the output of radix_sort() into a dynamic array
+template <typename Array, typename UInt = radix_uint_t<scalar_t<Array>>>
+Array radix_decode(const UInt *keys, size_t size) {
+    using Codec = radix_codec<scalar_t<Array>, Array::PacketSize>;
+    Array result;
+    result.resize(size);
+    UInt *out = (UInt *) result.data();
+    parallel_for(size, radix_chunk_size<UInt, Array::PacketSize>(size),
+                 [&](size_t start, size_t end) {
+        Codec::template transform<false>(keys, out, start, end);
+    });
+    return result;
+}
+
+NAMESPACE_END(detail)
+
+/**
+ * \brief Sort a dynamic array of 32/64-bit integers or floating point values
+ * in ascending order
+ *
+ * Uses a parallel LSD radix sort. Negative zero is ordered before positive
+ * zero, and NaNs are placed at the beginning (negative sign) or end.
+ */
+template <typename Array, enable_if_t<detail::is_host_dynamic_v<Array>> = 0>
+Array sort(const Array &a) {
+    using Value = scalar_t<Array>;
+    static_assert(detail::is_radix_sortable_v<Value>,
+                  "sort(): expected an array of 32/64-bit integers or floating point values!");
+
+    auto keys = detail::radix_encode(a);
+    detail::radix_sort<Array::PacketSize>(keys.get(), nullptr, a.size());
+    return detail::radix_decode<Array>(keys.get(), a.size());
+}
+
+/**
+ * \brief Return the permutation that sorts \c a (stable)
+ *
+ * The result can be passed to \ref gather() to reorder \c a or other arrays
+ * of the same size.
+ */
+template <typename Array, enable_if_t<detail::is_host_dynamic_v<Array>> = 0>
+uint32_array_t<Array> argsort(const Array &a) {
+    using Value = scalar_t<Array>;
+    static_assert(detail::is_radix_sortable_v<Value>,
+                  "argsort(): expected an array of 32/64-bit integers or floating point values!");
+
+    auto keys = detail::radix_encode(a);
+    uint32_array_t<Array> index = arange<uint32_array_t<Array>>(a.size());
+    detail::radix_sort<Array::PacketSize, detail::radix_uint_t<Value>, uint32_t>(
+        keys.get(), index.data(), a.size());
+    return index;
+}
+
+/// Sort \c keys in ascending order and permute \c values accordingly (stable)
+template <typename Keys, typename Values,
+          enable_if_t<detail::is_host_dynamic_v<Keys> && detail::is_host_dynamic_v<Values>> = 0>
+std::pair<Keys, Values> sort_by_key(const Keys &keys, const Values &values) {
+    using Key = scalar_t<Keys>;
+    using Payload = detail::radix_uint_t<scalar_t<Values>>;
+    static_assert(detail::is_radix_sortable_v<Key>,
+                  "sort_by_key(): expected keys of 32/64-bit integers or floating point values!");
+    static_assert(sizeof(scalar_t<Values>) == 4 || sizeof(scalar_t<Values>) == 8,
+                  "sort_by_key(): expected values of a 32/64-bit type!");
+
+    if (keys.size() != values.size())
+        throw std::runtime_error("sort_by_key(): keys and values have different sizes!");
+
+    auto encoded = detail::radix_encode(keys);
+    Values values_out = values;
+    detail::radix_sort<Keys::PacketSize, detail::radix_uint_t<Key>, Payload>(
+        encoded.get(), (Payload *) values_out.data(), keys.size());
+
+    return { detail::radix_decode<Keys>(encoded.get(), keys.size()),
+             std::move(values_out) };
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name Stream compaction of dynamic arrays
+// -----------------------------------------------------------------------
+
+/// Return the indices of the active entries of a dynamic mask
+template <typename Mask, enable_if_t<is_dynamic_array_v<Mask>> = 0>
+uint32_array_t<array_t<Mask>> nonzero(const Mask &mask) {
+    using UInt32 = uint32_array_t<array_t<Mask>>;
+
+    if constexpr (detail::is_host_dynamic_v<Mask>) {
+        using UInt32P = typename UInt32::Packet;
+        return detail::compress_packets<UInt32>(mask, [](size_t i) {
+            return arange<UInt32P>() + uint32_t(i * UInt32P::Size);
+        });
+    } else {
+        return compress(arange<UInt32>(mask.size()), mask);
+    }
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
 #if defined(ENOKI_AUTODIFF) && !defined(ENOKI_BUILD)
     extern ENOKI_IMPORT template struct Tape<DynamicArray<Packet<float>>>;
     extern ENOKI_IMPORT template struct DiffArray<DynamicArray<Packet<float>>>;
@@ -327,6 +327,9 @@ template <typename Packet_> struct DynamicMask;
 /// Reverse-mode autodiff array
 template <typename Value> struct DiffArray;
 
+/// Forward-mode dual number with N tangents
+template <typename Type, size_t N = 1> struct Dual;
+
 template <typename Value_, size_t Size_, bool Approx_ = array_approx_v<Value_>>
 struct Matrix;
 
@@ -343,6 +346,9 @@ struct struct_support;
 template <typename Value>
 struct CUDAArray;
 
+template <typename Value>
+struct LLVMArray;
+
 template <typename T> class cuda_host_allocator;
 template <typename T> class cuda_managed_allocator;
 
@@ -0,0 +1,510 @@
+/*
+    enoki/llvm.h -- Host-backed Enoki dynamic array with JIT compilation
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#define ENOKI_LLVM 1
+
+#include <enoki/array.h>
+
+NAMESPACE_BEGIN(enoki)
+
+// -----------------------------------------------------------------------
+//! @{ \name Imports from libenoki-llvm.so
+// -----------------------------------------------------------------------
+
+/// Initialize the tracing JIT
+extern ENOKI_IMPORT void llvm_init();
+
+/// Delete the trace, requires a subsequent call by llvm_init()
+extern ENOKI_IMPORT void llvm_shutdown();
+
+/// Compile and evaluate the trace up to the current instruction
+extern ENOKI_IMPORT void llvm_eval(bool log_assembly = false);
+
+/// Invokes 'llvm_eval' if the given variable has not been evaluated yet
+extern ENOKI_IMPORT void llvm_eval_var(uint32_t index, bool log_assembly = false);
+
+/// Increase the reference count of a variable
+extern ENOKI_IMPORT void llvm_inc_ref_ext(uint32_t);
+
+/// Decrease the reference count of a variable
+extern ENOKI_IMPORT void llvm_dec_ref_ext(uint32_t);
+
+/// Return the size of a variable
+extern ENOKI_IMPORT size_t llvm_var_size(uint32_t);
+
+/// Return the pointer address of a variable (in host memory)
+extern ENOKI_IMPORT void* llvm_var_ptr(uint32_t);
+
+/// Retroactively adjust the recorded size of a variable
+extern ENOKI_IMPORT uint32_t llvm_var_set_size(uint32_t index, size_t size, bool copy = false);
+
+/// Mark a variable as dirty (e.g. due to scatter)
+extern ENOKI_IMPORT void llvm_var_mark_dirty(uint32_t);
+
+/// Attach a label to a variable (written to the kernel listing)
+extern ENOKI_IMPORT void llvm_var_set_label(uint32_t, const char *);
+
+/// Needed to mark certain instructions with side effects (e.g. scatter)
+extern ENOKI_IMPORT void llvm_var_mark_side_effect(uint32_t);
+
+/**
+ * \brief Append an operation to the trace (0 arguments)
+ *
+ * Operations are specified using a mnemonic (e.g. \c "add", \c "fma",
+ * \c "select", see \c src/llvm/jit.cpp for the complete list). Literal
+ * constants are created using <tt>"const <value>"</tt>, where \c value
+ * holds the bit representation of the constant.
+ */
+extern ENOKI_IMPORT uint32_t llvm_trace_append(EnokiType type,
+                                               const char *op);
+
+/// Append an operation to the trace (1 argument)
+extern ENOKI_IMPORT uint32_t llvm_trace_append(EnokiType type,
+                                               const char *op,
+                                               uint32_t arg1);
+
+/// Append an operation to the trace (2 arguments)
+extern ENOKI_IMPORT uint32_t llvm_trace_append(EnokiType type,
+                                               const char *op,
+                                               uint32_t arg1,
+                                               uint32_t arg2);
+
+/// Append an operation to the trace (3 arguments)
+extern ENOKI_IMPORT uint32_t llvm_trace_append(EnokiType type,
+                                               const char *op,
+                                               uint32_t arg1,
+                                               uint32_t arg2,
+                                               uint32_t arg3);
+
+/// Copy some host memory region and wrap it in a variable
+extern ENOKI_IMPORT uint32_t llvm_var_copy(EnokiType type, size_t size,
+                                           const void *value);
+
+/// Create a variable that stores a pointer to some memory region
+extern ENOKI_IMPORT uint32_t llvm_var_register_ptr(const void *ptr);
+
+/// Register a memory region (allocated via llvm_malloc()) as a variable
+extern ENOKI_IMPORT uint32_t llvm_var_register(EnokiType type, size_t size,
+                                               void *ptr, bool dealloc);
+
+/// Fetch a scalar value from an LLVM array
+extern ENOKI_IMPORT void llvm_fetch_element(void *, uint32_t, size_t, size_t);
+
+/// Allocate host memory that is suitably aligned for the compiled kernels
+extern ENOKI_IMPORT void* llvm_malloc(size_t);
+
+/// Release memory allocated via llvm_malloc()
+extern ENOKI_IMPORT void llvm_free(void *);
+
+/// Return the number of kernels in the cache of compiled kernels
+extern ENOKI_IMPORT size_t llvm_kernel_count();
+
+/// Register a callback that will be invoked before llvm_eval()
+extern ENOKI_IMPORT void llvm_register_callback(void (*callback)(void *), void *payload);
+
+/// Unregister a callback installed via 'llvm_register_callback()'
+extern ENOKI_IMPORT void llvm_unregister_callback(void (*callback)(void *), void *payload);
+
+/**
+ * \brief Current log level (0: none, 1: kernel launches,
+ * 2: +compilation/run time, 3: +kernel listing, 4: +jit trace, 5: +ref counting)
+ */
+extern ENOKI_IMPORT void llvm_set_log_level(uint32_t);
+extern ENOKI_IMPORT uint32_t llvm_log_level();
+
+//! @}
+// -----------------------------------------------------------------------
+
+/**
+ * \brief Dynamic array that records arithmetic into a trace, which is
+ * compiled and executed on the host using all cores when its contents are
+ * accessed (the CPU counterpart of \ref CUDAArray).
+ */
+template <typename Value>
+struct LLVMArray : ArrayBase<value_t<Value>, LLVMArray<Value>> {
+    template <typename T> friend struct LLVMArray;
+    using Index = uint32_t;
+
+    static constexpr EnokiType Type = enoki_type_v<Value>;
+    static constexpr bool IsLLVM = true;
+    static constexpr bool Approx = std::is_floating_point_v<Value>;
+    template <typename T> using ReplaceValue = LLVMArray<T>;
+    using MaskType = LLVMArray<bool>;
+    using ArrayType = LLVMArray;
+
+    LLVMArray() = default;
+
+    ~LLVMArray() {
+        llvm_dec_ref_ext(m_index);
+    }
+
+    LLVMArray(const LLVMArray &a) : m_index(a.m_index) {
+        llvm_inc_ref_ext(m_index);
+    }
+
+    LLVMArray(LLVMArray &&a) : m_index(a.m_index) {
+        a.m_index = 0;
+    }
+
+    template <typename T> LLVMArray(const LLVMArray<T> &v) {
+        if constexpr (LLVMArray<T>::Type == Type) {
+            m_index = v.index_();
+            llvm_inc_ref_ext(m_index);
+        } else {
+            m_index = llvm_trace_append(Type, "cvt", v.index_());
+        }
+    }
+
+    template <typename T>
+    LLVMArray(const LLVMArray<T> &v, detail::reinterpret_flag) {
+        static_assert(sizeof(T) == sizeof(Value));
+        if constexpr (LLVMArray<T>::Type != Type) {
+            m_index = llvm_trace_append(Type, "bitcast", v.index_());
+        } else {
+            m_index = v.index_();
+            llvm_inc_ref_ext(m_index);
+        }
+    }
+
+    template <typename T, enable_if_t<std::is_scalar_v<T>> = 0>
+    LLVMArray(const T &value, detail::reinterpret_flag)
+        : LLVMArray(memcpy_cast<Value>(value)) { }
+
+    template <typename T, enable_if_t<std::is_scalar_v<T>> = 0>
+    LLVMArray(T value) : LLVMArray((Value) value) { }
+
+    LLVMArray(Value value) {
+        uint64_t bits = 0;
+        if constexpr (std::is_same_v<Value, bool>)
+            bits = value ? 1 : 0;
+        else
+            bits = (uint64_t) memcpy_cast<uint_array_t<Value>>(value);
+
+        char tmp[32];
+        snprintf(tmp, 32, "const 0x%016llx", (unsigned long long) bits);
+
+        m_index = llvm_trace_append(Type, tmp);
+    }
+
+    template <typename... Args, enable_if_t<(sizeof...(Args) > 1)> = 0>
+    LLVMArray(Args&&... args) {
+        Value data[] = { (Value) args... };
+        m_index = llvm_var_copy(Type, sizeof...(Args), data);
+    }
+
+    LLVMArray &operator=(const LLVMArray &a) {
+        llvm_inc_ref_ext(a.m_index);
+        llvm_dec_ref_ext(m_index);
+        m_index = a.m_index;
+        return *this;
+    }
+
+    LLVMArray &operator=(LLVMArray &&a) {
+        std::swap(m_index, a.m_index);
+        return *this;
+    }
+
+    LLVMArray add_(const LLVMArray &v) const { return binary("add", v); }
+    LLVMArray sub_(const LLVMArray &v) const { return binary("sub", v); }
+    LLVMArray mul_(const LLVMArray &v) const { return binary("mul", v); }
+    LLVMArray div_(const LLVMArray &v) const { return binary("div", v); }
+    LLVMArray mod_(const LLVMArray &v) const { return binary("rem", v); }
+    LLVMArray min_(const LLVMArray &v) const { return binary("min", v); }
+    LLVMArray max_(const LLVMArray &v) const { return binary("max", v); }
+    LLVMArray xor_(const LLVMArray &v) const { return binary("xor", v); }
+
+    LLVMArray fmadd_(const LLVMArray &a, const LLVMArray &b) const {
+        return LLVMArray::from_index_(
+            llvm_trace_append(Type, "fma", index_(), a.index_(), b.index_()));
+    }
+
+    LLVMArray fmsub_(const LLVMArray &a, const LLVMArray &b) const {
+        return fmadd_(a, -b);
+    }
+
+    LLVMArray fnmadd_(const LLVMArray &a, const LLVMArray &b) const {
+        return fmadd_(-a, b);
+    }
+
+    LLVMArray fnmsub_(const LLVMArray &a, const LLVMArray &b) const {
+        return -fmadd_(a, b);
+    }
+
+    LLVMArray abs_()   const { return unary("abs"); }
+    LLVMArray neg_()   const { return unary("neg"); }
+    LLVMArray sqrt_()  const { return unary("sqrt"); }
+    LLVMArray exp_()   const { return unary("exp"); }
+    LLVMArray log_()   const { return unary("log"); }
+    LLVMArray sin_()   const { return unary("sin"); }
+    LLVMArray cos_()   const { return unary("cos"); }
+    LLVMArray rcp_()   const { return unary("rcp"); }
+    LLVMArray rsqrt_() const { return unary("rsqrt"); }
+    LLVMArray floor_() const { return unary("floor"); }
+    LLVMArray ceil_()  const { return unary("ceil"); }
+    LLVMArray round_() const { return unary("round"); }
+    LLVMArray trunc_() const { return unary("trunc"); }
+    LLVMArray not_()   const { return unary("not"); }
+    LLVMArray popcnt_() const { return unary("popc"); }
+    LLVMArray lzcnt_() const { return unary("clz"); }
+    LLVMArray tzcnt_() const { return unary("ctz"); }
+
+    std::pair<LLVMArray, LLVMArray> sincos_() const {
+        return { sin_(), cos_() };
+    }
+
+    template <typename T> T floor2int_() const { return T(floor_()); }
+    template <typename T> T ceil2int_() const { return T(ceil_()); }
+
+    LLVMArray sl_(const LLVMArray &v) const { return binary("shl", v); }
+    LLVMArray sr_(const LLVMArray &v) const { return binary("shr", v); }
+
+    LLVMArray sl_(size_t value) const { return sl_(LLVMArray((Value) value)); }
+    LLVMArray sr_(size_t value) const { return sr_(LLVMArray((Value) value)); }
+
+    template <size_t Imm> LLVMArray sl_() const { return sl_(Imm); }
+    template <size_t Imm> LLVMArray sr_() const { return sr_(Imm); }
+
+    template <typename T>
+    LLVMArray or_(const LLVMArray<T> &v) const {
+        if constexpr (std::is_same_v<T, Value>) {
+            return binary("or", v);
+        } else {
+            Value all_ones = memcpy_cast<Value>(int_array_t<Value>(-1));
+            return select_(v, LLVMArray(all_ones), *this);
+        }
+    }
+
+    template <typename T>
+    LLVMArray and_(const LLVMArray<T> &v) const {
+        if constexpr (std::is_same_v<T, Value>)
+            return binary("and", v);
+        else
+            return select_(v, *this, LLVMArray(Value(0)));
+    }
+
+    template <typename T> LLVMArray andnot_(const LLVMArray<T> &v) const {
+        return and_(!v);
+    }
+
+    MaskType gt_(const LLVMArray &v)  const { return compare("gt", v); }
+    MaskType ge_(const LLVMArray &v)  const { return compare("ge", v); }
+    MaskType lt_(const LLVMArray &v)  const { return compare("lt", v); }
+    MaskType le_(const LLVMArray &v)  const { return compare("le", v); }
+    MaskType eq_(const LLVMArray &v)  const { return compare("eq", v); }
+    MaskType neq_(const LLVMArray &v) const { return compare("neq", v); }
+
+    static LLVMArray select_(const MaskType &m, const LLVMArray &t, const LLVMArray &f) {
+        return LLVMArray::from_index_(llvm_trace_append(
+            Type, "select", m.index_(), t.index_(), f.index_()));
+    }
+
+    static LLVMArray arange_(ssize_t start, ssize_t stop, ssize_t step) {
+        size_t size = size_t((stop - start + step - (step > 0 ? 1 : -1)) / step);
+
+        using UInt32 = LLVMArray<uint32_t>;
+        UInt32 index = UInt32::from_index_(
+            llvm_trace_append(EnokiType::UInt32, "index"));
+        index.m_index = llvm_var_set_size(index.index_(), size);
+
+        if (start == 0 && step == 1)
+            return index;
+        else
+            return fmadd(LLVMArray(index), LLVMArray((Value) step), LLVMArray((Value) start));
+    }
+
+    static LLVMArray linspace_(Value min, Value max, size_t size) {
+        using UInt32 = LLVMArray<uint32_t>;
+        UInt32 index = UInt32::from_index_(
+            llvm_trace_append(EnokiType::UInt32, "index"));
+        index.m_index = llvm_var_set_size(index.index_(), size);
+
+        Value step = (max - min) / Value(size - 1);
+        return fmadd(LLVMArray(index), LLVMArray(step), LLVMArray(min));
+    }
+
+    static LLVMArray empty_(size_t size) {
+        return LLVMArray::from_index_(llvm_var_register(
+            Type, size, llvm_malloc(size * sizeof(Value)), true));
+    }
+
+    static LLVMArray zero_(size_t size) {
+        return full_(Value(0), size);
+    }
+
+    static LLVMArray full_(const Value &value, size_t size) {
+        if (size == 1) {
+            return LLVMArray(value);
+        } else {
+            Value *ptr = (Value *) llvm_malloc(size * sizeof(Value));
+            std::fill(ptr, ptr + size, value);
+            return LLVMArray::from_index_(llvm_var_register(Type, size, ptr, true));
+        }
+    }
+
+    LLVMArray hsum_() const {
+        return reduce([](Value a, Value b) { return (Value) (a + b); });
+    }
+
+    LLVMArray hprod_() const {
+        return reduce([](Value a, Value b) { return (Value) (a * b); });
+    }
+
+    LLVMArray hmax_() const {
+        return reduce([](Value a, Value b) { return std::max(a, b); });
+    }
+
+    LLVMArray hmin_() const {
+        return reduce([](Value a, Value b) { return std::min(a, b); });
+    }
+
+    bool all_() const {
+        llvm_eval_var(m_index);
+        const Value *ptr = data();
+        return std::all_of(ptr, ptr + size(), [](Value v) { return (bool) v; });
+    }
+
+    bool any_() const {
+        llvm_eval_var(m_index);
+        const Value *ptr = data();
+        return std::any_of(ptr, ptr + size(), [](Value v) { return (bool) v; });
+    }
+
+    size_t count_() const {
+        llvm_eval_var(m_index);
+        const Value *ptr = data();
+        return (size_t) std::count_if(ptr, ptr + size(), [](Value v) { return (bool) v; });
+    }
+
+    static LLVMArray map(void *ptr, size_t size, bool dealloc = false) {
+        return LLVMArray::from_index_(llvm_var_register(Type, size, ptr, dealloc));
+    }
+
+    static LLVMArray copy(const void *ptr, size_t size) {
+        return LLVMArray::from_index_(llvm_var_copy(Type, size, ptr));
+    }
+
+    template <size_t Stride, typename Index, typename Mask>
+    static LLVMArray gather_(const void *ptr_, const Index &index,
+                             const Mask &mask) {
+        using UInt64 = LLVMArray<uint64_t>;
+
+        UInt64 ptr    = UInt64::from_index_(llvm_var_register_ptr(ptr_)),
+               addr   = fmadd(UInt64(index), UInt64((uint64_t) Stride), ptr);
+
+        return LLVMArray::from_index_(llvm_trace_append(
+            Type, "ld", addr.index_(), mask.index_()));
+    }
+
+    template <size_t Stride, typename Index, typename Mask>
+    void scatter_(void *ptr_, const Index &index, const Mask &mask) const {
+        using UInt64 = LLVMArray<uint64_t>;
+
+        UInt64 ptr    = UInt64::from_index_(llvm_var_register_ptr(ptr_)),
+               addr   = fmadd(UInt64(index), UInt64((uint64_t) Stride), ptr);
+
+        LLVMArray::Index var = llvm_trace_append(
+            EnokiType::UInt64, "st", addr.index_(), m_index, mask.index_());
+
+        llvm_var_mark_side_effect(var);
+    }
+
+    template <typename Mask> LLVMArray compress_(const Mask &mask) const {
+        if (mask.size() == 0)
+            return LLVMArray();
+        else if (size() == 1 && mask.size() != 0)
+            return *this;
+        else if (mask.size() != size())
+            throw std::runtime_error("LLVMArray::compress_(): size mismatch!");
+        llvm_eval_var(m_index);
+        llvm_eval_var(mask.index_());
+
+        const Value *in = data();
+        const bool *m = mask.data();
+        size_t n = size(), new_size = (size_t) std::count(m, m + n, true);
+        if (new_size == 0)
+            return LLVMArray();
+
+        Value *out = (Value *) llvm_malloc(new_size * sizeof(Value));
+        for (size_t i = 0, j = 0; i < n; ++i) {
+            if (m[i])
+                out[j++] = in[i];
+        }
+
+        return map(out, new_size, true);
+    }
+
+    Index index_() const { return m_index; }
+    size_t size() const { return llvm_var_size(m_index); }
+    bool empty() const { return size() == 0; }
+    const Value *data() const { return (const Value *) llvm_var_ptr(m_index); }
+    Value *data() { return (Value *) llvm_var_ptr(m_index); }
+    void resize(size_t size) {
+        m_index = llvm_var_set_size(m_index, size, true);
+    }
+
+    Value coeff(size_t i) const {
+        Value result = (Value) 0;
+        llvm_fetch_element(&result, m_index, i, sizeof(Value));
+        return result;
+    }
+
+    static LLVMArray from_index_(Index index) {
+        LLVMArray a;
+        a.m_index = index;
+        return a;
+    }
+
+private:
+    LLVMArray unary(const char *op) const {
+        return LLVMArray::from_index_(llvm_trace_append(Type, op, index_()));
+    }
+
+    LLVMArray binary(const char *op, const LLVMArray &v) const {
+        return LLVMArray::from_index_(
+            llvm_trace_append(Type, op, index_(), v.index_()));
+    }
+
+    MaskType compare(const char *op, const LLVMArray &v) const {
+        return MaskType::from_index_(llvm_trace_append(
+            EnokiType::Bool, op, index_(), v.index_()));
+    }
+
+    template <typename Func> LLVMArray reduce(Func func) const {
+        size_t n = size();
+        if (n == 1)
+            return *this;
+        llvm_eval_var(m_index);
+        const Value *ptr = data();
+        Value result = ptr[0];
+        for (size_t i = 1; i < n; ++i)
+            result = func(result, ptr[i]);
+        return LLVMArray(result);
+    }
+
+protected:
+    Index m_index = 0;
+};
+
+template <typename T, enable_if_t<!is_diff_array_v<T> && is_llvm_array_v<T>> = 0>
+ENOKI_INLINE void set_label(const T& a, const char *label) {
+    if constexpr (array_depth_v<T> >= 2) {
+        for (size_t i = 0; i < T::Size; ++i)
+            set_label(a.coeff(i), (std::string(label) + "." + std::to_string(i)).c_str());
+    } else {
+        llvm_var_set_label(a.index_(), label);
+    }
+}
+
+NAMESPACE_END(enoki)
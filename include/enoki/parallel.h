@@ -0,0 +1,253 @@
+/*
+    enoki/parallel.h -- Minimal thread pool for data-parallel loops over
+    dynamic arrays (used by vectorize_parallel())
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <enoki/fwd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/// Target amount of memory (in bytes, per array argument) processed by one work item
+#if !defined(ENOKI_PARALLEL_CHUNK_SIZE)
+#  define ENOKI_PARALLEL_CHUNK_SIZE 32768
+#endif
+
+NAMESPACE_BEGIN(enoki)
+NAMESPACE_BEGIN(detail)
+
+/**
+ * \brief Lazily initialized pool of worker threads
+ *
+ * The pool executes one parallel loop at a time. The calling thread takes
+ * part in the computation, hence a pool configured for \c n threads spawns
+ * <tt>n - 1</tt> workers. Work items are handed out dynamically via an atomic
+ * counter. Nested invocations (i.e. from within a work item, which is
+ * detected using a thread-local flag that is set on both the workers and the
+ * calling thread) and concurrent invocations from other threads while the pool
+ * is busy fall back to serial execution on the calling thread.
+ */
+class ThreadPool {
+public:
+    using Callback = void (*)(void *payload, size_t start, size_t end);
+
+    static ThreadPool &get() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ~ThreadPool() { stop(); }
+
+    size_t thread_count() const { return m_thread_count; }
+
+    void set_thread_count(size_t count) {
+        /* The pool cannot be reconfigured while it executes the caller */
+        if (work_flag())
+            throw std::runtime_error(
+                "set_parallel_thread_count(): cannot be called from within a "
+                "parallel_for() work item!");
+        std::lock_guard<std::mutex> guard(m_job_mutex);
+        stop();
+        m_thread_count = std::max(count, (size_t) 1);
+    }
+
+    void run(size_t size, size_t grain, Callback callback, void *payload) {
+        grain = std::max(grain, (size_t) 1);
+
+        if (size <= grain || m_thread_count <= 1 || work_flag() ||
+            !m_job_mutex.try_lock()) {
+            WorkScope scope;
+            callback(payload, 0, size);
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(m_job_mutex, std::adopt_lock);
+
+        if (m_workers.size() + 1 != m_thread_count)
+            start();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_callback = callback;
+            m_payload  = payload;
+            m_size     = size;
+            m_grain    = grain;
+            m_error    = nullptr;
+            m_next.store(0, std::memory_order_relaxed);
+            m_pending  = m_workers.size();
+            m_epoch++;
+        }
+        m_cv_work.notify_all();
+
+        {
+            WorkScope scope;
+            work();
+        }
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv_done.wait(lock, [&] { return m_pending == 0; });
+            error = m_error;
+            m_error = nullptr;
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    ThreadPool()
+        : m_thread_count((size_t) std::max(std::thread::hardware_concurrency(), 1u)) { }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// Is the current thread executing a work item (or a worker thread)?
+    static bool &work_flag() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    /// Marks the calling thread as busy while it executes work items
+    struct WorkScope {
+        WorkScope() : prev(work_flag()) { work_flag() = true; }
+        ~WorkScope() { work_flag() = prev; }
+        bool prev;
+    };
+
+    void start() {
+        stop();
+        m_shutdown = false;
+        size_t epoch = m_epoch;
+        for (size_t i = 1; i < m_thread_count; ++i)
+            m_workers.emplace_back([this, epoch] { worker(epoch); });
+    }
+
+    void stop() {
+        if (m_workers.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_cv_work.notify_all();
+        for (auto &thread : m_workers)
+            thread.join();
+        m_workers.clear();
+    }
+
+    void worker(size_t epoch) {
+        work_flag() = true;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv_work.wait(lock, [&] { return m_shutdown || m_epoch != epoch; });
+            if (m_shutdown)
+                return;
+            epoch = m_epoch;
+
+            lock.unlock();
+            work();
+            lock.lock();
+
+            if (--m_pending == 0)
+                m_cv_done.notify_all();
+        }
+    }
+
+    /// Process work items until the loop range is exhausted
+    void work() {
+        while (true) {
+            size_t start = m_next.fetch_add(m_grain, std::memory_order_relaxed);
+            if (start >= m_size)
+                break;
+            size_t end = std::min(start + m_grain, m_size);
+
+            try {
+                m_callback(m_payload, start, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+                /* Prevent other threads from picking up further work */
+                m_next.store(m_size, std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_thread_count;
+
+    /// Serializes parallel loops issued by different threads
+    std::mutex m_job_mutex;
+
+    /// Protects the job description and worker bookkeeping below
+    std::mutex m_mutex;
+    std::condition_variable m_cv_work, m_cv_done;
+    size_t m_epoch = 0;
+    size_t m_pending = 0;
+    bool m_shutdown = false;
+
+    Callback m_callback = nullptr;
+    void *m_payload = nullptr;
+    size_t m_size = 0, m_grain = 1;
+    std::atomic<size_t> m_next { 0 };
+    std::exception_ptr m_error;
+};
+
+NAMESPACE_END(detail)
+
+/// Return the number of threads used by parallel_for() (including the caller)
+inline size_t parallel_thread_count() {
+    return detail::ThreadPool::get().thread_count();
+}
+
+/**
+ * \brief Set the number of threads used by parallel_for() (including the
+ * caller). The default is <tt>std::thread::hardware_concurrency()</tt>, and a
+ * value of \c 1 disables multithreading.
+ */
+inline void set_parallel_thread_count(size_t count) {
+    detail::ThreadPool::get().set_thread_count(count);
+}
+
+/**
+ * \brief Invoke <tt>func(start, end)</tt> on disjoint subranges of
+ * <tt>[0, size)</tt> that cover the entire range, in parallel
+ *
+ * Each subrange contains at most \c grain entries. The function returns once
+ * all subranges have been processed. If \c func throws an exception, the
+ * remaining subranges are skipped, and the first exception is rethrown on the
+ * calling thread.
+ */
+template <typename Func> void parallel_for(size_t size, size_t grain, Func &&func) {
+    using FuncType = std::remove_reference_t<Func>;
+
+    detail::ThreadPool::get().run(
+        size, grain,
+        [](void *payload, size_t start, size_t end) {
+            (*(FuncType *) payload)(start, end);
+        },
+        (void *) std::addressof(func));
+}
+
+NAMESPACE_END(enoki)
@@ -15,10 +15,13 @@
 #include <enoki/cuda.h>
 #include <enoki/autodiff.h>
 
-#include <unordered_map>
-#include <set>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <limits>
 #include <sstream>
 #include <iomanip>
+#include <unordered_map>
 
 #if defined(NDEBUG)
 #  define ENOKI_AUTODIFF_DEFAULT_LOG_LEVEL 0
@@ -29,6 +32,15 @@
 /// Max. allowed cost in number of arithmetic operations that a simplification can do
 #define ENOKI_AUTODIFF_MAX_SIMPLIFICATION_COST 10
 
+/// Number of nodes queued by dec_ref_ext() that triggers their collapse in append*()
+#define ENOKI_AUTODIFF_PENDING_BATCH 32
+
+/// Min. average number of consecutive lanes sharing an offset for sorted gathers
+#define ENOKI_AUTODIFF_SORTED_GATHER_MIN_RUN 4
+
+/// Number of nodes per block of the node arena (log2)
+#define ENOKI_AUTODIFF_NODE_BLOCK_SHIFT 12
+
 NAMESPACE_BEGIN(enoki)
 
 using Index = uint32_t;
@@ -38,18 +50,92 @@ Value safe_mul(const Value &value1, const Value &value2);
 template <typename Value>
 Value safe_fmadd(const Value &value1, const Value &value2, const Value &value3);
 
-template <typename Value> struct Tape<Value>::Node {
-    /// Descriptive label
-    std::string label;
+/**
+ * \brief Minimal vector with inline storage for the first \c Inline entries
+ *
+ * Most nodes of a computation graph have only a small number of incident
+ * edges. Storing them inline avoids a heap allocation per node.
+ */
+template <typename T, uint32_t Inline> struct SmallVector {
+    SmallVector() = default;
+    SmallVector(const SmallVector &) = delete;
+    SmallVector &operator=(const SmallVector &) = delete;
+
+    ~SmallVector() {
+        clear();
+        if (m_data != inline_data())
+            std::allocator<T>().deallocate(m_data, m_capacity);
+    }
+
+    T *begin() { return m_data; }
+    T *end() { return m_data + m_size; }
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+    T &operator[](size_t i) { return m_data[i]; }
+    const T &operator[](size_t i) const { return m_data[i]; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    template <typename... Args> T &emplace_back(Args &&... args) {
+        if (ENOKI_UNLIKELY(m_size == m_capacity))
+            grow();
+        T *ptr = new (m_data + m_size) T(std::forward<Args>(args)...);
+        m_size++;
+        return *ptr;
+    }
 
+    void push_back(const T &value) { emplace_back(value); }
+
+    T *erase(T *it) {
+        std::move(it + 1, end(), it);
+        m_data[--m_size].~T();
+        return it;
+    }
+
+    /// Destroy all entries (the capacity is retained)
+    void clear() {
+        for (uint32_t i = 0; i < m_size; ++i)
+            m_data[i].~T();
+        m_size = 0;
+    }
+
+private:
+    T *inline_data() { return (T *) m_inline; }
+
+    void grow() {
+        uint32_t capacity = m_capacity * 2;
+        T *data = std::allocator<T>().allocate(capacity);
+        for (uint32_t i = 0; i < m_size; ++i) {
+            new (data + i) T(std::move(m_data[i]));
+            m_data[i].~T();
+        }
+        if (m_data != inline_data())
+            std::allocator<T>().deallocate(m_data, m_capacity);
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+private:
+    alignas(T) unsigned char m_inline[Inline * sizeof(T)];
+    T *m_data = inline_data();
+    uint32_t m_size = 0, m_capacity = Inline;
+};
+
+template <typename Value> struct Tape<Value>::Node {
     /// Gradient value
     Value grad;
 
-    /// Pointer to incident edge linked list
-    std::vector<Edge> edges;
+    /// Incident edges
+    SmallVector<Edge, 2> edges;
 
     /// Reverse edge list
-    std::vector<uint32_t> edges_rev;
+    SmallVector<Index, 4> edges_rev;
+
+    /// Descriptive label provided at creation time (must have static storage)
+    const char *label_static = nullptr;
+
+    /// Label assigned via set_label() or with a prefix (allocated on demand)
+    std::unique_ptr<std::string> label_custom;
 
     /// External (i.e. by Enoki) reference count
     uint32_t ref_count_ext = 0;
@@ -60,13 +146,22 @@ template <typename Value> struct Tape<Value>::Node {
     /// Size of the variable
     uint32_t size = 0;
 
-    Node(size_t size, const char *label)
-        : label(label ? label : ""), size((uint32_t) size) { }
+    /// Profiling bucket, i.e. label prefix at creation time (see Detail::profile_ids)
+    uint16_t profile = 0;
+
+    /// Is this slot of the node arena in use?
+    bool used = false;
 
     bool is_scalar() const {
         return size == 1;
     }
 
+    const char *label() const {
+        if (label_custom)
+            return label_custom->c_str();
+        return label_static ? label_static : "";
+    }
+
     bool collapse_allowed() const {
         return !edges.empty() && !edges_rev.empty();
     }
@@ -96,9 +191,7 @@ template <typename Value> struct Tape<Value>::Node {
 
     Node() = default;
     Node(const Node &) = delete;
-    Node(Node&&) = default;
     Node& operator=(const Node &) = delete;
-    Node& operator=(Node&&) = default;
 };
 
 template <typename Value> struct Tape<Value>::Edge {
@@ -111,12 +204,12 @@ template <typename Value> struct Tape<Value>::Edge {
     /// Optional: special operation (scatter/gather/reduction)
     std::unique_ptr<Special> special;
 
-    /// Pointer to next edge
-    std::unique_ptr<Edge> next;
-
     Edge(Index source, const Value &weight)
         : source(source), weight(weight) { }
 
+    Edge(Index source, Value &&weight)
+        : source(source), weight(std::move(weight)) { }
+
     Edge(Index source, Special *special)
         : source(source), special(special) { }
 
@@ -138,54 +231,1050 @@ template <typename Value> struct Tape<Value>::Special {
         throw std::runtime_error("Special::forward(): not implemented!");
     }
 
+    /// Does backward() only depend on the gradients of the two endpoints?
+    virtual bool is_stateless() const { return true; }
+
     virtual ~Special() = default;
 };
 
+template <typename Value> struct Tape<Value>::Capture {
+    /// Node sizes (in order of creation)
+    std::vector<uint32_t> size;
+
+    /// Edges of node 'i' are stored at [edge_offset[i], edge_offset[i + 1])
+    std::vector<uint32_t> edge_offset { 0 }, edge_source;
+    std::vector<Value> edge_weight;
+
+    /// Node positions of the inputs and outputs (outputs: -1 == constant)
+    std::vector<uint32_t> inputs, outputs;
+
+    /// Number of nodes and inputs appended during the current evaluation
+    uint32_t position = 0, input_position = 0;
+
+    /// Has the structure of the graph been recorded?
+    bool recorded = false;
+};
+
 template <typename Value> struct Tape<Value>::Detail {
+    static constexpr Index node_block_size = 1u << ENOKI_AUTODIFF_NODE_BLOCK_SHIFT;
+
+    /// Marks indices that refer to the nodes of a graph capture
+    static constexpr Index capture_flag = 0x80000000u;
+
     Index node_counter = 1,
           node_counter_last = 1;
 
-    std::unordered_map<Index, Node> nodes;
+    /// Node arena: fixed-size blocks, hence references remain valid as it grows
+    std::vector<std::unique_ptr<Node[]>> node_blocks;
+
+    /// Number of arena slots in use or on the free list (slot 0 is reserved)
+    Index node_slots = 1;
+
+    /// Indices of released arena slots
+    std::vector<Index> node_free;
+
     std::vector<std::string> prefix;
     Index *scatter_gather_index = nullptr;
     size_t scatter_gather_size = 0;
     bool scatter_gather_permute = false;
     uint32_t log_level = ENOKI_AUTODIFF_DEFAULT_LOG_LEVEL;
     bool graph_simplification = true,
-         is_simplified = true;
+         is_simplified = true,
+         parallel_backward = false,
+         sorted_gather = false;
+
+    /// Graph capture that is currently being recorded or replayed
+    Capture *capture = nullptr;
+
+    /// Nodes selected for next backward/forward pass (in DFS postorder)
+    std::vector<Index> scheduled;
+
+    /// Bit mask marking the nodes in 'scheduled'
+    std::vector<uint64_t> visited;
+
+    /// Stack of (node index, next edge) pairs used by dfs()
+    std::vector<std::pair<Index, uint32_t>> dfs_stack;
+
+    /// Indexed binary min-heap of (score, index) pairs of collapse candidates
+    std::vector<std::pair<Index, Index>> heap;
+
+    /// Position of each node within 'heap' plus one (0 == not queued)
+    std::vector<uint32_t> heap_pos;
+
+    /// Is a node currently being collapsed? (prevents reentrant simplification)
+    bool simplifying = false;
+
+    /// Number of nodes queued by dec_ref_ext() since the last simplify_pending()
+    uint32_t pending = 0;
+
+    /**
+     * \brief Pool of released gradient and edge weight buffers
+     *
+     * The storage of CPU dynamic arrays released by the tape (gradients that
+     * are cleared during traversals, weights of removed edges) is kept here,
+     * bucketed by the number of packets. Seeds and the gradients of regular
+     * edges are created via pool_acquire() (see set_gradient(),
+     * accumulate_pooled() and accumulate_batch()) in serial, parallel and
+     * batched traversals. Repeated differentiation of graphs with a similar
+     * structure (e.g. the iterations of an optimization) therefore performs
+     * almost no heap allocations during traversals. Edge weights are computed
+     * by the arithmetic that records the graph and do not come from the pool.
+     *
+     * After each traversal, every bucket retains as many buffers as were
+     * requested from it since the previous traversal. The remaining ones are
+     * returned to the allocator, where they serve the arithmetic that
+     * produces the next graph.
+     */
+    struct PoolBucket {
+        std::vector<Value> free;
+        size_t requests = 0;
+    };
+
+    std::unordered_map<size_t, PoolBucket> pool;
+
+    /// Memory held by 'pool' (in bytes)
+    size_t pool_bytes = 0;
+
+    static constexpr bool pool_enabled =
+        is_dynamic_v<Value> && !is_cuda_array_v<Value>;
+
+    /// Is the pool accessed by several threads? (see backward_parallel())
+    bool pool_shared = false;
+    std::mutex pool_mutex;
+
+    /// Return an uninitialized array of the given size, preferably from the pool
+    Value pool_acquire(size_t size) {
+        if constexpr (pool_enabled) {
+            using Packet = typename Value::Packet;
+            std::unique_lock<std::mutex> guard(pool_mutex, std::defer_lock);
+            if (pool_shared)
+                guard.lock();
+            size_t packets = (size + Packet::Size - 1) / Packet::Size;
+            PoolBucket &bucket = pool[packets];
+            bucket.requests++;
+            if (!bucket.free.empty()) {
+                Value value = std::move(bucket.free.back());
+                bucket.free.pop_back();
+                pool_bytes -= packets * sizeof(Packet);
+                value.resize(size);
+                return value;
+            }
+        }
+        return empty<Value>(size);
+    }
+
+    /// Move the storage of 'value' into the pool (or release it)
+    void pool_release(Value &value) {
+        if constexpr (pool_enabled) {
+            size_t packets = value.packets_allocated();
+            if (value.size() > 0 && !value.is_mapped()) {
+                PoolBucket &bucket = pool[packets];
+                bucket.free.push_back(std::move(value));
+                pool_bytes += packets * sizeof(typename Value::Packet);
+            }
+        }
+        value = Value();
+    }
+
+    /// Shrink the buckets to the number of requests since the last call
+    void pool_trim() {
+        if constexpr (pool_enabled) {
+            for (auto it = pool.begin(); it != pool.end(); ) {
+                PoolBucket &bucket = it->second;
+                while (bucket.free.size() > bucket.requests) {
+                    pool_bytes -= it->first * sizeof(typename Value::Packet);
+                    bucket.free.pop_back();
+                }
+                bucket.requests = 0;
+                if (bucket.free.empty())
+                    it = pool.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+
+    /// Record the derivatives of edge weights via Tape::append_hessian()?
+    bool second_order = false;
+
+    /// Derivative 'h' of the weight of the edge from 'source' w.r.t. the input 'input'
+    struct HessianEntry {
+        Index source, input;
+        Value h;
+    };
+
+    /**
+     * \brief Second-order information of the nodes created while
+     * 'second_order' was set (used by Tape::hvp())
+     *
+     * Entries refer to the sources of a node by index, hence graph
+     * simplification is suspended while this map is non-empty.
+     */
+    std::unordered_map<Index, std::vector<HessianEntry>> hessian;
+
+    /// Collect statistics in 'profile_stats'?
+    bool profiling = false;
+
+    /// Bucket of the nodes created under the current label prefix
+    uint16_t profile_current = 0;
+
+    /// Label prefixes and statistics of the profiling buckets
+    std::vector<std::string> profile_names { "" };
+    std::vector<ProfileEntry> profile_stats { ProfileEntry() };
+    std::unordered_map<std::string, uint16_t> profile_ids { { "", 0 } };
+
+    /// Protects 'profile_stats' during parallel traversals
+    std::mutex profile_mutex;
+
+    /// Look up the profiling bucket of the current label prefix
+    void profile_update_current() {
+        std::string name;
+        for (const std::string &p : prefix)
+            name += (name.empty() ? "" : "/") + p;
+
+        auto it = profile_ids.find(name);
+        if (it != profile_ids.end()) {
+            profile_current = it->second;
+        } else if (profile_names.size() <= std::numeric_limits<uint16_t>::max()) {
+            profile_current = (uint16_t) profile_names.size();
+            profile_ids.emplace(name, profile_current);
+            profile_names.push_back(std::move(name));
+            profile_stats.emplace_back();
+        } else {
+            /* Too many distinct prefixes, account to the root bucket */
+            profile_current = 0;
+        }
+    }
+
+    /// Add the time elapsed since 'start' and executed specials to a bucket
+    void profile_record(uint16_t bucket, std::chrono::steady_clock::time_point start,
+                        size_t specials, bool backward) {
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start).count();
+        ProfileEntry &entry = profile_stats[bucket];
+        (backward ? entry.backward_ms : entry.forward_ms) += ms;
+        entry.specials += specials;
+    }
+
+    /// Recount the nodes, edges and edge weights of each bucket
+    void profile_snapshot() {
+        for (ProfileEntry &entry : profile_stats)
+            entry.nodes = entry.edges = entry.weight_bytes = 0;
+
+        for_each_node([&](Index, const Node &n) {
+            ProfileEntry &entry = profile_stats[n.profile];
+            entry.nodes++;
+            entry.edges += n.edges.size();
+            for (const Edge &edge : n.edges) {
+                if constexpr (is_dynamic_v<Value>)
+                    entry.weight_bytes += edge.weight.size() * sizeof(scalar_t<Value>);
+                else if (!edge.is_special())
+                    entry.weight_bytes += sizeof(Value);
+            }
+        });
 
-    /// Set of indices selected for next backward pass
-    std::set<uint32_t> scheduled;
+        for (ProfileEntry &entry : profile_stats)
+            entry.weight_bytes_peak = std::max(entry.weight_bytes_peak, entry.weight_bytes);
+    }
+
+    Node &slot(Index index) {
+        return node_blocks[index >> ENOKI_AUTODIFF_NODE_BLOCK_SHIFT]
+                          [index & (node_block_size - 1)];
+    }
 
     Node &node(Index index) {
-        auto it = nodes.find(index);
-        if (it == nodes.end())
+        if (ENOKI_UNLIKELY(index == 0 || index >= node_slots || !slot(index).used))
             throw std::runtime_error("autodiff: Detail::node(): Unknown index " +
                                      std::to_string(index));
-        return it->second;
+        return slot(index);
     }
 
-    void dfs(Index k, bool backward, bool clear_grad) {
-        if (scheduled.find(k) != scheduled.end())
-            return;
-        scheduled.insert(k);
+    /// Fetch an unused slot from the arena (reusing released ones first)
+    Index alloc_node() {
+        if (!node_free.empty()) {
+            Index index = node_free.back();
+            node_free.pop_back();
+            return index;
+        }
+
+        if (ENOKI_UNLIKELY(node_slots >= node_blocks.size() * node_block_size)) {
+            if (node_slots >= capture_flag - node_block_size)
+                throw std::runtime_error("autodiff: exceeded the maximum number of nodes!");
+            node_blocks.emplace_back(new Node[node_block_size]);
+        }
+
+        return node_slots++;
+    }
 
-        Node &n = node(k);
+    /// Reset a node and return its slot to the arena
+    void release_node(Index index) {
+        heap_remove(index);
+        Node &n = slot(index);
+        pool_release(n.grad);
+        for (Edge &edge : n.edges)
+            pool_release(edge.weight);
+        n.edges.clear();
+        n.edges_rev.clear();
+        n.label_static = nullptr;
+        n.label_custom.reset();
+        n.ref_count_ext = n.ref_count_int = n.size = 0;
+        n.profile = 0;
+        n.used = false;
+        node_free.push_back(index);
+        if (ENOKI_UNLIKELY(!hessian.empty()))
+            hessian.erase(index);
+    }
+
+    /// Invoke 'func(index, node)' for each live node in order of increasing index
+    template <typename Func> void for_each_node(Func &&func) {
+        for (Index index = 1; index < node_slots; ++index) {
+            Node &n = slot(index);
+            if (n.used)
+                func(index, n);
+        }
+    }
+
+    bool is_visited(Index index) const {
+        return (visited[index >> 6] >> (index & 63)) & 1;
+    }
+
+    /// Add a node to the traversal and clear its gradient if requested
+    void visit(Index index, bool clear_grad) {
+        Node &n = node(index);
+        visited[index >> 6] |= uint64_t(1) << (index & 63);
         if (clear_grad) {
             if (is_dynamic_v<Value>)
                 n.grad = Value();
             else
                 n.grad = zero<Value>();
         }
+        dfs_stack.emplace_back(index, 0);
+    }
+
+    /**
+     * \brief Iterative depth-first search along the edges (backward) or
+     * reverse edges (forward) starting at node \c k
+     *
+     * Newly reached nodes are appended to \c scheduled in postorder, hence
+     * traversing \c scheduled in reverse always visits a node before the
+     * nodes that it depends on (backward) or that depend on it (forward).
+     */
+    void dfs(Index k, bool backward, bool clear_grad) {
+        if (visited.size() * 64 < node_slots)
+            visited.resize((node_slots + 63) / 64, 0);
+
+        if (is_visited(k))
+            return;
+        visit(k, clear_grad);
+
+        while (!dfs_stack.empty()) {
+            auto [index, pos] = dfs_stack.back();
+            const Node &n = slot(index);
+
+            if (pos < (backward ? n.edges.size() : n.edges_rev.size())) {
+                Index next = backward ? n.edges[pos].source : n.edges_rev[pos];
+                dfs_stack.back().second++;
+                if (!is_visited(next))
+                    visit(next, clear_grad);
+            } else {
+                dfs_stack.pop_back();
+                scheduled.push_back(index);
+            }
+        }
+    }
 
-        if (backward) {
-            for (const Edge &edge : n.edges)
-                dfs(edge.source, backward, clear_grad);
+    bool heap_contains(Index index) const {
+        return index < heap_pos.size() && heap_pos[index] != 0;
+    }
+
+    void heap_set(size_t pos, std::pair<Index, Index> entry) {
+        heap[pos] = entry;
+        heap_pos[entry.second] = (uint32_t) pos + 1;
+    }
+
+    void heap_sift_up(size_t pos) {
+        std::pair<Index, Index> entry = heap[pos];
+        while (pos > 0) {
+            size_t parent = (pos - 1) / 2;
+            if (!(entry < heap[parent]))
+                break;
+            heap_set(pos, heap[parent]);
+            pos = parent;
+        }
+        heap_set(pos, entry);
+    }
+
+    void heap_sift_down(size_t pos) {
+        std::pair<Index, Index> entry = heap[pos];
+        size_t size = heap.size();
+        while (true) {
+            size_t child = 2 * pos + 1;
+            if (child >= size)
+                break;
+            if (child + 1 < size && heap[child + 1] < heap[child])
+                child++;
+            if (!(heap[child] < entry))
+                break;
+            heap_set(pos, heap[child]);
+            pos = child;
+        }
+        heap_set(pos, entry);
+    }
+
+    /// Queue a node for collapsing, or update its score if already queued
+    void heap_push(Index index) {
+        if (heap_pos.size() < node_slots)
+            heap_pos.resize(node_slots, 0);
+        if (heap_pos[index] != 0) {
+            heap_update(index);
+            return;
+        }
+        heap.emplace_back(slot(index).score(), index);
+        heap_sift_up(heap.size() - 1);
+    }
+
+    /// Restore the heap property after the score of a queued node changed
+    void heap_update(Index index) {
+        if (!heap_contains(index))
+            return;
+        size_t pos = heap_pos[index] - 1;
+        Index score = slot(index).score();
+        if (score == heap[pos].first)
+            return;
+        bool decrease = score < heap[pos].first;
+        heap[pos].first = score;
+        if (decrease)
+            heap_sift_up(pos);
+        else
+            heap_sift_down(pos);
+    }
+
+    void heap_remove(Index index) {
+        if (!heap_contains(index))
+            return;
+        size_t pos = heap_pos[index] - 1;
+        heap_pos[index] = 0;
+        std::pair<Index, Index> last = heap.back();
+        heap.pop_back();
+        if (pos < heap.size()) {
+            heap_set(pos, last);
+            heap_sift_up(pos);
+            heap_sift_down(heap_pos[last.second] - 1);
+        }
+    }
+
+    Index heap_pop() {
+        Index index = heap.front().second;
+        heap_remove(index);
+        return index;
+    }
+
+    /// Clear the list of scheduled nodes
+    void clear_schedule() {
+        for (Index index : scheduled)
+            visited[index >> 6] &= ~(uint64_t(1) << (index & 63));
+        scheduled.clear();
+    }
+
+    /// Ensure that the gradient of a node matches its size (broadcasting if needed)
+    void check_grad_size(Node &n, const char *func) {
+        check_grad_size(n.grad, n.size, func);
+    }
+
+    static void check_grad_size(Value &grad, uint32_t size, const char *func) {
+        if constexpr (is_dynamic_v<Value>) {
+            if (ENOKI_UNLIKELY(size != grad.size())) {
+                if (grad.size() == 1)
+                    set_slices(grad, size);
+                else
+                    throw std::runtime_error(
+                        std::string(func) + "(): gradient sizes don't match: expected " +
+                        std::to_string(size) + ", got " +
+                        std::to_string(grad.size()));
+            }
+        }
+    }
+
+    static bool grad_empty(const Value &grad) {
+        if constexpr (is_dynamic_v<Value>)
+            return grad.empty();
+        else
+            return false;
+    }
+
+    /// Accumulate 'weight * grad_target' into the gradient of a node of size 'source_size'
+    static void accumulate(Value &grad_source, uint32_t source_size,
+                           const Value &weight, const Value &grad_target) {
+        if constexpr (is_dynamic_v<Value>) {
+            if (source_size == 1 && (weight.size() != 1 || grad_target.size() != 1)) {
+                if (grad_source.empty())
+                    grad_source = hsum(safe_mul(weight, grad_target));
+                else
+                    grad_source += hsum(safe_mul(weight, grad_target));
+            } else {
+                if (grad_source.empty())
+                    grad_source = safe_mul(weight, grad_target);
+                else
+                    grad_source = safe_fmadd(weight, grad_target, grad_source);
+            }
+        } else {
+            grad_source = safe_fmadd(weight, grad_target, grad_source);
+        }
+    }
+
+    /**
+     * \brief Variant of accumulate() used by traversals of the tape
+     *
+     * For CPU dynamic arrays, \c grad_source is updated in place and new
+     * gradients are obtained from the pool, so that no intermediate products
+     * are allocated.
+     */
+    void accumulate_pooled(Value &grad_source, uint32_t source_size,
+                           const Value &weight, const Value &grad_target) {
+        if constexpr (pool_enabled) {
+            if (accumulate_packets(grad_source, source_size, weight, grad_target))
+                return;
+        }
+        accumulate(grad_source, source_size, weight, grad_target);
+    }
+
+    /// Packet-wise accumulate_pooled() (returns \c false if the operand sizes are unsupported)
+    bool accumulate_packets(Value &grad_source, uint32_t source_size,
+                            const Value &weight, const Value &grad_target) {
+        if constexpr (!pool_enabled) {
+            return false;
         } else {
-            for (Index k2: n.edges_rev)
-                dfs(k2, backward, clear_grad);
+            using Packet = typename Value::Packet;
+            using Scalar = scalar_t<Value>;
+
+            size_t size_w = weight.size(), size_g = grad_target.size(),
+                   size = std::max(size_w, size_g);
+            if (size == 0 || (size_w != 1 && size_w != size) ||
+                (size_g != 1 && size_g != size))
+                return false;
+
+            Packet weight_b(weight.coeff(0)), grad_b(grad_target.coeff(0));
+
+            if (size == 1) {
+                /* Scalar product, possibly broadcast to a larger gradient */
+                Scalar result = safe_mul(weight_b, grad_b).coeff(0);
+                Packet result_b(result);
+                if (grad_source.empty()) {
+                    grad_source = pool_acquire(source_size);
+                    for (size_t i = 0; i < grad_source.packets(); ++i)
+                        grad_source.packet(i) = result_b;
+                } else if (grad_source.size() == 1) {
+                    grad_source.coeff(0) += result;
+                } else {
+                    for (size_t i = 0; i < grad_source.packets(); ++i)
+                        grad_source.packet(i) += result_b;
+                }
+                return true;
+            }
+
+            auto w = [&](size_t i) -> const Packet & {
+                return size_w == 1 ? weight_b : weight.packet(i);
+            };
+            auto g = [&](size_t i) -> const Packet & {
+                return size_g == 1 ? grad_b : grad_target.packet(i);
+            };
+            size_t packets = (size + Packet::Size - 1) / Packet::Size;
+
+            if (source_size == 1) {
+                if (!grad_source.empty() && grad_source.size() != 1)
+                    return false;
+
+                /* Reduction, the last packet may be partially occupied */
+                Packet sum = zero<Packet>();
+                for (size_t i = 0; i < packets - 1; ++i)
+                    sum += safe_mul(w(i), g(i));
+                Packet last = safe_mul(w(packets - 1), g(packets - 1));
+                Scalar result = hsum(sum);
+                for (size_t j = 0, n = size - (packets - 1) * Packet::Size; j < n; ++j)
+                    result += last.coeff(j);
+
+                if (grad_source.empty()) {
+                    grad_source = pool_acquire(1);
+                    grad_source.coeff(0) = result;
+                } else {
+                    grad_source.coeff(0) += result;
+                }
+            } else {
+                if (grad_source.empty()) {
+                    grad_source = pool_acquire(size);
+                    for (size_t i = 0; i < packets; ++i)
+                        grad_source.packet(i) = safe_mul(w(i), g(i));
+                } else if (grad_source.size() == size) {
+                    for (size_t i = 0; i < packets; ++i) {
+                        Packet &gs = grad_source.packet(i);
+                        gs = safe_fmadd(w(i), g(i), gs);
+                    }
+                } else {
+                    return false;
+                }
+            }
+            return true;
         }
     }
+
+    /**
+     * \brief Batched variant of accumulate() for \c count seeds
+     *
+     * When all operands of a CPU dynamic array have the same size, the
+     * accumulation is fused into a single pass over the packets of
+     * \c weight so that each packet is loaded only once.
+     */
+    void accumulate_batch(Value *grad_source, uint32_t source_size,
+                          const Value &weight, const Value *grad_target,
+                          size_t count) {
+        if constexpr (is_dynamic_v<Value> && !is_cuda_array_v<Value>) {
+            size_t size = weight.size();
+            bool fused = size > 1 && source_size == size;
+            for (size_t k = 0; k < count && fused; ++k) {
+                if (!grad_target[k].empty() && grad_target[k].size() != size)
+                    fused = false;
+                if (!grad_source[k].empty() && grad_source[k].size() != size)
+                    fused = false;
+            }
+
+            if (fused) {
+                batch_init.resize(count);
+                for (size_t k = 0; k < count; ++k) {
+                    bool init = !grad_target[k].empty() && grad_source[k].empty();
+                    if (init)
+                        grad_source[k] = pool_acquire(size);
+                    batch_init[k] = init;
+                }
+
+                for (size_t i = 0; i < weight.packets(); ++i) {
+                    auto w = weight.packet(i);
+                    for (size_t k = 0; k < count; ++k) {
+                        if (grad_target[k].empty())
+                            continue;
+                        auto &g = grad_source[k].packet(i);
+                        g = batch_init[k] ? safe_mul(w, grad_target[k].packet(i))
+                                          : safe_fmadd(w, grad_target[k].packet(i), g);
+                    }
+                }
+                return;
+            }
+        }
+
+        for (size_t k = 0; k < count; ++k) {
+            if (!grad_empty(grad_target[k]))
+                accumulate_pooled(grad_source[k], source_size, weight, grad_target[k]);
+        }
+    }
+
+    /// Propagate the gradient of 'target' along 'edge' into its source node
+    void backward_edge(Index target_idx, const Node &target, const Edge &edge) {
+        Node &source = slot(edge.source);
+        if (ENOKI_LIKELY(!edge.is_special()))
+            accumulate_pooled(source.grad, source.size, edge.weight, target.grad);
+        else
+            edge.special->backward(this, target_idx, edge);
+    }
+
+    /**
+     * \brief Propagate the gradient of 'target' along all of its edges
+     *
+     * For CPU dynamic arrays, the regular edges whose source has the same
+     * size as the gradient of 'target' are fused into a single pass over its
+     * packets that updates the source gradients in place. The remaining
+     * edges are subsequently handled by backward_edge().
+     */
+    void backward_node(Index target_idx, const Node &target) {
+        if constexpr (is_dynamic_v<Value> && !is_cuda_array_v<Value>) {
+            using Packet = typename Value::Packet;
+            size_t size = target.grad.size();
+            if (size > 1 && target.size == size) {
+                fused_edges.clear();
+                bool unfused = false;
+
+                for (const Edge &edge : target.edges) {
+                    Node &source = slot(edge.source);
+                    size_t weight_size = edge.weight.size();
+                    if (edge.is_special() || source.size != size ||
+                        (weight_size != 1 && weight_size != size) ||
+                        (!source.grad.empty() && source.grad.size() != size)) {
+                        unfused = true;
+                        continue;
+                    }
+
+                    bool init = source.grad.empty();
+                    if (init)
+                        source.grad = pool_acquire(size);
+
+                    fused_edges.push_back(FusedEdge{
+                        &source.grad, weight_size == 1 ? nullptr : &edge.weight,
+                        edge.weight.coeff(0), init });
+                }
+
+                for (size_t i = 0; i < target.grad.packets(); ++i) {
+                    auto g = target.grad.packet(i);
+                    for (const FusedEdge &e : fused_edges) {
+                        auto w = e.weight ? e.weight->packet(i)
+                                          : Packet(e.weight_scalar);
+                        auto &gs = e.grad->packet(i);
+                        gs = e.init ? safe_mul(w, g) : safe_fmadd(w, g, gs);
+                    }
+                }
+
+                if (unfused) {
+                    for (const Edge &edge : target.edges) {
+                        const Node &source = slot(edge.source);
+                        size_t weight_size = edge.weight.size();
+                        if (edge.is_special() || source.size != size ||
+                            (weight_size != 1 && weight_size != size) ||
+                            source.grad.size() != size)
+                            backward_edge(target_idx, target, edge);
+                    }
+                }
+                return;
+            }
+        }
+
+        for (const Edge &edge : target.edges)
+            backward_edge(target_idx, target, edge);
+    }
+
+    /// Map an index returned by capture_node() back to a node position
+    uint32_t capture_position(Index index) const {
+        if (!(index & capture_flag) || (index & ~capture_flag) >= capture->position)
+            throw std::runtime_error(
+                "capture(): the captured function may only depend on "
+                "differentiable variables through its input!");
+        return index & ~capture_flag;
+    }
+
+    /**
+     * \brief Append a node to the active graph capture (when recording), or
+     * update the weights of the next node (when replaying)
+     */
+    Index capture_node(size_t size, std::initializer_list<std::pair<Index, const Value *>> edges) {
+        Capture &c = *capture;
+        uint32_t pos = c.position++;
+
+        if (!c.recorded) {
+            size_t begin = c.edge_source.size();
+            for (auto [index, weight] : edges) {
+                if (index == 0)
+                    continue;
+                uint32_t source = capture_position(index);
+                auto it = std::find(c.edge_source.begin() + begin, c.edge_source.end(), source);
+                if (it != c.edge_source.end())
+                    c.edge_weight[it - c.edge_source.begin()] += *weight;
+                else {
+                    c.edge_source.push_back(source);
+                    c.edge_weight.push_back(*weight);
+                }
+            }
+            c.size.push_back((uint32_t) size);
+            c.edge_offset.push_back((uint32_t) c.edge_source.size());
+        } else {
+            if (pos >= c.size.size())
+                throw std::runtime_error("capture(): the structure of the graph changed!");
+
+            uint32_t begin = c.edge_offset[pos], end = c.edge_offset[pos + 1],
+                     cur = begin;
+            for (auto [index, weight] : edges) {
+                if (index == 0)
+                    continue;
+                uint32_t source = capture_position(index);
+                const uint32_t *sources = c.edge_source.data(),
+                               *it = std::find(sources + begin, sources + cur, source);
+                if (it != sources + cur) {
+                    c.edge_weight[it - sources] += *weight;
+                } else {
+                    if (cur == end || sources[cur] != source)
+                        throw std::runtime_error("capture(): the structure of the graph changed!");
+                    c.edge_weight[cur++] = *weight;
+                }
+            }
+            if (cur != end)
+                throw std::runtime_error("capture(): the structure of the graph changed!");
+            c.size[pos] = (uint32_t) size;
+        }
+
+        return pos | capture_flag;
+    }
+
+    /**
+     * \brief Multithreaded variant of the gradient propagation in
+     * Tape::backward()
+     *
+     * Scheduled nodes are grouped into levels such that all nodes depending
+     * on a node belong to earlier levels. The nodes of each level are then
+     * processed in parallel. Instead of pushing gradients into their sources
+     * (which would require synchronization when several nodes of a level
+     * share a source), each node pulls the contributions of its already
+     * completed dependents, hence every gradient is written by a single
+     * thread.
+     */
+    void backward_parallel() {
+        if (node_level.size() < node_slots)
+            node_level.resize(node_slots);
+
+        /* Assign levels, visiting each node before its sources */
+        uint32_t level_count = 0;
+        for (Index index : scheduled)
+            node_level[index] = 0;
+        for (auto it = scheduled.rbegin(); it != scheduled.rend(); ++it) {
+            uint32_t level = node_level[*it];
+            for (const Edge &edge : slot(*it).edges)
+                node_level[edge.source] = std::max(node_level[edge.source], level + 1);
+            level_count = std::max(level_count, level + 1);
+        }
+
+        /* Sort the nodes by level */
+        std::vector<size_t> offset(level_count + 1, 0);
+        for (Index index : scheduled)
+            offset[node_level[index] + 1]++;
+        for (uint32_t i = 0; i < level_count; ++i)
+            offset[i + 1] += offset[i];
+
+        std::vector<Index> order(scheduled.size());
+        std::vector<size_t> pos(offset.begin(), offset.end() - 1);
+        for (Index index : scheduled)
+            order[pos[node_level[index]]++] = index;
+
+        pool_shared = true;
+        for (uint32_t i = 0; i < level_count; ++i) {
+            const Index *level = order.data() + offset[i];
+            parallel_for(offset[i + 1] - offset[i], 1, [&](size_t start, size_t end) {
+                for (size_t j = start; j < end; ++j)
+                    backward_pull(level[j]);
+            });
+        }
+        pool_shared = false;
+    }
+
+    /// Gather the gradient of a node from all scheduled nodes that depend on it
+    void backward_pull(Index index) {
+        Node &n = slot(index);
+        for (Index target_idx : n.edges_rev) {
+            if (!is_visited(target_idx))
+                continue;
+            const Node &target = slot(target_idx);
+            for (const Edge &edge : target.edges) {
+                if (edge.source != index)
+                    continue;
+                std::chrono::steady_clock::time_point start;
+                if (ENOKI_UNLIKELY(profiling))
+                    start = std::chrono::steady_clock::now();
+                backward_edge(target_idx, target, edge);
+                if (ENOKI_UNLIKELY(profiling)) {
+                    std::lock_guard<std::mutex> guard(profile_mutex);
+                    profile_record(target.profile, start, edge.is_special(), true);
+                }
+            }
+        }
+        check_grad_size(n, "backward");
+    }
+
+    /// Scratch space used by backward_parallel()
+    std::vector<uint32_t> node_level;
+
+    /**
+     * \brief Offsets and mask of a gather operation
+     *
+     * When sorted gathers are enabled, the active lanes of CPU arrays are
+     * additionally grouped by their offset, which turns the backward pass
+     * into a segmented reduction with sequential writes.
+     */
+    struct GatherIndex {
+        Int64 offset;
+        Mask mask;
+
+        /// Were 'order' and 'segments' computed?
+        bool sorted = false;
+
+        /// Active lanes sorted by offset
+        std::vector<uint32_t> order;
+
+        /// Offset and end position (within 'order') of each run of equal offsets
+        std::vector<std::pair<uint32_t, uint32_t>> segments;
+    };
+
+    /// Most recent sorted gather index (reused by gathers with the same offsets)
+    std::weak_ptr<const GatherIndex> gather_index_last;
+
+    /// Create the index of a gather from a source array of size 'size'
+    std::shared_ptr<const GatherIndex> gather_index(const Int64 &offset,
+                                                    const Mask &mask,
+                                                    size_t size, bool permute) {
+        if constexpr (is_dynamic_v<Value> && !is_cuda_array_v<Value>) {
+            if (sorted_gather && !permute) {
+                /* Gathers of multi-channel data typically share their offsets */
+                auto last = gather_index_last.lock();
+                if (last && last->offset.size() == offset.size() &&
+                    last->mask.size() == mask.size() &&
+                    all(eq(last->offset, offset)) &&
+                    none(last->mask ^ mask))
+                    return last;
+
+                auto index = std::make_shared<GatherIndex>();
+                index->offset = offset;
+                index->mask = mask;
+                if (sort_gather_index(*index, size))
+                    gather_index_last = index;
+                return index;
+            }
+        }
+
+        auto index = std::make_shared<GatherIndex>();
+        index->offset = offset;
+        index->mask = mask;
+        return index;
+    }
+
+    /// Group the active lanes of a gather by offset (returns false if not worthwhile)
+    static bool sort_gather_index(GatherIndex &index, size_t size) {
+        if constexpr (is_dynamic_v<Value> && !is_cuda_array_v<Value>) {
+            const Int64 &offset = index.offset;
+            const Mask &mask = index.mask;
+            size_t n = offset.size();
+            if (n < 2 || n > std::numeric_limits<uint32_t>::max() ||
+                size > std::numeric_limits<uint32_t>::max() ||
+                (mask.size() != 1 && mask.size() != n))
+                return false;
+
+            const int64_t *op = offset.data();
+            bool mask_broadcast = mask.size() == 1,
+                 mask_value = mask_broadcast && (bool) mask.coeff(0);
+            auto active = [&](size_t i) {
+                return mask_broadcast ? mask_value : (bool) mask.coeff(i);
+            };
+
+            /* Only worthwhile when many neighboring lanes share an offset */
+            size_t runs = 0;
+            for (size_t i = 0; i < n; ++i) {
+                if (!active(i))
+                    continue;
+                if (op[i] < 0 || (size_t) op[i] >= size)
+                    return false;
+                if (i == 0 || op[i] != op[i - 1])
+                    runs++;
+            }
+            if (runs * ENOKI_AUTODIFF_SORTED_GATHER_MIN_RUN > n)
+                return false;
+
+            auto &order = index.order;
+            auto &segments = index.segments;
+
+            if (size <= 4 * n) {
+                /* Counting sort */
+                std::vector<uint32_t> pos(size + 1, 0);
+                for (size_t i = 0; i < n; ++i) {
+                    if (active(i))
+                        pos[(size_t) op[i] + 1]++;
+                }
+                for (size_t i = 0; i < size; ++i)
+                    pos[i + 1] += pos[i];
+                order.resize(pos[size]);
+                for (size_t i = 0; i < n; ++i) {
+                    if (active(i))
+                        order[pos[(size_t) op[i]]++] = (uint32_t) i;
+                }
+                /* 'pos[o]' now refers to the end of the run of offset 'o' */
+                for (size_t o = 0; o < size; ++o) {
+                    if (pos[o] != (o == 0 ? 0 : pos[o - 1]))
+                        segments.emplace_back((uint32_t) o, pos[o]);
+                }
+            } else {
+                std::vector<uint64_t> keys;
+                keys.reserve(n);
+                for (size_t i = 0; i < n; ++i) {
+                    if (active(i))
+                        keys.push_back(((uint64_t) op[i] << 32) | i);
+                }
+                std::sort(keys.begin(), keys.end());
+                order.resize(keys.size());
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    uint32_t o = (uint32_t) (keys[i] >> 32);
+                    order[i] = (uint32_t) keys[i];
+                    if (i + 1 == keys.size() || (uint32_t) (keys[i + 1] >> 32) != o)
+                        segments.emplace_back(o, (uint32_t) (i + 1));
+                }
+            }
+
+            index.sorted = true;
+            return true;
+        } else {
+            ENOKI_MARK_USED(index);
+            ENOKI_MARK_USED(size);
+            return false;
+        }
+    }
+
+    /// Scratch space used by backward_node()
+    struct FusedEdge {
+        Value *grad;
+        const Value *weight;
+        scalar_t<Value> weight_scalar;
+        bool init;
+    };
+    std::vector<FusedEdge> fused_edges;
+
+    /**
+     * \brief Propagate the adjoint seeds <tt>[first, first + count)</tt>
+     * through the scheduled nodes in a single traversal
+     *
+     * Seed \c k of the node at position \c i of \c scheduled is stored in
+     * <tt>grad[i * stride + k]</tt>, and \c node_position maps node indices
+     * to positions. Each edge weight is thus loaded once and applied to all
+     * seeds. Special edges are evaluated once per seed by temporarily
+     * moving the adjoints into the gradients of the two endpoints. Adjoints
+     * of interior nodes are released once they have been propagated, except
+     * for the nodes listed in \c keep (sorted).
+     */
+    void backward_batch(std::vector<Value> &grad, size_t stride, size_t first,
+                        size_t count, const std::vector<Index> &keep) {
+        for (size_t i = scheduled.size(); i-- > 0;) {
+            Index target_idx = scheduled[i];
+            Node &target = slot(target_idx);
+            Value *grad_target = grad.data() + i * stride + first;
+
+            for (size_t k = 0; k < count; ++k) {
+                if (!grad_empty(grad_target[k]))
+                    check_grad_size(grad_target[k], target.size, "backward_batch");
+            }
+
+            for (const Edge &edge : target.edges) {
+                Node &source = slot(edge.source);
+                Value *grad_source =
+                    grad.data() + node_position[edge.source] * stride + first;
+
+                if (ENOKI_LIKELY(!edge.is_special())) {
+                    accumulate_batch(grad_source, source.size, edge.weight,
+                                     grad_target, count);
+                    continue;
+                }
+
+                for (size_t k = 0; k < count; ++k) {
+                    if (grad_empty(grad_target[k]))
+                        continue;
+                    std::swap(target.grad, grad_target[k]);
+                    std::swap(source.grad, grad_source[k]);
+                    edge.special->backward(this, target_idx, edge);
+                    std::swap(target.grad, grad_target[k]);
+                    std::swap(source.grad, grad_source[k]);
+                }
+            }
+
+            if (target.edges.size() > 0 &&
+                !std::binary_search(keep.begin(), keep.end(), target_idx)) {
+                for (size_t k = 0; k < count; ++k)
+                    pool_release(grad_target[k]);
+            }
+        }
+    }
+
+    /// Scratch space used by backward_batch()
+    std::vector<uint32_t> node_position;
+
+    /// Scratch space used by accumulate_batch() (was a gradient created?)
+    std::vector<uint8_t> batch_init;
 };
 
 template <typename Value> struct Tape<Value>::SimplificationLock {
@@ -201,11 +1290,24 @@ template <typename Value> struct Tape<Value>::SimplificationLock {
     bool state = false;
 };
 
-template <typename Value> Tape<Value> *Tape<Value>::s_tape = nullptr;
+/// Tape that was made current on the calling thread via Tape::set_current()
+template <typename Value> Tape<Value> *&tape_current() {
+    static thread_local Tape<Value> *tape = nullptr;
+    return tape;
+}
+
 template <typename Value> Tape<Value> *Tape<Value>::get() {
-    if (ENOKI_UNLIKELY(!s_tape))
-        s_tape = new Tape();
-    return s_tape;
+    if (Tape *tape = tape_current<Value>(); tape != nullptr)
+        return tape;
+
+    static Tape *tape_global = new Tape();
+    return tape_global;
+}
+
+template <typename Value> Tape<Value> *Tape<Value>::set_current(Tape *tape) {
+    Tape *prev = tape_current<Value>();
+    tape_current<Value>() = tape;
+    return prev;
 }
 
 template <typename Value> Tape<Value>::Tape() {
@@ -221,22 +1323,25 @@ template <typename Value> Tape<Value>::~Tape() {
         if (d->node_counter != 1)
             std::cerr << "autodiff: shutdown." << std::endl;
         size_t n_live = 0;
-        for (const auto &it : d->nodes) {
+        d->for_each_node([&](Index index, const Node &node) {
             if (n_live < 10)
-                std::cerr << "autodiff: variable " << it.first
+                std::cerr << "autodiff: variable " << index
                           << " still live at shutdown. (ref_count_int="
-                          << it.second.ref_count_int
-                          << ", ref_count_ext=" << it.second.ref_count_ext << ")"
+                          << node.ref_count_int
+                          << ", ref_count_ext=" << node.ref_count_ext << ")"
                           << std::endl;
             if (n_live == 9)
                 std::cerr << "(skipping remainder)" << std::endl;
             n_live++;
-        }
+        });
         if (n_live > 0)
             std::cerr << "autodiff: " << n_live
                       << " variables were still live at shutdown." << std::endl;
     }
 #endif
+    if constexpr (is_cuda_array_v<Value>)
+        cuda_unregister_callback((void (*)(void *)) & Tape::cuda_callback, this);
+
     delete d;
 }
 
@@ -258,61 +1363,132 @@ template <typename Value> void Tape<Value>::set_graph_simplification(bool value)
     d->graph_simplification = value;
 }
 
+template <typename Value> void Tape<Value>::set_parallel_backward(bool value) {
+    d->parallel_backward = value;
+}
+
+template <typename Value> void Tape<Value>::set_sorted_gather(bool value) {
+    d->sorted_gather = value;
+}
+
+template <typename Value> void Tape<Value>::set_second_order(bool value) {
+    d->second_order = value;
+}
+
+template <typename Value> bool Tape<Value>::second_order() const {
+    return d->second_order;
+}
+
+template <typename Value> void Tape<Value>::trim_pool() {
+    d->pool.clear();
+    d->pool_bytes = 0;
+}
+
+template <typename Value> size_t Tape<Value>::pool_size() const {
+    return d->pool_bytes;
+}
+
+template <typename Value> void Tape<Value>::set_profiling(bool value) {
+    d->profiling = value;
+}
+
+template <typename Value>
+std::map<std::string, typename Tape<Value>::ProfileEntry> Tape<Value>::profile() {
+    d->profile_snapshot();
+    std::map<std::string, ProfileEntry> result;
+    for (size_t i = 0; i < d->profile_names.size(); ++i)
+        result.emplace(d->profile_names[i], d->profile_stats[i]);
+    return result;
+}
+
+template <typename Value> void Tape<Value>::clear_profile() {
+    for (ProfileEntry &entry : d->profile_stats)
+        entry = ProfileEntry();
+}
+
 template <typename Value>
-Index Tape<Value>::append(const char *label, size_t size, Index i1, const Value &w1) {
+Index Tape<Value>::append(const char *label, size_t size, Index i1, Value w1) {
     if (i1 == 0)
         return 0;
+    if (ENOKI_UNLIKELY(d->capture))
+        return d->capture_node(size, { { i1, &w1 } });
     Index idx = append_node(size, label);
 #if !defined(NDEBUG)
     if (d->log_level >= 3)
         std::cerr << "autodiff: append(\"" << (label ? label : "") << "\", " << idx
                   << " <- " << i1 << ")" << std::endl;
 #endif
-    append_edge(i1, idx, w1);
+    append_edge(i1, idx, std::move(w1));
     return idx;
 }
 
 template <typename Value>
 Index Tape<Value>::append(const char *label, size_t size, Index i1, Index i2,
-                          const Value &w1, const Value &w2) {
+                          Value w1, Value w2) {
     if (i1 == 0 && i2 == 0)
         return 0;
+    if (ENOKI_UNLIKELY(d->capture))
+        return d->capture_node(size, { { i1, &w1 }, { i2, &w2 } });
     Index idx = append_node(size, label);
 #if !defined(NDEBUG)
     if (d->log_level >= 3)
         std::cerr << "autodiff: append(\"" << (label ? label : "") << "\", " << idx
                   << " <- [" << i1 << ", " << i2 << "])" << std::endl;
 #endif
-    append_edge(i1, idx, w1);
-    append_edge(i2, idx, w2);
+    append_edge(i1, idx, std::move(w1));
+    append_edge(i2, idx, std::move(w2));
     return idx;
 }
 
 template <typename Value>
 Index Tape<Value>::append(const char *label, size_t size, Index i1, Index i2, Index i3,
-                          const Value &w1, const Value &w2, const Value &w3) {
+                          Value w1, Value w2, Value w3) {
     if (i1 == 0 && i2 == 0 && i3 == 0)
         return 0;
+    if (ENOKI_UNLIKELY(d->capture))
+        return d->capture_node(size, { { i1, &w1 }, { i2, &w2 }, { i3, &w3 } });
     Index idx = append_node(size, label);
 #if !defined(NDEBUG)
     if (d->log_level >= 3)
         std::cerr << "autodiff: append(\"" << (label ? label : "") << "\", " << idx
                   << " <- [" << i1 << ", " << i2 << ", " << i3 << "])" << std::endl;
 #endif
-    append_edge(i1, idx, w1);
-    append_edge(i2, idx, w2);
-    append_edge(i3, idx, w3);
+    append_edge(i1, idx, std::move(w1));
+    append_edge(i2, idx, std::move(w2));
+    append_edge(i3, idx, std::move(w3));
     return idx;
 }
 
 template <typename Value>
-Index Tape<Value>::append_node(size_t size, const char *label) {
-    Index idx = d->node_counter++;
-    auto result = d->nodes.emplace(std::make_pair(idx, Node(size, label)));
+void Tape<Value>::append_hessian(Index index, Index i1, Index i2, const Value &h) {
+    if (i1 == 0 || i2 == 0)
+        return;
+    if (ENOKI_UNLIKELY(d->capture))
+        throw std::runtime_error("capture(): second-order derivatives are not supported!");
+    d->hessian[index].push_back(typename Detail::HessianEntry{ i1, i2, h });
+}
 
-    Node &node = result.first->second;
-    for (auto it = d->prefix.rbegin(); it != d->prefix.rend(); ++it)
-        node.label = *it + '/' + node.label;
+template <typename Value>
+Index Tape<Value>::append_node(size_t size, const char *label) {
+    if (ENOKI_UNLIKELY(d->pending >= ENOKI_AUTODIFF_PENDING_BATCH))
+        simplify_pending();
+
+    Index idx = d->alloc_node();
+    Node &node = d->slot(idx);
+    node.used = true;
+    d->node_counter++;
+    node.size = (uint32_t) size;
+    node.label_static = label;
+    node.profile = d->profile_current;
+    if (ENOKI_UNLIKELY(d->profiling))
+        d->profile_stats[node.profile].nodes_created++;
+
+    if (ENOKI_UNLIKELY(!d->prefix.empty())) {
+        std::string name = label ? label : "";
+        for (auto it = d->prefix.rbegin(); it != d->prefix.rend(); ++it)
+            name = *it + '/' + name;
+        node.label_custom = std::make_unique<std::string>(std::move(name));
+    }
 
 #if !defined(NDEBUG)
     if (d->log_level >= 3)
@@ -326,6 +1502,8 @@ Index Tape<Value>::append_node(size_t size, const char *label) {
 
 template <typename Value>
 Index Tape<Value>::append_leaf(size_t size) {
+    if (ENOKI_UNLIKELY(d->capture))
+        return d->capture_node(size, { });
     Index idx = append_node(size, "'unnamed'");
     Node &n = d->node(idx);
     n.grad = zero<Value>(n.size);
@@ -334,7 +1512,7 @@ Index Tape<Value>::append_leaf(size_t size) {
 
 template <typename Value>
 void Tape<Value>::set_label(Index idx, const char *label) {
-    if (idx == 0)
+    if (idx == 0 || (idx & Detail::capture_flag))
         return;
 #if !defined(NDEBUG)
     if (d->log_level >= 3)
@@ -342,7 +1520,7 @@ void Tape<Value>::set_label(Index idx, const char *label) {
 #endif
     std::string name = "'" + std::string(label) + "'";
     Node &n = d->node(idx);
-    n.label = name;
+    n.label_custom = std::make_unique<std::string>(std::move(name));
     enoki::set_label(n.grad, (label + std::string(".grad")).c_str());
 }
 
@@ -353,10 +1531,11 @@ Index Tape<Value>::append_gather(const Int64 &offset, const Mask &mask) {
            *d->scatter_gather_index == 0)
             return 0;
         Index source = *d->scatter_gather_index;
+        if (ENOKI_UNLIKELY(d->capture))
+            throw std::runtime_error("capture(): gather operations are not supported!");
 
         struct Gather : Special {
-            Int64 offset;
-            Mask mask;
+            std::shared_ptr<const typename Detail::GatherIndex> index;
             size_t size;
             bool permute;
 
@@ -368,7 +1547,7 @@ Index Tape<Value>::append_gather(const Int64 &offset, const Mask &mask) {
                 if (grad_source.size() != size)
                     throw std::runtime_error("Internal error in Gather::forward()!");
 
-                Value value = gather<Value>(grad_source, offset, mask);
+                Value value = gather<Value>(grad_source, index->offset, index->mask);
 
                 if (grad_target.empty())
                     grad_target = value;
@@ -386,18 +1565,42 @@ Index Tape<Value>::append_gather(const Int64 &offset, const Mask &mask) {
                 else if (grad_source.size() != size)
                     throw std::runtime_error("Internal error in Gather::backward()!");
 
-                if (permute)
-                    scatter(grad_source, grad_target, offset, mask);
-                else
-                    scatter_add(grad_source, grad_target, offset, mask);
+                if (permute) {
+                    scatter(grad_source, grad_target, index->offset, index->mask);
+                } else if (index->sorted && grad_target.size() == index->offset.size()) {
+                    /* Segmented reduction with sequential writes */
+                    using Scalar = scalar_t<Value>;
+                    using Packet = typename Value::Packet;
+                    using UInt32P = uint32_array_t<Packet>;
+                    constexpr uint32_t PacketSize = (uint32_t) Packet::Size;
+
+                    const Scalar *gt = grad_target.data();
+                    const uint32_t *order = index->order.data();
+                    Scalar *gs = grad_source.data();
+                    uint32_t j = 0;
+
+                    for (auto [o, end] : index->segments) {
+                        Scalar sum = 0;
+                        if (end - j >= 2 * PacketSize) {
+                            Packet accum = zero<Packet>();
+                            for (; j + PacketSize <= end; j += PacketSize)
+                                accum += gather<Packet>(gt, load_unaligned<UInt32P>(order + j));
+                            sum = hsum(accum);
+                        }
+                        for (; j < end; ++j)
+                            sum += gt[order[j]];
+                        gs[o] += sum;
+                    }
+                } else {
+                    scatter_add(grad_source, grad_target, index->offset, index->mask);
+                }
             }
         };
 
         Gather *gather = new Gather();
-        gather->offset = offset;
-        gather->mask = mask;
         gather->size = d->scatter_gather_size;
         gather->permute = d->scatter_gather_permute;
+        gather->index = d->gather_index(offset, mask, gather->size, gather->permute);
 
         Index target = append_node(slices(offset), "gather");
         d->node(target).edges.emplace_back(source, gather);
@@ -422,6 +1625,8 @@ void Tape<Value>::append_scatter(Index source, const Int64 &offset, const Mask &
 
         if (d->scatter_gather_index == nullptr || source == 0)
             return;
+        if (ENOKI_UNLIKELY(d->capture))
+            throw std::runtime_error("capture(): scatter operations are not supported!");
         Index target_orig = *d->scatter_gather_index;
 
         struct Scatter : Special {
@@ -491,20 +1696,215 @@ void Tape<Value>::append_scatter(Index source, const Int64 &offset, const Mask &
             dec_ref_ext(target_orig);
         }
 
-        *d->scatter_gather_index = target_new;
+        *d->scatter_gather_index = target_new;
+
+#if !defined(NDEBUG)
+        if (d->log_level >= 3)
+            std::cerr << "autodiff: append_scatter(" << target_orig << " <- "
+                      << source << ", scatter_add=" << scatter_add << ") -> "
+                      << target_new << std::endl;
+#endif
+    }
+}
+
+template <typename Value>
+std::vector<Index>
+Tape<Value>::append_checkpoint(const std::vector<Index> &inputs,
+                               const std::vector<size_t> &output_sizes,
+                               CheckpointCallback callback) {
+    struct CheckpointOp : CustomOp {
+        CheckpointCallback callback;
+
+        void backward(const std::vector<Value> &grad_out,
+                      std::vector<Value> &grad_in) override {
+            callback(grad_out, grad_in);
+        }
+
+        const char *name() const override { return "checkpoint"; }
+    };
+
+    auto op = std::make_shared<CheckpointOp>();
+    op->callback = std::move(callback);
+    return append_custom(inputs, output_sizes, std::move(op));
+}
+
+template <typename Value>
+std::vector<Index>
+Tape<Value>::append_custom(const std::vector<Index> &inputs,
+                           const std::vector<size_t> &output_sizes,
+                           std::shared_ptr<CustomOp> op) {
+    std::vector<Index> outputs(output_sizes.size(), 0);
+    if (std::all_of(inputs.begin(), inputs.end(), [](Index i) { return i == 0; }))
+        return outputs;
+    if (ENOKI_UNLIKELY(d->second_order))
+        throw std::runtime_error(std::string(op->name()) +
+                                 "(): second-order derivatives are not supported!");
+
+    /* Shared by all edges of the operation. The input and output gradients
+       of a traversal are gathered from the individual edges, and the
+       operation is invoked once when the first result is needed. */
+    struct State {
+        std::shared_ptr<CustomOp> op;
+        std::vector<Value> grad_out, grad_in;
+        std::mutex mutex;
+        bool ready = false;
+    };
+
+    struct CustomEdge : Special {
+        std::shared_ptr<State> state;
+
+        /* Add 'grad' to the gradient of 'node' (reducing it if needed) */
+        static void accum(Node &node, Value grad) {
+            if constexpr (is_dynamic_v<Value>) {
+                if (grad.empty())
+                    return;
+                if (node.size == 1 && grad.size() != 1)
+                    grad = hsum(grad);
+                if (node.grad.empty()) {
+                    node.grad = std::move(grad);
+                    return;
+                }
+            }
+            node.grad += grad;
+        }
+
+        bool is_stateless() const override { return false; }
+    };
+
+    /* Output -> joint node */
+    struct CustomOutput : CustomEdge {
+        size_t slot;
+
+        /* Stash the output gradient */
+        void backward(Detail *detail, Index target_idx,
+                      const Edge &edge) const override {
+            State &state = *this->state;
+            state.grad_out[slot] = detail->node(target_idx).grad;
+            state.ready = false;
+
+            Node &joint = detail->node(edge.source);
+            if constexpr (is_dynamic_v<Value>) {
+                if (joint.grad.empty())
+                    joint.grad = zero<Value>(1);
+            }
+        }
+
+        /* Evaluate the forward derivative and propagate */
+        void forward(Detail *detail, Index target_idx,
+                     const Edge &) const override {
+            State &state = *this->state;
+            {
+                std::lock_guard<std::mutex> guard(state.mutex);
+                if (!state.ready) {
+                    state.grad_out.assign(state.grad_out.size(), Value());
+                    state.op->forward(state.grad_in, state.grad_out);
+                    state.ready = true;
+                    /* Inputs that are not part of the next traversal contribute nothing */
+                    for (Value &grad : state.grad_in)
+                        grad = Value();
+                }
+            }
+            CustomEdge::accum(detail->node(target_idx), state.grad_out[slot]);
+        }
+    };
+
+    /* Joint node -> input */
+    struct CustomInput : CustomEdge {
+        std::vector<size_t> slots;
+
+        /* Evaluate the reverse derivative and propagate */
+        void backward(Detail *detail, Index,
+                      const Edge &edge) const override {
+            State &state = *this->state;
+            {
+                std::lock_guard<std::mutex> guard(state.mutex);
+                if (!state.ready) {
+                    size_t n_inputs = state.grad_in.size();
+                    state.grad_in.assign(n_inputs, Value());
+                    state.op->backward(state.grad_out, state.grad_in);
+                    if (state.grad_in.size() != n_inputs)
+                        throw std::runtime_error(
+                            std::string(state.op->name()) +
+                            "(): backward() produced an incorrect number of gradients!");
+                    state.ready = true;
+                    /* Outputs that are not part of the next traversal contribute nothing */
+                    for (Value &grad : state.grad_out)
+                        grad = Value();
+                }
+            }
+
+            Node &source = detail->node(edge.source);
+            for (size_t slot : slots)
+                CustomEdge::accum(source, state.grad_in[slot]);
+        }
+
+        /* Stash the input gradient */
+        void forward(Detail *detail, Index target_idx,
+                     const Edge &edge) const override {
+            State &state = *this->state;
+            const Value &grad = detail->node(edge.source).grad;
+            for (size_t slot : slots)
+                state.grad_in[slot] = grad;
+            state.ready = false;
+
+            Node &joint = detail->node(target_idx);
+            if constexpr (is_dynamic_v<Value>) {
+                if (joint.grad.empty())
+                    joint.grad = zero<Value>(1);
+            }
+        }
+    };
+
+    auto state = std::make_shared<State>();
+    state->op = std::move(op);
+    state->grad_out.resize(output_sizes.size());
+    state->grad_in.resize(inputs.size());
+
+    const char *name = state->op->name();
+    Index joint = append_node(1, name);
+
+    /* Inputs can occur several times, but each needs a single edge */
+    std::vector<std::pair<Index, size_t>> sorted;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (inputs[i] != 0)
+            sorted.emplace_back(inputs[i], i);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    for (size_t i = 0; i < sorted.size(); ) {
+        CustomInput *ci = new CustomInput();
+        ci->state = state;
+        Index source = sorted[i].first;
+        for (; i < sorted.size() && sorted[i].first == source; ++i)
+            ci->slots.push_back(sorted[i].second);
+        d->node(joint).edges.emplace_back(source, ci);
+        inc_ref_int(source, joint);
+    }
+
+    for (size_t i = 0; i < output_sizes.size(); ++i) {
+        CustomOutput *co = new CustomOutput();
+        co->state = state;
+        co->slot = i;
+        outputs[i] = append_node(output_sizes[i], name);
+        d->node(outputs[i]).edges.emplace_back(joint, co);
+        inc_ref_int(joint, outputs[i]);
+    }
+
+    dec_ref_ext(joint);
 
 #if !defined(NDEBUG)
-        if (d->log_level >= 3)
-            std::cerr << "autodiff: append_scatter(" << target_orig << " <- "
-                      << source << ", scatter_add=" << scatter_add << ") -> "
-                      << target_new << std::endl;
+    if (d->log_level >= 3)
+        std::cerr << "autodiff: append_custom(\"" << name << "\", "
+                  << sorted.size() << " inputs, " << outputs.size()
+                  << " outputs) -> " << joint << std::endl;
 #endif
-    }
+
+    return outputs;
 }
 
 template <typename Value>
 void Tape<Value>::append_edge(Index source_idx, Index target_idx,
-                              const Value &weight) {
+                              Value weight) {
     if (source_idx == 0)
         return;
     assert(target_idx != 0);
@@ -532,7 +1932,7 @@ void Tape<Value>::append_edge(Index source_idx, Index target_idx,
                       << source_idx << "): creating."
                       << std::endl;
 #endif
-        target.edges.emplace_back(source_idx, weight);
+        target.edges.emplace_back(source_idx, std::move(weight));
         inc_ref_int(source_idx, target_idx);
     }
 }
@@ -588,6 +1988,7 @@ template <typename Value> void Tape<Value>::inc_ref_int(Index index, Index from)
 
     node.edges_rev.push_back(from);
     node.ref_count_int++;
+    d->heap_update(index);
 }
 
 template <typename Value> void Tape<Value>::dec_ref_int(Index index, Index from) {
@@ -615,10 +2016,12 @@ template <typename Value> void Tape<Value>::dec_ref_int(Index index, Index from)
 
     if (node.ref_count_int == 0 && node.ref_count_ext == 0)
         free_node(index);
+    else
+        d->heap_update(index);
 }
 
 template <typename Value> void Tape<Value>::inc_ref_ext(Index index) {
-    if (index == 0)
+    if (index == 0 || (index & Detail::capture_flag))
         return;
     Node &node = d->node(index);
     node.ref_count_ext++;
@@ -630,7 +2033,7 @@ template <typename Value> void Tape<Value>::inc_ref_ext(Index index) {
 }
 
 template <typename Value> void Tape<Value>::dec_ref_ext(Index index) {
-    if (index == 0)
+    if (index == 0 || (index & Detail::capture_flag))
         return;
     Node &node = d->node(index);
 
@@ -646,8 +2049,17 @@ template <typename Value> void Tape<Value>::dec_ref_ext(Index index) {
 
     --node.ref_count_ext;
 
-    if (node.ref_count_int == 0 && node.ref_count_ext == 0)
+    if (node.ref_count_int == 0 && node.ref_count_ext == 0) {
         free_node(index);
+    } else if (node.ref_count_ext == 0 && d->graph_simplification &&
+               node.collapse_allowed()) {
+        /* The node can no longer be referenced by new operations. Only
+           queue it here: collapsing may throw, and this function is called
+           by ~DiffArray(). The queue is drained by append_node() and at the
+           beginning of traversals. */
+        d->heap_push(index);
+        d->pending++;
+    }
 }
 
 template <typename Value> void Tape<Value>::free_node(Index index) {
@@ -656,26 +2068,23 @@ template <typename Value> void Tape<Value>::free_node(Index index) {
         std::cerr << "autodiff: free_node(" << index << ")" << std::endl;
 #endif
 
-    auto it = d->nodes.find(index);
-    if (it == d->nodes.end())
-        throw std::runtime_error("autodiff: free_node(): Unknown index " +
-                                 std::to_string(index));
-
-    Node &node = it->second;
+    Node &node = d->node(index);
     for (const Edge &edge : node.edges)
         dec_ref_int(edge.source, index);
 
-    d->nodes.erase(it);
+    d->release_node(index);
 }
 
 template <typename Value> void Tape<Value>::push_prefix(const char *value) {
     d->prefix.push_back(value);
+    d->profile_update_current();
 }
 
 template <typename Value> void Tape<Value>::pop_prefix() {
     if (d->prefix.empty())
         throw std::runtime_error("pop_prefix(): prefix list is already empty!");
     d->prefix.pop_back();
+    d->profile_update_current();
 }
 
 template <typename Value>
@@ -700,6 +2109,7 @@ template <typename Value>
 void Tape<Value>::backward(Index index, bool free_graph) {
     using Scalar = scalar_t<Value>;
 
+    simplify_pending();
     SimplificationLock lock(*this);
     set_gradient(index, Scalar(1), true);
     backward(free_graph);
@@ -709,6 +2119,7 @@ template <typename Value>
 void Tape<Value>::forward(Index index, bool free_graph) {
     using Scalar = scalar_t<Value>;
 
+    simplify_pending();
     SimplificationLock lock(*this);
     set_gradient(index, Scalar(1), false);
     forward(free_graph);
@@ -721,8 +2132,21 @@ void Tape<Value>::set_gradient(Index index, const Value &value, bool backward) {
             "set_gradient(): no gradients are associated with this variable (a "
             "prior call to requires_gradient() is required.) ");
 
+    simplify_pending();
     d->dfs(index, backward, true);
     Node &node = d->node(index);
+    if constexpr (Detail::pool_enabled) {
+        if (node.size > 1 && value.size() == 1) {
+            /* Broadcast scalar seeds into a pooled buffer */
+            using Packet = typename Value::Packet;
+            Packet value_b(value.coeff(0));
+            d->pool_release(node.grad);
+            node.grad = d->pool_acquire(node.size);
+            for (size_t i = 0; i < node.grad.packets(); ++i)
+                node.grad.packet(i) = value_b;
+            return;
+        }
+    }
     node.grad = value;
     if constexpr (is_dynamic_v<Value>) {
         if (node.size > 1 && node.grad.size() == 1)
@@ -735,61 +2159,53 @@ void Tape<Value>::backward(bool free_graph) {
     auto &scheduled = d->scheduled;
 
     if (free_graph) {
-        for (auto it = scheduled.begin(); it != scheduled.end(); ++it)
-            inc_ref_ext(*it);
+        for (Index index : scheduled)
+            inc_ref_ext(index);
     }
 
+    if (ENOKI_UNLIKELY(d->profiling))
+        d->profile_snapshot();
+
+    bool parallel = false;
+    if constexpr (is_dynamic_v<Value> && !is_cuda_array_v<Value>)
+        parallel = d->parallel_backward;
+
+    if (parallel)
+        d->backward_parallel();
+
     for (auto it = scheduled.rbegin(); it != scheduled.rend(); ++it) {
         Index target_idx = *it;
         Node &target = d->node(target_idx);
 
-        if constexpr (is_dynamic_v<Value>) {
-            if (ENOKI_UNLIKELY(target.size != target.grad.size())) {
-                if (target.grad.size() == 1)
-                    set_slices(target.grad, target.size);
-                else
-                    throw std::runtime_error(
-                        "backward(): gradient sizes don't match: expected " +
-                        std::to_string(target.size) + ", got " +
-                        std::to_string(target.grad.size()));
+        if (!parallel) {
+            d->check_grad_size(target, "backward");
+            if (ENOKI_UNLIKELY(d->profiling)) {
+                auto start = std::chrono::steady_clock::now();
+                d->backward_node(target_idx, target);
+                size_t specials = 0;
+                for (const Edge &edge : target.edges)
+                    specials += edge.is_special();
+                d->profile_record(target.profile, start, specials, true);
+            } else {
+                d->backward_node(target_idx, target);
             }
         }
 
-        for (Edge &edge : target.edges) {
-            Node &source = d->node(edge.source);
-            if (ENOKI_LIKELY(!edge.is_special())) {
-                if constexpr (is_dynamic_v<Value>) {
-                    if (source.size == 1 && (edge.weight.size() != 1 || target.grad.size() != 1)) {
-                        if (source.grad.empty())
-                            source.grad = hsum(safe_mul(edge.weight, target.grad));
-                        else
-                            source.grad += hsum(safe_mul(edge.weight, target.grad));
-                    } else {
-                        if (source.grad.empty())
-                            source.grad = safe_mul(edge.weight, target.grad);
-                        else
-                            source.grad = safe_fmadd(edge.weight, target.grad, source.grad);
-                    }
-                } else {
-                    source.grad = safe_fmadd(edge.weight, target.grad, source.grad);
-                }
-            } else {
-                edge.special->backward(d, target_idx, edge);
-            }
-            if (free_graph) {
+        if (free_graph) {
+            for (Edge &edge : target.edges) {
                 dec_ref_int(edge.source, target_idx);
                 edge.source = 0;
             }
-        }
-        if (free_graph) {
             if (target.edges.size() > 0) {
+                for (Edge &edge : target.edges)
+                    d->pool_release(edge.weight);
                 target.edges.clear();
-                target.grad = Value();
+                d->pool_release(target.grad);
             }
             dec_ref_ext(target_idx);
         } else {
             if (target.ref_count_int > 0)
-                target.grad = Value();
+                d->pool_release(target.grad);
         }
     }
 
@@ -801,19 +2217,324 @@ void Tape<Value>::backward(bool free_graph) {
     if (free_graph)
         d->node_counter_last = d->node_counter;
 
-    scheduled.clear();
+    d->pool_trim();
+    d->clear_schedule();
+}
+
+template <typename Value>
+std::vector<Value> Tape<Value>::backward_batch(const std::vector<Index> &outputs,
+                                               const std::vector<Value> &seeds,
+                                               const std::vector<Index> &inputs,
+                                               bool free_graph) {
+    if (outputs.empty() || seeds.size() % outputs.size() != 0)
+        throw std::runtime_error(
+            "backward_batch(): expected one seed per output and batch entry!");
+
+    for (Index index : inputs) {
+        if (index == 0)
+            throw std::runtime_error(
+                "backward_batch(): no gradients are associated with this "
+                "variable (a prior call to requires_gradient() is required.)");
+    }
+
+    size_t n_out = outputs.size(), n_in = inputs.size(),
+           count = seeds.size() / n_out;
+
+    simplify_pending();
+    SimplificationLock lock(*this);
+    auto &scheduled = d->scheduled;
+    for (Index index : outputs) {
+        if (index != 0)
+            d->dfs(index, true, false);
+    }
+
+    if (d->node_position.size() < d->node_slots)
+        d->node_position.resize(d->node_slots);
+
+    /* Special edges that keep state across a traversal require one traversal per seed */
+    bool stateless = true;
+    for (size_t i = 0; i < scheduled.size(); ++i) {
+        d->node_position[scheduled[i]] = (uint32_t) i;
+        for (const Edge &edge : d->slot(scheduled[i]).edges) {
+            if (edge.is_special() && !edge.special->is_stateless())
+                stateless = false;
+        }
+    }
+
+    Value zero_grad;
+    if constexpr (!is_dynamic_v<Value>)
+        zero_grad = zero<Value>();
+
+    std::vector<Value> grad(scheduled.size() * count, zero_grad);
+    for (size_t k = 0; k < count; ++k) {
+        for (size_t j = 0; j < n_out; ++j) {
+            const Value &seed = seeds[k * n_out + j];
+            if (outputs[j] == 0 || Detail::grad_empty(seed))
+                continue;
+            Value &g = grad[d->node_position[outputs[j]] * count + k];
+            if (Detail::grad_empty(g))
+                g = seed;
+            else
+                g += seed;
+        }
+    }
+
+    if (free_graph) {
+        for (Index index : scheduled)
+            inc_ref_ext(index);
+    }
+
+    std::vector<Index> keep(inputs);
+    std::sort(keep.begin(), keep.end());
+
+    if (stateless) {
+        d->backward_batch(grad, count, 0, count, keep);
+    } else {
+        for (size_t k = 0; k < count; ++k)
+            d->backward_batch(grad, count, k, 1, keep);
+    }
+
+    std::vector<Value> result(count * n_in);
+    for (size_t j = 0; j < n_in; ++j) {
+        Index index = inputs[j];
+        const Node &node = d->node(index);
+        bool reached = (index >> 6) < d->visited.size() && d->is_visited(index);
+        for (size_t k = 0; k < count; ++k) {
+            Value &r = result[k * n_in + j];
+            if (reached)
+                r = grad[d->node_position[index] * count + k];
+            if constexpr (is_dynamic_v<Value>) {
+                if (r.empty())
+                    r = zero<Value>(node.size);
+            } else {
+                if (!reached)
+                    r = zero<Value>();
+            }
+        }
+    }
+
+    if (free_graph)
+        free_scheduled();
+
+    if (d->log_level >= 1)
+        std::cerr << "autodiff: backward_batch(): processed " << scheduled.size() << "/"
+                  << (d->node_counter - d->node_counter_last) << " nodes ("
+                  << count << " seeds)." << std::endl;
+
+    if (free_graph)
+        d->node_counter_last = d->node_counter;
+
+    d->pool_trim();
+    d->clear_schedule();
+    return result;
+}
+
+template <typename Value>
+std::vector<Value> Tape<Value>::hvp(const std::vector<Index> &outputs,
+                                    const std::vector<Index> &inputs,
+                                    const std::vector<Value> &tangents,
+                                    bool free_graph) {
+    using Scalar = scalar_t<Value>;
+
+    if (inputs.size() != tangents.size())
+        throw std::runtime_error("hvp(): expected one tangent per input!");
+
+    for (Index index : inputs) {
+        if (index == 0)
+            throw std::runtime_error(
+                "hvp(): no gradients are associated with this variable (a "
+                "prior call to requires_gradient() is required.)");
+    }
+
+    SimplificationLock lock(*this);
+    auto &scheduled = d->scheduled;
+    for (Index index : outputs) {
+        if (index != 0)
+            d->dfs(index, true, false);
+    }
+
+    if (d->node_position.size() < d->node_slots)
+        d->node_position.resize(d->node_slots);
+    for (size_t i = 0; i < scheduled.size(); ++i)
+        d->node_position[scheduled[i]] = (uint32_t) i;
+    const uint32_t *position = d->node_position.data();
+
+    Value zero_grad;
+    if constexpr (!is_dynamic_v<Value>)
+        zero_grad = zero<Value>();
+
+    auto reached = [&](Index index) {
+        return (index >> 6) < d->visited.size() && d->is_visited(index);
+    };
+
+    /* Forward pass: tangents of all nodes along the direction 'tangents' */
+    std::vector<Value> tangent(scheduled.size(), zero_grad);
+    for (size_t j = 0; j < inputs.size(); ++j) {
+        if (!reached(inputs[j]))
+            continue;
+        Value &t = tangent[position[inputs[j]]];
+        if (Detail::grad_empty(t))
+            t = tangents[j];
+        else
+            t += tangents[j];
+    }
+
+    for (size_t i = 0; i < scheduled.size(); ++i) {
+        Index target_idx = scheduled[i];
+        Node &target = d->slot(target_idx);
+        for (const Edge &edge : target.edges) {
+            Node &source = d->slot(edge.source);
+            Value &t_source = tangent[position[edge.source]];
+            if (Detail::grad_empty(t_source))
+                continue;
+            if (ENOKI_LIKELY(!edge.is_special())) {
+                d->accumulate_pooled(tangent[i], target.size, edge.weight, t_source);
+            } else {
+                std::swap(target.grad, tangent[i]);
+                std::swap(source.grad, t_source);
+                edge.special->forward(d, target_idx, edge);
+                std::swap(target.grad, tangent[i]);
+                std::swap(source.grad, t_source);
+            }
+        }
+        if (!Detail::grad_empty(tangent[i]))
+            Detail::check_grad_size(tangent[i], target.size, "hvp");
+    }
+
+    /* Backward pass: adjoints (grad[2*i]) and their tangents (grad[2*i+1]),
+       where the latter additionally receive the adjoint times the tangent
+       of the edge weight */
+    std::vector<Value> grad(scheduled.size() * 2, zero_grad);
+    for (Index index : outputs) {
+        if (index != 0)
+            grad[position[index] * 2] = Value(Scalar(1));
+    }
+
+    std::vector<Index> keep(inputs);
+    std::sort(keep.begin(), keep.end());
+
+    for (size_t i = scheduled.size(); i-- > 0;) {
+        Index target_idx = scheduled[i];
+        Node &target = d->slot(target_idx);
+        Value *grad_target = grad.data() + i * 2;
+
+        for (size_t k = 0; k < 2; ++k) {
+            if (!Detail::grad_empty(grad_target[k]))
+                d->check_grad_size(grad_target[k], target.size, "hvp");
+        }
+
+        if (!Detail::grad_empty(grad_target[0])) {
+            auto it = d->hessian.find(target_idx);
+            if (it != d->hessian.end()) {
+                for (const auto &entry : it->second) {
+                    const Value &t_input = tangent[position[entry.input]];
+                    if (Detail::grad_empty(t_input))
+                        continue;
+                    d->accumulate_pooled(grad[position[entry.source] * 2 + 1],
+                                         d->slot(entry.source).size,
+                                         safe_mul(entry.h, t_input), grad_target[0]);
+                }
+            }
+        }
+
+        for (const Edge &edge : target.edges) {
+            Node &source = d->slot(edge.source);
+            Value *grad_source = grad.data() + position[edge.source] * 2;
+
+            if (ENOKI_LIKELY(!edge.is_special())) {
+                d->accumulate_batch(grad_source, source.size, edge.weight,
+                                    grad_target, 2);
+                continue;
+            }
+
+            for (size_t k = 0; k < 2; ++k) {
+                if (Detail::grad_empty(grad_target[k]))
+                    continue;
+                std::swap(target.grad, grad_target[k]);
+                std::swap(source.grad, grad_source[k]);
+                edge.special->backward(d, target_idx, edge);
+                std::swap(target.grad, grad_target[k]);
+                std::swap(source.grad, grad_source[k]);
+            }
+        }
+
+        /* All nodes depending on this one have been processed */
+        tangent[i] = zero_grad;
+        if (target.edges.size() > 0 &&
+            !std::binary_search(keep.begin(), keep.end(), target_idx))
+            grad_target[0] = grad_target[1] = zero_grad;
+    }
+
+    std::vector<Value> result(inputs.size());
+    for (size_t j = 0; j < inputs.size(); ++j) {
+        Index index = inputs[j];
+        Value &r = result[j];
+        if (reached(index))
+            r = std::move(grad[position[index] * 2 + 1]);
+        if constexpr (is_dynamic_v<Value>) {
+            if (r.empty())
+                r = zero<Value>(d->node(index).size);
+            else
+                d->check_grad_size(r, d->node(index).size, "hvp");
+        } else {
+            if (!reached(index))
+                r = zero<Value>();
+        }
+    }
+
+    if (free_graph) {
+        for (Index index : scheduled)
+            inc_ref_ext(index);
+        free_scheduled();
+    }
+
+    if (d->log_level >= 1)
+        std::cerr << "autodiff: hvp(): processed " << scheduled.size() << "/"
+                  << (d->node_counter - d->node_counter_last) << " nodes."
+                  << std::endl;
+
+    if (free_graph)
+        d->node_counter_last = d->node_counter;
+
+    d->pool_trim();
+    d->clear_schedule();
+    return result;
+}
+
+template <typename Value> void Tape<Value>::free_scheduled() {
+    auto &scheduled = d->scheduled;
+    for (auto it = scheduled.rbegin(); it != scheduled.rend(); ++it) {
+        Index target_idx = *it;
+        Node &target = d->node(target_idx);
+        for (Edge &edge : target.edges) {
+            dec_ref_int(edge.source, target_idx);
+            edge.source = 0;
+        }
+        if (target.edges.size() > 0) {
+            for (Edge &edge : target.edges)
+                d->pool_release(edge.weight);
+            target.edges.clear();
+            d->pool_release(target.grad);
+        }
+        if (ENOKI_UNLIKELY(!d->hessian.empty()))
+            d->hessian.erase(target_idx);
+        dec_ref_ext(target_idx);
+    }
 }
 
 template <typename Value>
 void Tape<Value>::forward(bool free_graph) {
     auto &scheduled = d->scheduled;
 
+    if (ENOKI_UNLIKELY(d->profiling))
+        d->profile_snapshot();
+
     if (free_graph) {
-        for (auto it = scheduled.begin(); it != scheduled.end(); ++it)
-            inc_ref_ext(*it);
+        for (Index index : scheduled)
+            inc_ref_ext(index);
     }
 
-    for (auto it = scheduled.begin(); it != scheduled.end(); ++it) {
+    for (auto it = scheduled.rbegin(); it != scheduled.rend(); ++it) {
         Index source_idx = *it;
         Node &source = d->node(source_idx);
 
@@ -828,44 +2549,28 @@ void Tape<Value>::forward(bool free_graph) {
             if (edge == nullptr)
                 throw std::runtime_error("forward(): invalid graph structure!");
 
-            if (ENOKI_LIKELY(!edge->is_special())) {
-                if constexpr (is_dynamic_v<Value>) {
-                    if (target.size == 1 && (edge->weight.size() != 1 || source.grad.size() != 1)) {
-                        if (target.grad.empty())
-                            target.grad = hsum(safe_mul(edge->weight, source.grad));
-                        else
-                            target.grad += hsum(safe_mul(edge->weight, source.grad));
-                    } else {
-                        if (target.grad.empty())
-                            target.grad = safe_mul(edge->weight, source.grad);
-                        else
-                            target.grad = safe_fmadd(edge->weight, source.grad, target.grad);
-                    }
-                } else {
-                    target.grad = safe_fmadd(edge->weight, source.grad, target.grad);
-                }
-            } else {
+            std::chrono::steady_clock::time_point start;
+            if (ENOKI_UNLIKELY(d->profiling))
+                start = std::chrono::steady_clock::now();
+
+            if (ENOKI_LIKELY(!edge->is_special()))
+                d->accumulate_pooled(target.grad, target.size, edge->weight, source.grad);
+            else
                 edge->special->forward(d, target_idx, *edge);
-            }
-            if constexpr (is_dynamic_v<Value>) {
-                if (ENOKI_UNLIKELY(target.size != target.grad.size())) {
-                    if (target.grad.size() == 1)
-                        set_slices(target.grad, target.size);
-                    else
-                        throw std::runtime_error(
-                            "forward(): gradient sizes don't match: expected " +
-                            std::to_string(target.size) + ", got " +
-                            std::to_string(target.grad.size()));
-                }
-            }
+            d->check_grad_size(target, "forward");
+
+            if (ENOKI_UNLIKELY(d->profiling))
+                d->profile_record(target.profile, start, edge->is_special(), false);
         }
         if (source.ref_count_int > 0)
-            source.grad = Value();
+            d->pool_release(source.grad);
         if (free_graph) {
-            auto edges_rev = source.edges_rev;
+            std::vector<Index> edges_rev(source.edges_rev.begin(),
+                                         source.edges_rev.end());
             for (Index target_idx : edges_rev) {
                 dec_ref_int(source_idx, target_idx);
-                d->node(target_idx).remove_edge(source_idx);
+                Edge edge = d->node(target_idx).remove_edge(source_idx);
+                d->pool_release(edge.weight);
             }
             dec_ref_ext(source_idx);
         }
@@ -879,92 +2584,111 @@ void Tape<Value>::forward(bool free_graph) {
     if (free_graph)
         d->node_counter_last = d->node_counter;
 
-    scheduled.clear();
+    d->pool_trim();
+    d->clear_schedule();
 }
 
-template <typename Value> void Tape<Value>::simplify_graph() {
-    if (d->is_simplified)
-        return;
+template <typename Value> bool Tape<Value>::collapse_node(Index index) {
+    Node &node = d->node(index);
+    if (!node.collapse_allowed())
+        return false;
+
+    std::vector<Index> update;
+    update.reserve(node.edges.size() + node.edges_rev.size());
+
+    /* Collect predecessors and successors */ {
+        for (Index k : node.edges_rev) {
+            Edge *e = d->node(k).edge(index);
+            assert(e != nullptr);
+            if (e->is_special())
+                return false;
+            update.push_back(k);
+        }
+        for (const Edge &edge : node.edges) {
+            const Node &node2 = d->node(edge.source);
+            if ((node.size == 1 && (node2.size != node.size)) || edge.is_special())
+                return false;
+            update.push_back(edge.source);
+        }
+    }
 
-    SimplificationLock lock(*this);
-    if (d->log_level >= 2)
-        std::cerr << "autodiff: simplify_graph(): starting.." << std::endl;
+#if !defined(NDEBUG)
+    if (d->log_level >= 3)
+        std::cerr << "autodiff: simplify_graph(): collapsing node " << index
+                  << ", cost = " << node.score() << std::endl;
+#endif
 
-    std::set<std::pair<Index, Index>> todo;
-    std::vector<std::pair<Index, Index>> update;
-    std::vector<Index> edges_rev;
-    for (const auto &it : d->nodes)
-        todo.emplace(it.second.score(), it.first);
-    size_t cost = 0;
-
-    while (!todo.empty()) {
-        auto it = todo.begin();
-        uint32_t score = it->first, index = it->second;
-        todo.erase(it);
-        Node &node = d->node(index);
-        if (!node.collapse_allowed())
-            continue;
-        if (score > ENOKI_AUTODIFF_MAX_SIMPLIFICATION_COST) {
-            if (d->log_level >= 2)
-                std::cerr << "autodiff: simplify_graph(): cost of next simplification = " << cost << ", giving up." << std::endl;
-            break;
-        }
+    /* Remove node and create edges */ {
+        std::vector<Index> edges_rev(node.edges_rev.begin(), node.edges_rev.end());
+        for (Index other : edges_rev) {
+            Edge edge1 = d->node(other).remove_edge(index);
 
-        update.clear();
-        bool skip = false;
+            for (auto const &edge2 : node.edges)
+                append_edge_prod(edge2.source, other, edge1.weight, edge2.weight);
 
-        /* Collect predecessors and successors */ {
-            for (Index k : node.edges_rev) {
-                Edge *e = d->node(k).edge(index);
-                assert(e != nullptr);
-                if (e->is_special())
-                    skip = true;
-                update.emplace_back(d->node(k).score(), k);
-            }
-            for (const Edge &edge : node.edges) {
-                const Node &node2 = d->node(edge.source);
-                update.emplace_back(node2.score(), edge.source);
-                if ((node.size == 1 && (node2.size != node.size)) || edge.is_special())
-                    skip = true;
-            }
+            dec_ref_int(index, other);
         }
+    }
 
-        if (skip)
-            continue;
+    /* Update costs (if changed) */
+    for (Index id : update) {
+        if (d->slot(id).used)
+            d->heap_update(id);
+    }
 
-        if (d->log_level >= 3)
-            std::cerr << "autodiff: simplify_graph(): collapsing node " << index << ", cost = " << score << std::endl;
+    return true;
+}
 
-        /* Remove node and create edges */ {
-            edges_rev = node.edges_rev;
-            for (Index other : edges_rev) {
-                Edge edge1 = d->node(other).remove_edge(index);
+template <typename Value> void Tape<Value>::simplify_pending() {
+    if (!d->graph_simplification || d->simplifying || d->capture ||
+        !d->scheduled.empty() || !d->hessian.empty())
+        return;
 
-                for (auto const &edge2 : node.edges) {
-                    append_edge_prod(edge2.source, other, edge1.weight, edge2.weight);
-                    cost++;
-                }
+    d->pending = 0;
+    d->simplifying = true;
+    while (!d->heap.empty() &&
+           d->heap.front().first <= ENOKI_AUTODIFF_MAX_SIMPLIFICATION_COST)
+        collapse_node(d->heap_pop());
+    d->simplifying = false;
+}
 
-                dec_ref_int(index, other);
-            }
-        }
+template <typename Value> void Tape<Value>::simplify_graph() {
+    if (d->is_simplified || d->capture || !d->hessian.empty())
+        return;
 
-        /* Update costs (if changed) */ {
-            for (auto [old_score, id] : update) {
-                auto it = todo.find({ old_score, id });
-                if (it == todo.end())
-                    continue;
-                uint32_t new_score = d->node(id).score();
-                if (old_score != new_score) {
-                    todo.erase(it);
-                    todo.emplace(new_score, id);
-                }
-            }
+    SimplificationLock lock(*this);
+    if (d->log_level >= 2)
+        std::cerr << "autodiff: simplify_graph(): starting.." << std::endl;
+
+    /* Unreferenced nodes are already queued; also consider referenced ones */
+    d->for_each_node([&](Index index, const Node &node) {
+        if (node.collapse_allowed())
+            d->heap_push(index);
+    });
+
+    size_t collapsed = 0;
+    while (!d->heap.empty()) {
+        if (d->heap.front().first > ENOKI_AUTODIFF_MAX_SIMPLIFICATION_COST) {
+            if (d->log_level >= 2)
+                std::cerr << "autodiff: simplify_graph(): cost of next simplification = "
+                          << d->heap.front().first << ", giving up." << std::endl;
+            break;
         }
+        collapsed += collapse_node(d->heap_pop()) ? 1 : 0;
+    }
+
+    /* Referenced nodes are only considered by explicit calls */
+    std::vector<Index> referenced;
+    for (auto [score, index] : d->heap) {
+        if (d->slot(index).ref_count_ext > 0)
+            referenced.push_back(index);
     }
+    for (Index index : referenced)
+        d->heap_remove(index);
 
     if (d->log_level >= 2)
-        std::cerr << "autodiff: simplify_graph(): done. (cost = " << cost << ")" << std::endl;
+        std::cerr << "autodiff: simplify_graph(): done. (collapsed " << collapsed
+                  << " nodes)" << std::endl;
     d->is_simplified = true;
 }
 
@@ -987,9 +2711,10 @@ std::string Tape<Value>::graphviz(const std::vector<Index> &indices_) {
 
     for (Index index : indices) {
         const Node &node = d->node(index);
-        if (node.label.empty())
+        const char *label_full = node.label();
+        if (label_full[0] == '\0')
             continue;
-        std::string label = node.label;
+        std::string label = label_full;
 
         auto sepidx = label.rfind("/");
         std::string path, suffix;
@@ -1029,7 +2754,7 @@ std::string Tape<Value>::graphviz(const std::vector<Index> &indices_) {
             << std::to_string(node.ref_count_ext) << "/"
             << std::to_string(node.ref_count_int) << "]"
             << "\"";
-        if (node.label[0] == '\'')
+        if (label_full[0] == '\'')
             oss << " fillcolor=salmon style=filled";
         oss << "];" << std::endl;
     }
@@ -1053,7 +2778,7 @@ std::string Tape<Value>::graphviz(const std::vector<Index> &indices_) {
             << " [fillcolor=cornflowerblue style=filled];" << std::endl;
 
     oss << "}";
-    indices.clear();
+    d->clear_schedule();
     return oss.str();
 }
 
@@ -1063,26 +2788,149 @@ template <typename Value> std::string Tape<Value>::whos() const {
         << "  ID      E/I Refs   Size        Label" << std::endl
         << "  ====================================" << std::endl;
 
-    std::vector<uint32_t> indices;
-    indices.reserve(d->nodes.size());
-    for (const auto& it : d->nodes)
-        indices.push_back(it.first);
-    std::sort(indices.begin(), indices.end());
-
-    for (uint32_t id : indices) {
-        const Node &n = d->node(id);
+    d->for_each_node([&](Index id, const Node &n) {
         oss << "  " << std::left << std::setw(7) << id << " ";
         oss << std::left << std::setw(10) << (std::to_string(n.ref_count_ext) + " / " + std::to_string(n.ref_count_int)) << " ";
         oss << std::left << std::setw(12) << n.size;
-        oss << n.label;
+        oss << n.label();
         oss << std::endl;
-    }
+    });
 
     oss << "  ====================================" << std::endl << std::endl;
 
     return oss.str();
 }
 
+template <typename Value> typename Tape<Value>::Capture *Tape<Value>::capture_create() {
+    return new Capture();
+}
+
+template <typename Value> void Tape<Value>::capture_destroy(Capture *capture) {
+    delete capture;
+}
+
+template <typename Value> void Tape<Value>::capture_begin(Capture *capture) {
+    if (d->capture)
+        throw std::runtime_error("capture(): nested captures are not supported!");
+    d->capture = capture;
+    capture->position = capture->input_position = 0;
+}
+
+template <typename Value> Index Tape<Value>::capture_input(size_t size) {
+    Capture &c = *d->capture;
+    Index index = d->capture_node(size, { });
+    uint32_t pos = index & ~Detail::capture_flag;
+    if (!c.recorded)
+        c.inputs.push_back(pos);
+    else if (c.input_position >= c.inputs.size() ||
+             c.inputs[c.input_position] != pos)
+        throw std::runtime_error("capture(): the structure of the graph changed!");
+    c.input_position++;
+    return index;
+}
+
+template <typename Value>
+void Tape<Value>::capture_end(const std::vector<Index> &outputs, bool success) {
+    Capture &c = *d->capture;
+
+    if (!success) {
+        /* Discard a partially recorded structure */
+        if (!c.recorded)
+            c = Capture();
+        d->capture = nullptr;
+        return;
+    }
+
+    /* On failure, the caller invokes this function again with success=false */
+    if (c.recorded && (c.position != c.size.size() ||
+                       c.input_position != c.inputs.size() ||
+                       outputs.size() != c.outputs.size()))
+        throw std::runtime_error("capture(): the structure of the graph changed!");
+
+    std::vector<uint32_t> positions(outputs.size());
+    for (size_t i = 0; i < outputs.size(); ++i)
+        positions[i] = outputs[i] == 0 ? (uint32_t) -1
+                                       : d->capture_position(outputs[i]);
+
+    c.outputs = std::move(positions);
+    c.recorded = true;
+    d->capture = nullptr;
+}
+
+template <typename Value>
+void Tape<Value>::capture_backward(Capture *capture,
+                                   const std::vector<Value> &grad_out,
+                                   std::vector<Value> &grad_in) {
+    const Capture &c = *capture;
+    if (!c.recorded)
+        throw std::runtime_error("capture(): the function must be evaluated before backward()!");
+    if (grad_out.size() != c.outputs.size())
+        throw std::runtime_error("capture(): invalid number of output gradients!");
+
+    std::vector<Value> grad(c.size.size());
+    if constexpr (!is_dynamic_v<Value>) {
+        for (Value &g : grad)
+            g = zero<Value>();
+    }
+
+    for (size_t i = 0; i < grad_out.size(); ++i) {
+        uint32_t pos = c.outputs[i];
+        if (pos == (uint32_t) -1)
+            continue;
+        if constexpr (is_dynamic_v<Value>) {
+            if (grad_out[i].empty())
+                continue;
+            if (grad[pos].empty()) {
+                grad[pos] = grad_out[i];
+                continue;
+            }
+        }
+        grad[pos] += grad_out[i];
+    }
+
+    /* Nodes are stored in order of creation, i.e. in topological order */
+    for (uint32_t pos = (uint32_t) c.size.size(); pos-- > 0; ) {
+        uint32_t begin = c.edge_offset[pos], end = c.edge_offset[pos + 1];
+        if (begin == end)
+            continue;
+
+        Value &g = grad[pos];
+        if constexpr (is_dynamic_v<Value>) {
+            if (g.empty())
+                continue;
+            if (ENOKI_UNLIKELY(g.size() != c.size[pos])) {
+                if (g.size() == 1)
+                    set_slices(g, c.size[pos]);
+                else
+                    throw std::runtime_error(
+                        "capture(): gradient sizes don't match: expected " +
+                        std::to_string(c.size[pos]) + ", got " +
+                        std::to_string(g.size()));
+            }
+        }
+
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t source = c.edge_source[i];
+            Detail::accumulate(grad[source], c.size[source], c.edge_weight[i], g);
+        }
+
+        /* Release intermediate gradients as soon as possible */
+        g = Value();
+    }
+
+    grad_in.clear();
+    for (uint32_t pos : c.inputs) {
+        Value &g = grad[pos];
+        if constexpr (is_dynamic_v<Value>) {
+            if (g.empty())
+                g = zero<Value>(c.size[pos]);
+            else if (g.size() == 1 && c.size[pos] != 1)
+                set_slices(g, c.size[pos]);
+        }
+        grad_in.push_back(std::move(g));
+    }
+}
+
 template <typename Value> Value safe_mul(const Value &value1, const Value &value2) {
     Value tentative = value1 * value2;
     if constexpr (!is_cuda_array_v<Value>) {
@@ -0,0 +1,1445 @@
+/*
+    src/llvm/jit.cpp -- Host backend (Tracing JIT compiler)
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#include <enoki/llvm.h>
+#include <enoki/parallel.h>
+#include <vector>
+#include <iostream>
+#include <array>
+#include <algorithm>
+#include <sstream>
+#include <set>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <chrono>
+#include <memory>
+
+#if defined(NDEBUG)
+#  define ENOKI_LLVM_DEFAULT_LOG_LEVEL 0
+#else
+#  define ENOKI_LLVM_DEFAULT_LOG_LEVEL 1
+#endif
+
+/// Reserved variable indices (index 0 denotes an uninitialized array)
+#define ENOKI_LLVM_REG_RESERVED 1
+
+/// Number of entries processed at a time by each instruction of a kernel
+#define ENOKI_LLVM_BLOCK_SIZE 512
+
+NAMESPACE_BEGIN(enoki)
+
+using TimePoint = std::chrono::time_point<std::chrono::high_resolution_clock>;
+
+// Forward declarations
+ENOKI_EXPORT void llvm_inc_ref_ext(uint32_t);
+ENOKI_EXPORT void llvm_inc_ref_int(uint32_t);
+ENOKI_EXPORT void llvm_dec_ref_ext(uint32_t);
+ENOKI_EXPORT void llvm_dec_ref_int(uint32_t);
+ENOKI_EXPORT size_t llvm_register_size(EnokiType type);
+ENOKI_EXPORT uint32_t llvm_trace_append(EnokiType type, const char *cmd, uint32_t arg1);
+
+// -----------------------------------------------------------------------
+//! @{ \name Operations supported by the host backend
+// -----------------------------------------------------------------------
+
+enum class Op : uint8_t {
+    Const, Index, Mov, Cvt, Bitcast,
+    Add, Sub, Mul, Div, Rem, Fma, Min, Max,
+    Neg, Abs, Sqrt, Rcp, Rsqrt, Exp, Log, Sin, Cos,
+    Floor, Ceil, Round, Trunc,
+    Not, And, Or, Xor, Shl, Shr, Popc, Clz, Ctz,
+    Eq, Neq, Lt, Le, Gt, Ge, Select,
+    Load, Store, Count
+};
+
+static const char *op_name[(int) Op::Count] = {
+    "const", "index", "mov", "cvt", "bitcast",
+    "add", "sub", "mul", "div", "rem", "fma", "min", "max",
+    "neg", "abs", "sqrt", "rcp", "rsqrt", "exp", "log", "sin", "cos",
+    "floor", "ceil", "round", "trunc",
+    "not", "and", "or", "xor", "shl", "shr", "popc", "clz", "ctz",
+    "eq", "neq", "lt", "le", "gt", "ge", "select",
+    "ld", "st"
+};
+
+/// Number of operands expected by each operation
+static const uint8_t op_args[(int) Op::Count] = {
+    0, 0, 1, 1, 1,
+    2, 2, 2, 2, 2, 3, 2, 2,
+    1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1,
+    1, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 3,
+    2, 3
+};
+
+/// Parse an instruction of the form "<op>" or "const <literal>"
+static Op parse_op(const char *cmd, size_t nargs, uint64_t &imm) {
+    const char *sep = strchr(cmd, ' ');
+    size_t len = sep ? (size_t) (sep - cmd) : strlen(cmd);
+
+    for (int i = 0; i < (int) Op::Count; ++i) {
+        if (strlen(op_name[i]) != len || strncmp(op_name[i], cmd, len) != 0)
+            continue;
+        if (op_args[i] != nargs)
+            break;
+        imm = sep ? (uint64_t) strtoull(sep + 1, nullptr, 0) : 0;
+        return (Op) i;
+    }
+
+    throw std::runtime_error(std::string("llvm_trace_append(): unsupported "
+        "instruction \"") + cmd + "\" with " + std::to_string(nargs) +
+        " argument(s)!");
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name 'Variable' type that is used to record instruction traces
+// -----------------------------------------------------------------------
+
+struct Variable {
+    /// Data type of this variable
+    EnokiType type;
+
+    /// Instruction to compute it (as passed to llvm_trace_append())
+    std::string cmd;
+
+    /// Parsed version of 'cmd'
+    Op op = Op::Mov;
+
+    /// Immediate operand (literal constants)
+    uint64_t imm = 0;
+
+    /// Associated label (mainly for debugging)
+    std::string label;
+
+    /// Number of entries
+    size_t size = 0;
+
+    /// Pointer to host memory
+    void *data = nullptr;
+
+    /// External (i.e. by Enoki) reference count
+    uint32_t ref_count_ext = 0;
+
+    /// Internal (i.e. within the instruction stream) reference count
+    uint32_t ref_count_int = 0;
+
+    /// Dependencies of this instruction
+    std::array<uint32_t, 3> dep = { 0, 0, 0 };
+
+    /// Does the instruction have side effects (e.g. 'scatter')
+    bool side_effect = false;
+
+    /// A variable is 'dirty' if there are pending scatter operations to it
+    bool dirty = false;
+
+    /// Free 'data' after this variable is no longer referenced?
+    bool free = true;
+
+    /// Optimization: is this a direct pointer (rather than an array which stores a pointer?)
+    bool direct_pointer = false;
+
+    /// Size of the (heuristic for instruction scheduling)
+    uint32_t subtree_size = 0;
+
+    Variable(EnokiType type) : type(type) { }
+
+    ~Variable() { if (free && data != nullptr) llvm_free(data); }
+
+    bool is_collected() const {
+        return ref_count_int == 0 && ref_count_ext == 0;
+    }
+};
+
+/// Signature of the routines that execute one instruction over a block of entries
+using Kernel = void (*)(void *out, void *const *in, size_t offset, size_t count);
+
+/// Instruction of a compiled program
+struct Instr {
+    enum class Kind : uint8_t { Input, ScalarInput, Pointer, Literal, Compute };
+
+    Kind kind;
+    Op op;
+
+    /// Type of the result and of the (non-mask) operands
+    EnokiType type, type_in;
+
+    /// Operands, given as positions in the instruction list
+    std::array<uint32_t, 3> dep = { 0, 0, 0 };
+    uint32_t n_dep = 0;
+
+    /// Index into the pointer table (inputs, pointers and literals)
+    uint32_t ptr = 0;
+
+    /// Should the result be written to memory? (at index 'out' of the pointer table)
+    bool store = false;
+    uint32_t out = 0;
+
+    /* The remaining fields are filled in by llvm_jit_compile() */
+
+    /// Routine implementing the instruction
+    Kernel kernel = nullptr;
+
+    /// Does the result have the same value in every entry?
+    bool uniform = false;
+
+    /// Scratch buffer holding the result (if needed)
+    uint32_t slot = 0;
+};
+
+struct Program {
+    std::vector<Instr> instr;
+
+    /// Number of scratch buffers (each holding ENOKI_LLVM_BLOCK_SIZE entries)
+    uint32_t n_slots = 0;
+};
+
+struct Context {
+    /// Current variable index
+    uint32_t ctr = 0;
+
+    /// Enumerates "live" (externally referenced) variables and statements with side effects
+    std::set<uint32_t> live;
+
+    /// Enumerates "dirty" variables (targets of 'scatter' operations that have not yet executed)
+    std::vector<uint32_t> dirty;
+
+    /// Stores the mapping from variable indices to variables
+    std::unordered_map<uint32_t, Variable> variables;
+
+    /// Stores the mapping from pointer addresses to variable indices
+    std::unordered_map<const void *, uint32_t> ptr_map;
+
+    /// Current log level (0 == none, 1 == minimal, 2 == moderate, 3 == max.)
+    uint32_t log_level = ENOKI_LLVM_DEFAULT_LOG_LEVEL;
+
+    /// Callback that will be invoked before each llvm_eval() call
+    std::vector<std::pair<void(*)(void *), void *>> callbacks;
+
+    /// Hash table of previously compiled kernels (keyed by their listing)
+    std::unordered_map<std::string, Program> kernels;
+
+    ~Context() { clear(); }
+
+    Variable &operator[](uint32_t i) {
+        auto it = variables.find(i);
+        if (it == variables.end())
+            throw std::runtime_error("LLVMBackend: referenced unknown variable " + std::to_string(i));
+        return it->second;
+    }
+
+    void clear() {
+#if !defined(NDEBUG)
+        if (log_level >= 1) {
+            size_t n_live = 0;
+            for (auto const &var : variables) {
+                if (var.first < ENOKI_LLVM_REG_RESERVED)
+                    continue;
+                if (n_live < 10) {
+                    std::cerr << "llvm_shutdown(): variable " << var.first << " is still live. "<< std::endl;
+                    if (n_live == 9)
+                        std::cerr << "(skipping remainder)" << std::endl;
+                }
+                ++n_live;
+            }
+            if (n_live > 0)
+                std::cerr << "llvm_shutdown(): " << n_live
+                          << " variables were still live at shutdown." << std::endl;
+        }
+#endif
+        ctr = 0;
+        dirty.clear();
+        variables.clear();
+        live.clear();
+        ptr_map.clear();
+        kernels.clear();
+    }
+
+    Variable& append(EnokiType type) {
+        return variables.emplace(ctr++, type).first->second;
+    }
+};
+
+static Context *__context = nullptr;
+static bool installed_shutdown_handler = false;
+
+inline static Context &context() {
+    if (ENOKI_UNLIKELY(__context == nullptr))
+        llvm_init();
+    return *__context;
+}
+
+ENOKI_EXPORT void llvm_init() {
+    if (__context)
+        delete __context;
+    __context = new Context();
+    Context &ctx = *__context;
+    while (ctx.variables.size() != ENOKI_LLVM_REG_RESERVED)
+        ctx.append(EnokiType::Invalid);
+    ctx.kernels.reserve(1000);
+
+    if (!installed_shutdown_handler) {
+        installed_shutdown_handler = true;
+        atexit(llvm_shutdown);
+    }
+}
+
+ENOKI_EXPORT void llvm_shutdown() {
+    if (__context) {
+        __context->clear();
+        delete __context;
+        __context = nullptr;
+    }
+}
+
+ENOKI_EXPORT void *llvm_malloc(size_t size) {
+    if (size == 0)
+        return nullptr;
+    return ::operator new(size, std::align_val_t(64));
+}
+
+ENOKI_EXPORT void llvm_free(void *ptr) {
+    if (ptr)
+        ::operator delete(ptr, std::align_val_t(64));
+}
+
+ENOKI_EXPORT void *llvm_var_ptr(uint32_t index) {
+    return context()[index].data;
+}
+
+ENOKI_EXPORT size_t llvm_var_size(uint32_t index) {
+    return context()[index].size;
+}
+
+ENOKI_EXPORT void llvm_var_set_label(uint32_t index, const char *str) {
+    Context &ctx = context();
+    ctx[index].label = str;
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4)
+        std::cerr << "llvm_var_set_label(" << index << "): " << str << std::endl;
+#endif
+}
+
+ENOKI_EXPORT uint32_t llvm_var_set_size(uint32_t index, size_t size, bool copy) {
+    Context &ctx = context();
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4)
+        std::cerr << "llvm_var_set_size(" << index << "): " << size << std::endl;
+#endif
+
+    Variable &var = ctx[index];
+    if (var.size == size)
+        return index;
+
+    if (var.data != nullptr || var.ref_count_int > 0) {
+        if (var.size == 1 && copy) {
+            uint32_t index_new = llvm_trace_append(var.type, "mov", index);
+            ctx[index_new].size = size;
+            llvm_dec_ref_ext(index);
+            return index_new;
+        }
+
+        throw std::runtime_error(
+            "llvm_var_set_size(): attempted to resize variable " +
+            std::to_string(index) +
+            " which was already allocated (current size = " +
+            std::to_string(var.size) +
+            ", requested size = " + std::to_string(size) + ")");
+    }
+    var.size = size;
+    return index;
+}
+
+ENOKI_EXPORT uint32_t llvm_var_register(EnokiType type, size_t size,
+                                        void *ptr, bool free) {
+    Context &ctx = context();
+    uint32_t idx = ctx.ctr;
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4)
+        std::cerr << "llvm_var_register(" << idx << "): " << ptr
+                  << ", size=" << size << ", free=" << free << std::endl;
+#endif
+    if (size == 0)
+        throw std::runtime_error("llvm_var_register(): attempted to create a "
+                                 "variable of size zero!");
+    Variable &v = ctx.append(type);
+    v.data = ptr;
+    v.size = size;
+    v.free = free;
+    llvm_inc_ref_ext(idx);
+    return idx;
+}
+
+ENOKI_EXPORT uint32_t llvm_var_register_ptr(const void *ptr) {
+    Context &ctx = context();
+    auto it = ctx.ptr_map.find(ptr);
+    if (it != ctx.ptr_map.end()) {
+        llvm_inc_ref_ext(it->second);
+        return it->second;
+    }
+
+    uint32_t idx = ctx.ctr;
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4)
+        std::cerr << "llvm_var_register_ptr(" << idx << "): " << ptr
+                  << std::endl;
+#endif
+    Variable &v = ctx.append(EnokiType::Pointer);
+    v.data = (void *) ptr;
+    v.size = 1;
+    v.free = false;
+    v.direct_pointer = true;
+    llvm_inc_ref_ext(idx);
+    ctx.ptr_map[ptr] = idx;
+    return idx;
+}
+
+ENOKI_EXPORT uint32_t llvm_var_copy(EnokiType type, size_t size,
+                                    const void *value) {
+    size_t total_size = size * llvm_register_size(type);
+    void *ptr = llvm_malloc(total_size);
+    memcpy(ptr, value, total_size);
+    return llvm_var_register(type, size, ptr, true);
+}
+
+ENOKI_EXPORT void llvm_var_free(uint32_t idx) {
+    Context &ctx = context();
+    Variable &v = ctx[idx];
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 5) {
+        std::cerr << "llvm_var_free(" << idx << ") = " << v.data;
+        if (!v.free)
+            std::cerr << " (not deleted)";
+        std::cerr << std::endl;
+    }
+#endif
+    if (v.direct_pointer) {
+        auto it = ctx.ptr_map.find(v.data);
+        assert(it != ctx.ptr_map.end());
+        ctx.ptr_map.erase(it);
+    }
+    std::array<uint32_t, 3> dep = v.dep;
+    ctx.variables.erase(idx); // invokes Variable destructor + llvm_free().
+    for (int i = 0; i < 3; ++i)
+        llvm_dec_ref_int(dep[i]);
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name Common functionality to distinguish types
+// -----------------------------------------------------------------------
+
+ENOKI_EXPORT size_t llvm_register_size(EnokiType type) {
+    switch (type) {
+        case EnokiType::UInt8:
+        case EnokiType::Int8:
+        case EnokiType::Bool: return 1;
+        case EnokiType::UInt16:
+        case EnokiType::Int16:
+        case EnokiType::Float16: return 2;
+        case EnokiType::UInt32:
+        case EnokiType::Int32:
+        case EnokiType::Float32: return 4;
+        case EnokiType::UInt64:
+        case EnokiType::Int64:
+        case EnokiType::Pointer:
+        case EnokiType::Float64: return 8;
+        default: return (size_t) -1;
+    }
+}
+
+ENOKI_EXPORT const char *llvm_register_type(EnokiType type) {
+    switch (type) {
+        case EnokiType::UInt8: return "u8";
+        case EnokiType::Int8: return "i8";
+        case EnokiType::UInt16: return "u16";
+        case EnokiType::Int16: return "i16";
+        case EnokiType::UInt32: return "u32";
+        case EnokiType::Int32: return "i32";
+        case EnokiType::Pointer: return "ptr";
+        case EnokiType::UInt64: return "u64";
+        case EnokiType::Int64: return "i64";
+        case EnokiType::Float16: return "f16";
+        case EnokiType::Float32: return "f32";
+        case EnokiType::Float64: return "f64";
+        case EnokiType::Bool: return "bool";
+        default: return "???";
+    }
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name Reference counting (internal means: dependency within
+//           JIT trace, external means: referenced by an Enoki array)
+// -----------------------------------------------------------------------
+
+ENOKI_EXPORT void llvm_inc_ref_ext(uint32_t index) {
+    if (index < ENOKI_LLVM_REG_RESERVED)
+        return;
+    Context &ctx = context();
+    Variable &v = ctx[index];
+    v.ref_count_ext++;
+
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 5)
+        std::cerr << "llvm_inc_ref_ext(" << index << ") -> "
+                  << v.ref_count_ext << std::endl;
+#endif
+}
+
+ENOKI_EXPORT void llvm_inc_ref_int(uint32_t index) {
+    if (index < ENOKI_LLVM_REG_RESERVED)
+        return;
+    Context &ctx = context();
+    Variable &v = ctx[index];
+    v.ref_count_int++;
+
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 5)
+        std::cerr << "llvm_inc_ref_int(" << index << ") -> "
+                  << v.ref_count_int << std::endl;
+#endif
+}
+
+ENOKI_EXPORT void llvm_dec_ref_ext(uint32_t index) {
+    if (index < ENOKI_LLVM_REG_RESERVED || __context == nullptr)
+        return;
+    Context &ctx = *__context;
+    Variable &v = ctx[index];
+
+    if (ENOKI_UNLIKELY(v.ref_count_ext == 0)) {
+        fprintf(stderr, "llvm_dec_ref_ext(): Node %u has no external references!\n", index);
+        exit(EXIT_FAILURE);
+    }
+
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 5)
+        std::cerr << "llvm_dec_ref_ext(" << index << ") -> "
+                  << (v.ref_count_ext - 1) << std::endl;
+#endif
+
+    v.ref_count_ext--;
+
+    if (v.ref_count_ext == 0 && !v.side_effect)
+        ctx.live.erase(index);
+
+    if (v.is_collected())
+        llvm_var_free(index);
+}
+
+ENOKI_EXPORT void llvm_dec_ref_int(uint32_t index) {
+    if (index < ENOKI_LLVM_REG_RESERVED)
+        return;
+    Context &ctx = context();
+    Variable &v = ctx[index];
+
+    if (ENOKI_UNLIKELY(v.ref_count_int == 0)) {
+        fprintf(stderr, "llvm_dec_ref_int(): Node %u has no internal references!\n", index);
+        exit(EXIT_FAILURE);
+    }
+
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 5)
+        std::cerr << "llvm_dec_ref_int(" << index << ") -> "
+                  << (v.ref_count_int - 1) << std::endl;
+#endif
+
+    v.ref_count_int--;
+
+    if (v.is_collected())
+        llvm_var_free(index);
+}
+
+ENOKI_EXPORT void llvm_var_mark_side_effect(uint32_t index) {
+    Context &ctx = context();
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4)
+        std::cerr << "llvm_var_mark_side_effect(" << index << ")" << std::endl;
+#endif
+
+    assert(index >= ENOKI_LLVM_REG_RESERVED);
+    ctx[index].side_effect = true;
+}
+
+ENOKI_EXPORT void llvm_var_mark_dirty(uint32_t index) {
+    Context &ctx = context();
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4)
+        std::cerr << "llvm_var_mark_dirty(" << index << ")" << std::endl;
+#endif
+
+    assert(index >= ENOKI_LLVM_REG_RESERVED);
+    ctx[index].dirty = true;
+    ctx.dirty.push_back(index);
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name JIT trace append routines
+// -----------------------------------------------------------------------
+
+static uint32_t llvm_trace_append_impl(EnokiType type, const char *cmd,
+                                       size_t nargs, const uint32_t *arg) {
+    for (size_t i = 0; i < nargs; ++i) {
+        if (ENOKI_UNLIKELY(arg[i] == 0))
+            throw std::runtime_error("llvm_trace_append(): arithmetic involving "
+                                     "uninitialized variable!");
+    }
+
+    Context &ctx = context();
+    uint64_t imm = 0;
+    Op op = parse_op(cmd, nargs, imm);
+
+    bool dirty = false;
+    size_t size = nargs == 0 ? 1 : 0;
+    uint32_t subtree_size = 1;
+    for (size_t i = 0; i < nargs; ++i) {
+        const Variable &v = ctx[arg[i]];
+        dirty |= v.dirty;
+        size = std::max(size, v.size);
+        subtree_size += v.subtree_size;
+    }
+
+    for (size_t i = 0; i < nargs; ++i) {
+        size_t arg_size = ctx[arg[i]].size;
+        if (ENOKI_UNLIKELY(arg_size != 1 && arg_size != size)) {
+            std::string msg = "llvm_trace_append(): arithmetic involving "
+                              "arrays of incompatible size (";
+            for (size_t j = 0; j < nargs; ++j) {
+                msg += std::to_string(ctx[arg[j]].size);
+                msg += j + 1 < nargs ? ", " : "";
+            }
+            throw std::runtime_error(msg + "). The instruction was \"" + cmd + "\".");
+        }
+    }
+
+    if (dirty)
+        llvm_eval();
+
+    uint32_t idx = ctx.ctr;
+
+#if !defined(NDEBUG)
+    if (ctx.log_level >= 4) {
+        std::cerr << "llvm_trace_append(" << idx;
+        for (size_t i = 0; i < nargs; ++i)
+            std::cerr << (i == 0 ? " <- " : ", ") << arg[i];
+        std::cerr << "): " << cmd << std::endl;
+    }
+#endif
+
+    Variable &v = ctx.append(type);
+    v.size = size;
+    v.cmd = cmd;
+    v.op = op;
+    v.imm = imm;
+    v.subtree_size = subtree_size;
+    for (size_t i = 0; i < nargs; ++i) {
+        v.dep[i] = arg[i];
+        llvm_inc_ref_int(arg[i]);
+    }
+    llvm_inc_ref_ext(idx);
+    ctx.live.insert(idx);
+    return idx;
+}
+
+ENOKI_EXPORT uint32_t llvm_trace_append(EnokiType type, const char *cmd) {
+    return llvm_trace_append_impl(type, cmd, 0, nullptr);
+}
+
+ENOKI_EXPORT uint32_t llvm_trace_append(EnokiType type, const char *cmd,
+                                        uint32_t arg1) {
+    uint32_t arg[1] = { arg1 };
+    return llvm_trace_append_impl(type, cmd, 1, arg);
+}
+
+ENOKI_EXPORT uint32_t llvm_trace_append(EnokiType type, const char *cmd,
+                                        uint32_t arg1, uint32_t arg2) {
+    uint32_t arg[2] = { arg1, arg2 };
+    return llvm_trace_append_impl(type, cmd, 2, arg);
+}
+
+ENOKI_EXPORT uint32_t llvm_trace_append(EnokiType type, const char *cmd,
+                                        uint32_t arg1, uint32_t arg2,
+                                        uint32_t arg3) {
+    uint32_t arg[3] = { arg1, arg2, arg3 };
+    return llvm_trace_append_impl(type, cmd, 3, arg);
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name Kernels that execute one instruction over a block of entries
+// -----------------------------------------------------------------------
+
+NAMESPACE_BEGIN(detail)
+
+template <typename T> using llvm_bits_t =
+    std::conditional_t<sizeof(T) == 1, uint8_t,
+    std::conditional_t<sizeof(T) == 2, uint16_t,
+    std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+
+template <typename T> ENOKI_INLINE llvm_bits_t<T> to_bits(T value) {
+    llvm_bits_t<T> result;
+    memcpy(&result, &value, sizeof(T));
+    return result;
+}
+
+template <typename T> ENOKI_INLINE T from_bits(llvm_bits_t<T> value) {
+    T result;
+    memcpy(&result, &value, sizeof(T));
+    return result;
+}
+
+template <typename T> constexpr bool llvm_is_bool  = std::is_same_v<T, bool>;
+template <typename T> constexpr bool llvm_is_float = std::is_floating_point_v<T>;
+template <typename T> constexpr bool llvm_is_int   = !llvm_is_bool<T> && !llvm_is_float<T>;
+
+/// Is the operation 'op' (with result/operand type 'T') supported?
+template <Op op, typename T> constexpr bool llvm_supported() {
+    switch (op) {
+        case Op::Add: case Op::Sub: case Op::Mul: case Op::Div:
+        case Op::Fma: case Op::Min: case Op::Max: case Op::Neg:
+        case Op::Abs: case Op::Lt:  case Op::Le:  case Op::Gt:
+        case Op::Ge:
+            return !llvm_is_bool<T>;
+
+        case Op::Rem: case Op::Shl: case Op::Shr:
+            return llvm_is_int<T>;
+
+        case Op::Popc: case Op::Clz: case Op::Ctz:
+            return llvm_is_int<T> && sizeof(T) >= 4;
+
+        case Op::Sqrt: case Op::Rcp: case Op::Rsqrt: case Op::Exp:
+        case Op::Log: case Op::Sin: case Op::Cos: case Op::Floor:
+        case Op::Ceil: case Op::Round: case Op::Trunc:
+            return llvm_is_float<T>;
+
+        case Op::Index:
+            return llvm_is_int<T>;
+
+        default:
+            return true;
+    }
+}
+
+/// Operations whose operands and result are all of type 'T'
+template <Op op, typename T>
+void llvm_kernel_arith(void *out_, void *const *in, size_t offset, size_t count) {
+    T *out = (T *) out_;
+    const T *a = (const T *) in[0],
+            *b = (const T *) in[1],
+            *c = (const T *) in[2];
+    (void) a; (void) b; (void) c; (void) offset;
+
+    using U = std::conditional_t<llvm_is_int<T>, std::make_unsigned_t<
+        std::conditional_t<llvm_is_int<T>, T, int>>, T>;
+
+    for (size_t i = 0; i < count; ++i) {
+        if constexpr (op == Op::Index) {
+            out[i] = (T) (offset + i);
+        } else if constexpr (op == Op::Mov) {
+            out[i] = a[i];
+        } else if constexpr (op == Op::Add) {
+            out[i] = (T) ((U) a[i] + (U) b[i]);
+        } else if constexpr (op == Op::Sub) {
+            out[i] = (T) ((U) a[i] - (U) b[i]);
+        } else if constexpr (op == Op::Mul) {
+            out[i] = (T) ((U) a[i] * (U) b[i]);
+        } else if constexpr (op == Op::Div) {
+            out[i] = (T) (a[i] / b[i]);
+        } else if constexpr (op == Op::Rem) {
+            out[i] = (T) (a[i] % b[i]);
+        } else if constexpr (op == Op::Fma) {
+            out[i] = (T) ((U) a[i] * (U) b[i] + (U) c[i]);
+        } else if constexpr (op == Op::Min) {
+            out[i] = a[i] < b[i] ? a[i] : b[i];
+        } else if constexpr (op == Op::Max) {
+            out[i] = a[i] > b[i] ? a[i] : b[i];
+        } else if constexpr (op == Op::Neg) {
+            if constexpr (llvm_is_float<T>)
+                out[i] = -a[i];
+            else
+                out[i] = (T) (U(0) - (U) a[i]);
+        } else if constexpr (op == Op::Abs) {
+            if constexpr (std::is_unsigned_v<T>)
+                out[i] = a[i];
+            else
+                out[i] = a[i] < T(0) ? (T) -a[i] : a[i];
+        } else if constexpr (op == Op::Sqrt) {
+            out[i] = std::sqrt(a[i]);
+        } else if constexpr (op == Op::Rcp) {
+            out[i] = T(1) / a[i];
+        } else if constexpr (op == Op::Rsqrt) {
+            out[i] = T(1) / std::sqrt(a[i]);
+        } else if constexpr (op == Op::Exp) {
+            out[i] = std::exp(a[i]);
+        } else if constexpr (op == Op::Log) {
+            out[i] = std::log(a[i]);
+        } else if constexpr (op == Op::Sin) {
+            out[i] = std::sin(a[i]);
+        } else if constexpr (op == Op::Cos) {
+            out[i] = std::cos(a[i]);
+        } else if constexpr (op == Op::Floor) {
+            out[i] = std::floor(a[i]);
+        } else if constexpr (op == Op::Ceil) {
+            out[i] = std::ceil(a[i]);
+        } else if constexpr (op == Op::Round) {
+            out[i] = std::nearbyint(a[i]);
+        } else if constexpr (op == Op::Trunc) {
+            out[i] = std::trunc(a[i]);
+        } else if constexpr (op == Op::Not) {
+            if constexpr (llvm_is_bool<T>)
+                out[i] = !a[i];
+            else
+                out[i] = from_bits<T>((llvm_bits_t<T>) ~to_bits(a[i]));
+        } else if constexpr (op == Op::And) {
+            if constexpr (llvm_is_bool<T>)
+                out[i] = a[i] & b[i];
+            else
+                out[i] = from_bits<T>((llvm_bits_t<T>) (to_bits(a[i]) & to_bits(b[i])));
+        } else if constexpr (op == Op::Or) {
+            if constexpr (llvm_is_bool<T>)
+                out[i] = a[i] | b[i];
+            else
+                out[i] = from_bits<T>((llvm_bits_t<T>) (to_bits(a[i]) | to_bits(b[i])));
+        } else if constexpr (op == Op::Xor) {
+            if constexpr (llvm_is_bool<T>)
+                out[i] = a[i] != b[i];
+            else
+                out[i] = from_bits<T>((llvm_bits_t<T>) (to_bits(a[i]) ^ to_bits(b[i])));
+        } else if constexpr (op == Op::Shl) {
+            out[i] = (T) ((U) a[i] << ((U) b[i] & (sizeof(T) * 8 - 1)));
+        } else if constexpr (op == Op::Shr) {
+            out[i] = (T) (a[i] >> ((U) b[i] & (sizeof(T) * 8 - 1)));
+        } else if constexpr (op == Op::Popc) {
+            out[i] = (T) popcnt(a[i]);
+        } else if constexpr (op == Op::Clz) {
+            out[i] = (T) lzcnt(a[i]);
+        } else if constexpr (op == Op::Ctz) {
+            out[i] = (T) tzcnt(a[i]);
+        }
+    }
+}
+
+/// Comparisons (the result is a mask)
+template <Op op, typename T>
+void llvm_kernel_cmp(void *out_, void *const *in, size_t, size_t count) {
+    bool *out = (bool *) out_;
+    const T *a = (const T *) in[0],
+            *b = (const T *) in[1];
+
+    for (size_t i = 0; i < count; ++i) {
+        if constexpr (op == Op::Eq)
+            out[i] = a[i] == b[i];
+        else if constexpr (op == Op::Neq)
+            out[i] = a[i] != b[i];
+        else if constexpr (op == Op::Lt)
+            out[i] = a[i] < b[i];
+        else if constexpr (op == Op::Le)
+            out[i] = a[i] <= b[i];
+        else if constexpr (op == Op::Gt)
+            out[i] = a[i] > b[i];
+        else if constexpr (op == Op::Ge)
+            out[i] = a[i] >= b[i];
+    }
+}
+
+/// select(mask, t, f)
+template <typename T>
+void llvm_kernel_select(void *out_, void *const *in, size_t, size_t count) {
+    T *out = (T *) out_;
+    const bool *m = (const bool *) in[0];
+    const T *t = (const T *) in[1],
+            *f = (const T *) in[2];
+
+    for (size_t i = 0; i < count; ++i)
+        out[i] = m[i] ? t[i] : f[i];
+}
+
+/// Conversion from 'In' to 'T'
+template <typename T, typename In>
+void llvm_kernel_cvt(void *out_, void *const *in, size_t, size_t count) {
+    T *out = (T *) out_;
+    const In *a = (const In *) in[0];
+
+    for (size_t i = 0; i < count; ++i) {
+        if constexpr (llvm_is_bool<T>)
+            out[i] = a[i] != In(0);
+        else
+            out[i] = (T) a[i];
+    }
+}
+
+/// Reinterpret the bits of an operand with a type of the same size
+template <typename T>
+void llvm_kernel_bitcast(void *out, void *const *in, size_t, size_t count) {
+    memcpy(out, in[0], count * sizeof(T));
+}
+
+/// Masked gather: ld(address, mask)
+template <typename T>
+void llvm_kernel_load(void *out_, void *const *in, size_t, size_t count) {
+    T *out = (T *) out_;
+    const uint64_t *addr = (const uint64_t *) in[0];
+    const bool *mask = (const bool *) in[1];
+
+    for (size_t i = 0; i < count; ++i)
+        out[i] = mask[i] ? *((const T *) (uintptr_t) addr[i]) : T(0);
+}
+
+/// Masked scatter: st(address, value, mask)
+template <typename T>
+void llvm_kernel_store(void *, void *const *in, size_t, size_t count) {
+    const uint64_t *addr = (const uint64_t *) in[0];
+    const T *value = (const T *) in[1];
+    const bool *mask = (const bool *) in[2];
+
+    for (size_t i = 0; i < count; ++i) {
+        if (mask[i])
+            *((T *) (uintptr_t) addr[i]) = value[i];
+    }
+}
+
+template <Op op, typename T> Kernel llvm_lookup_arith() {
+    if constexpr (llvm_supported<op, T>())
+        return llvm_kernel_arith<op, T>;
+    else
+        return nullptr;
+}
+
+template <Op op, typename T> Kernel llvm_lookup_cmp() {
+    if constexpr (llvm_supported<op, T>())
+        return llvm_kernel_cmp<op, T>;
+    else
+        return nullptr;
+}
+
+/// Invoke 'func' with a default-constructed instance of the type 'type'
+template <typename Func> Kernel llvm_dispatch(EnokiType type, Func func) {
+    switch (type) {
+        case EnokiType::Bool:    return func(bool());
+        case EnokiType::Int8:    return func(int8_t());
+        case EnokiType::UInt8:   return func(uint8_t());
+        case EnokiType::Int16:   return func(int16_t());
+        case EnokiType::UInt16:  return func(uint16_t());
+        case EnokiType::Int32:   return func(int32_t());
+        case EnokiType::UInt32:  return func(uint32_t());
+        case EnokiType::Int64:   return func(int64_t());
+        case EnokiType::Pointer:
+        case EnokiType::UInt64:  return func(uint64_t());
+        case EnokiType::Float32: return func(float());
+        case EnokiType::Float64: return func(double());
+        default: return nullptr;
+    }
+}
+
+NAMESPACE_END(detail)
+
+/// Find the routine implementing a given instruction
+static Kernel llvm_kernel(const Instr &instr) {
+    using namespace detail;
+
+    return llvm_dispatch(instr.type, [&](auto t) -> Kernel {
+        using T = decltype(t);
+
+        switch (instr.op) {
+            #define ENOKI_LLVM_ARITH(name) \
+                case Op::name: return llvm_lookup_arith<Op::name, T>();
+            ENOKI_LLVM_ARITH(Index) ENOKI_LLVM_ARITH(Mov)
+            ENOKI_LLVM_ARITH(Add)
+            ENOKI_LLVM_ARITH(Sub)   ENOKI_LLVM_ARITH(Mul)
+            ENOKI_LLVM_ARITH(Div)   ENOKI_LLVM_ARITH(Rem)
+            ENOKI_LLVM_ARITH(Fma)   ENOKI_LLVM_ARITH(Min)
+            ENOKI_LLVM_ARITH(Max)   ENOKI_LLVM_ARITH(Neg)
+            ENOKI_LLVM_ARITH(Abs)   ENOKI_LLVM_ARITH(Sqrt)
+            ENOKI_LLVM_ARITH(Rcp)   ENOKI_LLVM_ARITH(Rsqrt)
+            ENOKI_LLVM_ARITH(Exp)   ENOKI_LLVM_ARITH(Log)
+            ENOKI_LLVM_ARITH(Sin)   ENOKI_LLVM_ARITH(Cos)
+            ENOKI_LLVM_ARITH(Floor) ENOKI_LLVM_ARITH(Ceil)
+            ENOKI_LLVM_ARITH(Round) ENOKI_LLVM_ARITH(Trunc)
+            ENOKI_LLVM_ARITH(Not)   ENOKI_LLVM_ARITH(And)
+            ENOKI_LLVM_ARITH(Or)    ENOKI_LLVM_ARITH(Xor)
+            ENOKI_LLVM_ARITH(Shl)   ENOKI_LLVM_ARITH(Shr)
+            ENOKI_LLVM_ARITH(Popc)  ENOKI_LLVM_ARITH(Clz)
+            ENOKI_LLVM_ARITH(Ctz)
+            #undef ENOKI_LLVM_ARITH
+
+            case Op::Eq: case Op::Neq: case Op::Lt:
+            case Op::Le: case Op::Gt:  case Op::Ge:
+                if constexpr (!llvm_is_bool<T>)
+                    return nullptr;
+                return llvm_dispatch(instr.type_in, [&](auto t2) -> Kernel {
+                    using In = decltype(t2);
+                    switch (instr.op) {
+                        case Op::Eq:  return llvm_lookup_cmp<Op::Eq,  In>();
+                        case Op::Neq: return llvm_lookup_cmp<Op::Neq, In>();
+                        case Op::Lt:  return llvm_lookup_cmp<Op::Lt,  In>();
+                        case Op::Le:  return llvm_lookup_cmp<Op::Le,  In>();
+                        case Op::Gt:  return llvm_lookup_cmp<Op::Gt,  In>();
+                        default:      return llvm_lookup_cmp<Op::Ge,  In>();
+                    }
+                });
+
+            case Op::Cvt:
+                return llvm_dispatch(instr.type_in, [](auto t2) -> Kernel {
+                    return llvm_kernel_cvt<T, decltype(t2)>;
+                });
+
+            case Op::Bitcast:
+                if (llvm_register_size(instr.type_in) != sizeof(T))
+                    return nullptr;
+                return llvm_kernel_bitcast<T>;
+
+            case Op::Select: return llvm_kernel_select<T>;
+            case Op::Load:   return llvm_kernel_load<T>;
+
+            case Op::Store:
+                return llvm_dispatch(instr.type_in, [](auto t2) -> Kernel {
+                    return llvm_kernel_store<decltype(t2)>;
+                });
+
+            default:
+                return nullptr;
+        }
+    });
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+//! @{ \name JIT trace generation
+// -----------------------------------------------------------------------
+
+/**
+ * \brief Turn a schedule into a list of instructions and a listing that
+ * serves as the key of the kernel cache
+ */
+static std::string llvm_jit_assemble(size_t size,
+                                     const std::vector<uint32_t> &sweep,
+                                     std::vector<Instr> &instr,
+                                     std::vector<void *> &ptrs) {
+    Context &ctx = context();
+    std::ostringstream oss;
+    size_t n_in = 0, n_out = 0, n_arith = 0;
+
+    std::unordered_map<uint32_t, uint32_t> reg_map;
+    for (uint32_t index : sweep) {
+        Variable &var = ctx[index];
+
+        if (var.is_collected() || (var.cmd.empty() && var.data == nullptr && !var.direct_pointer))
+            throw std::runtime_error(
+                "LLVMBackend: found invalid/expired variable " + std::to_string(index) + " in schedule! ");
+
+        if (var.size != 1 && var.size != size)
+            throw std::runtime_error(
+                "LLVMBackend: encountered arrays of incompatible size! (" +
+                std::to_string(size) + " vs " + std::to_string(var.size) + ")");
+
+        uint32_t reg = (uint32_t) instr.size();
+        reg_map[index] = reg;
+
+        Instr in;
+        in.type = in.type_in = var.type;
+        oss << "%" << reg << " = ";
+
+        if (var.data || var.direct_pointer) {
+            in.kind = var.direct_pointer ? Instr::Kind::Pointer
+                      : (var.size == 1 ? Instr::Kind::ScalarInput : Instr::Kind::Input);
+            in.op = Op::Mov;
+            in.ptr = (uint32_t) ptrs.size();
+            ptrs.push_back(var.data);
+            oss << (var.direct_pointer ? "ptr" : (var.size == 1 ? "ld.scalar." : "ld."))
+                << (var.direct_pointer ? "" : llvm_register_type(var.type))
+                << " [in " << in.ptr << "]";
+            n_in++;
+        } else if (var.op == Op::Const) {
+            /* Literals are passed via the pointer table so that kernels
+               which only differ in their constants are compiled once */
+            in.kind = Instr::Kind::Literal;
+            in.op = Op::Const;
+            in.ptr = (uint32_t) ptrs.size();
+            ptrs.push_back((void *) (uintptr_t) var.imm);
+            oss << "const." << llvm_register_type(var.type) << " [in "
+                << in.ptr << "]";
+        } else {
+            in.kind = Instr::Kind::Compute;
+            in.op = var.op;
+            in.n_dep = op_args[(int) var.op];
+            for (uint32_t i = 0; i < in.n_dep; ++i)
+                in.dep[i] = reg_map.at(var.dep[i]);
+
+            /* Record the type of the (non-mask) operands */
+            uint32_t in_arg = var.op == Op::Select ? 1 : (var.op == Op::Store ? 1 : 0);
+            if (in.n_dep > 0)
+                in.type_in = ctx[var.dep[in_arg]].type;
+
+            oss << op_name[(int) var.op] << "." << llvm_register_type(var.type);
+            if (in.type_in != in.type)
+                oss << "." << llvm_register_type(in.type_in);
+            for (uint32_t i = 0; i < in.n_dep; ++i)
+                oss << (i == 0 ? " %" : ", %") << in.dep[i];
+            n_arith++;
+        }
+
+        if (var.side_effect) {
+            n_out++;
+        } else if (!var.data && var.ref_count_ext > 0 && var.size == size) {
+            size_t size_in_bytes = var.size * llvm_register_size(var.type);
+            var.data = llvm_malloc(size_in_bytes);
+            var.subtree_size = 1;
+#if !defined(NDEBUG)
+            if (ctx.log_level >= 4)
+                std::cerr << "llvm_eval(): allocated variable " << index
+                          << " -> " << var.data << " (" << size_in_bytes
+                          << " bytes)" << std::endl;
+#endif
+            in.store = true;
+            in.out = (uint32_t) ptrs.size();
+            ptrs.push_back(var.data);
+            oss << " -> [out " << in.out << "]";
+            n_out++;
+        }
+
+        if (!var.label.empty())
+            oss << " // " << var.label;
+        oss << std::endl;
+        instr.push_back(in);
+    }
+
+    if (ctx.log_level >= 1)
+        std::cerr << "llvm_eval(): launching kernel (n=" << size << ", in="
+                  << n_in << ", out=" << n_out << ", ops=" << n_arith
+                  << ")" << std::endl;
+
+    return oss.str();
+}
+
+/**
+ * \brief Resolve the routines implementing each instruction, detect
+ * instructions that evaluate to the same value for all entries, and assign
+ * scratch buffers (which are recycled once their last user has executed)
+ */
+static Program llvm_jit_compile(std::vector<Instr> &&instr) {
+    Program program;
+    size_t n = instr.size();
+    std::vector<uint32_t> last_use(n, 0);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        Instr &in = instr[i];
+
+        switch (in.kind) {
+            case Instr::Kind::Input:
+                in.uniform = false;
+                break;
+
+            case Instr::Kind::ScalarInput:
+            case Instr::Kind::Pointer:
+            case Instr::Kind::Literal:
+                in.uniform = true;
+                break;
+
+            case Instr::Kind::Compute:
+                in.kernel = llvm_kernel(in);
+                if (!in.kernel)
+                    throw std::runtime_error(
+                        std::string("llvm_eval(): operation \"") +
+                        op_name[(int) in.op] + "\" is not supported for type " +
+                        llvm_register_type(in.type) + "!");
+                in.uniform = in.op != Op::Index;
+                for (uint32_t k = 0; k < in.n_dep; ++k) {
+                    in.uniform &= instr[in.dep[k]].uniform;
+                    last_use[in.dep[k]] = i;
+                }
+                break;
+        }
+    }
+
+    std::vector<uint32_t> free_slots;
+    for (uint32_t i = 0; i < n; ++i) {
+        Instr &in = instr[i];
+
+        if (in.kind != Instr::Kind::Input && !(in.store && !in.uniform)) {
+            if (in.uniform || free_slots.empty()) {
+                in.slot = program.n_slots++;
+            } else {
+                in.slot = free_slots.back();
+                free_slots.pop_back();
+            }
+
+            /* Results without users (e.g. scatter operations) */
+            if (!in.uniform && !in.store && last_use[i] == 0)
+                free_slots.push_back(in.slot);
+        }
+
+        /* Release the scratch buffers of operands that are no longer needed
+           (only after allocating the output, since operands and result may
+           have a different size) */
+        for (uint32_t k = 0; k < in.n_dep; ++k) {
+            const Instr &dep = instr[in.dep[k]];
+            bool first = std::find(in.dep.begin(), in.dep.begin() + k,
+                                   in.dep[k]) == in.dep.begin() + k;
+            if (first && !dep.uniform && dep.kind == Instr::Kind::Compute &&
+                !dep.store && last_use[in.dep[k]] == i)
+                free_slots.push_back(dep.slot);
+        }
+    }
+
+    program.instr = std::move(instr);
+    return program;
+}
+
+/// Execute a program over 'size' entries using all cores
+static void llvm_jit_run(const Program &program,
+                         const std::vector<void *> &ptrs, size_t size) {
+    constexpr size_t BlockSize = ENOKI_LLVM_BLOCK_SIZE;
+    size_t n_blocks = (size + BlockSize - 1) / BlockSize,
+           grain = std::max((size_t) 1, (size_t) ENOKI_PARALLEL_CHUNK_SIZE /
+                                            (BlockSize * sizeof(float)));
+
+    parallel_for(n_blocks, grain, [&](size_t start, size_t end) {
+        const std::vector<Instr> &instr = program.instr;
+        std::unique_ptr<uint64_t[]> scratch(
+            new uint64_t[std::max(program.n_slots, 1u) * BlockSize]);
+        std::vector<void *> reg(instr.size());
+        void *in[3] = { nullptr, nullptr, nullptr };
+
+        /* Instructions that produce the same value for all entries are
+           executed once per work item */
+        size_t count = std::min(size, BlockSize);
+        for (size_t i = 0; i < instr.size(); ++i) {
+            const Instr &ins = instr[i];
+            if (!ins.uniform)
+                continue;
+
+            uint8_t *out = (uint8_t *) (scratch.get() + ins.slot * BlockSize);
+            size_t tsize = llvm_register_size(ins.type);
+            reg[i] = out;
+
+            if (ins.kind == Instr::Kind::Compute) {
+                for (uint32_t k = 0; k < ins.n_dep; ++k)
+                    in[k] = reg[ins.dep[k]];
+                ins.kernel(out, in, 0, count);
+            } else {
+                uint64_t value = (uint64_t) (uintptr_t) ptrs[ins.ptr];
+                const void *src = ins.kind == Instr::Kind::ScalarInput
+                                      ? ptrs[ins.ptr] : (const void *) &value;
+                for (size_t j = 0; j < count; ++j)
+                    memcpy(out + j * tsize, src, tsize);
+            }
+        }
+
+        for (size_t block = start; block < end; ++block) {
+            size_t offset = block * BlockSize;
+            count = std::min(size - offset, BlockSize);
+
+            for (size_t i = 0; i < instr.size(); ++i) {
+                const Instr &ins = instr[i];
+                size_t tsize = llvm_register_size(ins.type);
+
+                if (ins.uniform) {
+                    if (ins.store)
+                        memcpy((uint8_t *) ptrs[ins.out] + offset * tsize,
+                               reg[i], count * tsize);
+                    continue;
+                } else if (ins.kind == Instr::Kind::Input) {
+                    reg[i] = (uint8_t *) ptrs[ins.ptr] + offset * tsize;
+                    continue;
+                }
+
+                void *out = ins.store
+                    ? (void *) ((uint8_t *) ptrs[ins.out] + offset * tsize)
+                    : (void *) (scratch.get() + ins.slot * BlockSize);
+                reg[i] = out;
+
+                for (uint32_t k = 0; k < ins.n_dep; ++k)
+                    in[k] = reg[ins.dep[k]];
+                ins.kernel(out, in, offset, count);
+            }
+        }
+    });
+}
+
+static void sweep_recursive(Context &ctx,
+                            std::unordered_set<uint32_t> &visited,
+                            std::vector<uint32_t> &sweep,
+                            uint32_t idx) {
+    if (visited.find(idx) != visited.end())
+        return;
+    visited.insert(idx);
+
+    std::array<uint32_t, 3> deps = ctx[idx].dep;
+
+    for (uint32_t k : deps) {
+        if (k >= ENOKI_LLVM_REG_RESERVED)
+            sweep_recursive(ctx, visited, sweep, k);
+    }
+
+    sweep.push_back(idx);
+}
+
+ENOKI_EXPORT void llvm_eval(bool log_assembly) {
+    Context &ctx = context();
+
+    for (auto callback: ctx.callbacks)
+        callback.first(callback.second);
+
+    std::map<size_t, std::pair<std::unordered_set<uint32_t>,
+                               std::vector<uint32_t>>> sweeps;
+    for (uint32_t idx : ctx.live) {
+        auto &sweep = sweeps[ctx[idx].size];
+        sweep_recursive(ctx, std::get<0>(sweep), std::get<1>(sweep), idx);
+    }
+    for (uint32_t idx : ctx.dirty)
+        ctx[idx].dirty = false;
+
+    ctx.live.clear();
+    ctx.dirty.clear();
+
+    for (auto it = sweeps.rbegin(); it != sweeps.rend(); ++it) {
+        size_t size = std::get<0>(*it);
+        const std::vector<uint32_t> &schedule = std::get<1>(std::get<1>(*it));
+
+        TimePoint start = std::chrono::high_resolution_clock::now();
+        std::vector<Instr> instr;
+        std::vector<void *> ptrs;
+        std::string source = llvm_jit_assemble(size, schedule, instr, ptrs);
+
+        auto hash_entry = ctx.kernels.emplace(std::move(source), Program());
+        Program &program = hash_entry.first->second;
+        if (hash_entry.second) {
+            try {
+                program = llvm_jit_compile(std::move(instr));
+            } catch (...) {
+                ctx.kernels.erase(hash_entry.first);
+                throw;
+            }
+        }
+        TimePoint mid = std::chrono::high_resolution_clock::now();
+
+        if (ctx.log_level >= 3 || log_assembly)
+            std::cerr << hash_entry.first->first << std::endl;
+
+        llvm_jit_run(program, ptrs, size);
+
+        TimePoint end = std::chrono::high_resolution_clock::now();
+        if (ctx.log_level >= 2) {
+            size_t duration_1 = (size_t) std::chrono::duration_cast<
+                    std::chrono::microseconds>(mid - start).count(),
+                   duration_2 = (size_t) std::chrono::duration_cast<
+                    std::chrono::microseconds>(end - mid).count();
+            std::cerr << "llvm_eval(): "
+                      << (hash_entry.second ? "compiled" : "cache hit")
+                      << " in " << duration_1 << " us, ran in "
+                      << duration_2 << " us." << std::endl;
+        }
+    }
+
+    for (auto const &sweep : sweeps) {
+        const std::vector<uint32_t> &schedule =
+            std::get<1>(std::get<1>(sweep));
+
+        for (uint32_t idx : schedule) {
+            auto it = ctx.variables.find(idx);
+            if (it == ctx.variables.end())
+                continue;
+
+            Variable &v = it->second;
+
+            if (v.data != nullptr && !v.cmd.empty()) {
+                for (int j = 0; j < 3; ++j) {
+                    uint32_t dep = v.dep[j];
+                    v.dep[j] = 0;
+                    llvm_dec_ref_int(dep);
+                }
+            }
+
+            if (v.side_effect)
+                llvm_dec_ref_ext(idx);
+        }
+    }
+}
+
+ENOKI_EXPORT void llvm_eval_var(uint32_t index, bool log_assembly) {
+    Variable &var = context()[index];
+    if (var.data == nullptr || var.dirty)
+        llvm_eval(log_assembly);
+    assert(!var.dirty);
+}
+
+//! @}
+// -----------------------------------------------------------------------
+
+ENOKI_EXPORT void llvm_fetch_element(void *dst, uint32_t src, size_t offset, size_t size) {
+    Variable &var = context()[src];
+
+    if (var.data == nullptr || var.dirty)
+        llvm_eval();
+
+    if (var.dirty)
+        throw std::runtime_error("llvm_fetch_element(): element is still "
+                                 "marked as 'dirty' even after llvm_eval()!");
+    else if (var.data == nullptr)
+        throw std::runtime_error(
+            "llvm_fetch_element(): tried to read from invalid/uninitialized LLVM array!");
+
+    if (var.size == 1)
+        offset = 0;
+
+    memcpy(dst, (uint8_t *) var.data + size * offset, size);
+}
+
+ENOKI_EXPORT size_t llvm_kernel_count() {
+    return context().kernels.size();
+}
+
+ENOKI_EXPORT void llvm_set_log_level(uint32_t level) {
+#if defined(NDEBUG)
+    if (level >= 4)
+        throw std::runtime_error("llvm_set_log_level(): log levels >= 4 are only supported when Enoki is compiled in debug mode!");
+#endif
+    context().log_level = level;
+}
+
+ENOKI_EXPORT uint32_t llvm_log_level() {
+    return context().log_level;
+}
+
+ENOKI_EXPORT void llvm_register_callback(void (*callback)(void *), void *payload) {
+    context().callbacks.emplace_back(callback, payload);
+}
+
+ENOKI_EXPORT void llvm_unregister_callback(void (*callback)(void *), void *payload) {
+    auto &cb = context().callbacks;
+    auto it = std::find(cb.begin(), cb.end(), std::make_pair(callback, payload));
+    if (it == cb.end())
+        throw std::runtime_error("llvm_unregister_callback(): entry not found!");
+    cb.erase(it);
+}
+
+NAMESPACE_END(enoki)
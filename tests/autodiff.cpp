@@ -15,6 +15,8 @@
 #include <enoki/dynamic.h>
 #include <enoki/autodiff.h>
 #include <enoki/color.h>
+#include <set>
+#include <thread>
 
 using Float  = float;
 using FloatP = Packet<Float>;
@@ -634,3 +636,493 @@ ENOKI_TEST(test37_scatter_fwd) {
     FloatX ref_gradient { 0.f, 0.f, -2.f, -1.f, 0.f, 1.f, 2.f, 0.f, 0.f, 0.f };
     assert(allclose(ref_gradient, gradient(y), 1e-4f, 1e-4f));
 }
+
+ENOKI_TEST(test38_node_reuse) {
+    FloatD x = 2.f;
+    set_requires_gradient(x);
+
+    /* Release two nodes; the one with the larger index is recycled first */
+    FloatD t1 = x * 3.f, t2 = x * 4.f;
+    if (t1.index_() > t2.index_())
+        std::swap(t1, t2);
+    t1 = FloatD();
+    t2 = FloatD();
+
+    /* 'z' thus ends up with a smaller index than its source 'y' */
+    FloatD y = x * x;
+    FloatD z = y * x;
+    assert(z.index_() < y.index_());
+
+    backward(z);
+    assert(gradient(x)[0] == 12.f);
+}
+
+ENOKI_TEST(test39_parallel_backward) {
+    auto run = [](bool parallel) {
+        FloatD::set_parallel_backward_(parallel);
+        FloatD x = linspace<FloatD>(-1.f, 1.f, 1000);
+        set_requires_gradient(x);
+
+        /* Independent chains of different lengths sharing the source 'x' */
+        FloatD y = 0.f;
+        for (int i = 0; i < 16; ++i) {
+            FloatD z = x;
+            for (int j = 0; j <= i; ++j)
+                z = sin(z) * x + float(j);
+            y = y + z;
+        }
+        y = y + hsum(gather<FloatD>(x * x, arange<UInt32D>(500) * 2));
+
+        backward(y);
+        FloatD::set_parallel_backward_(false);
+        return FloatX(gradient(x));
+    };
+
+    size_t thread_count = parallel_thread_count();
+    set_parallel_thread_count(4);
+    FloatX ref = run(false), result = run(true);
+    set_parallel_thread_count(thread_count);
+
+    assert(allclose(ref, result, 1e-5f, 1e-5f));
+}
+
+ENOKI_TEST(test40_tape_scope) {
+    auto run = [](float scale, FloatX &result) {
+        FloatD::Tape tape;
+        TapeScope scope(tape);
+        FloatD::set_log_level_(0);
+
+        FloatD x = linspace<FloatD>(0.f, 1.f, 100);
+        set_requires_gradient(x);
+        for (int i = 0; i < 100; ++i) {
+            FloatD y = hsum(x * x * scale);
+            backward(y);
+            result = gradient(x);
+        }
+    };
+
+    FloatX r1, r2;
+    std::thread t1(run, 1.f, std::ref(r1)),
+                t2(run, 2.f, std::ref(r2));
+    t1.join();
+    t2.join();
+
+    FloatX ref = linspace<FloatX>(0.f, 2.f, 100);
+    assert(allclose(r1, ref) && allclose(r2, ref * 2.f));
+    assert(FloatD::Tape::get() != nullptr);
+}
+
+ENOKI_TEST(test41_checkpoint) {
+    auto func = [](const Vector2fD &v) {
+        FloatD r = v.x();
+        for (int i = 0; i < 10; ++i)
+            r = sin(r) * v.y() + r;
+        return Vector2fD(r, v.x() * v.y());
+    };
+
+    auto run = [&](bool use_checkpoint) {
+        FloatD x = linspace<FloatD>(0.f, 1.f, 10);
+        set_requires_gradient(x);
+        Vector2fD v(x * 2.f, x);
+        Vector2fD r = use_checkpoint ? checkpoint(func, v) : func(v);
+        FloatD y = hsum(r.x() * r.y());
+        backward(y);
+        return FloatX(gradient(x));
+    };
+
+    FloatX ref = run(false), result = run(true);
+    assert(allclose(ref, result, 1e-5f, 1e-5f));
+
+    FloatD::set_parallel_backward_(true);
+    result = run(true);
+    FloatD::set_parallel_backward_(false);
+    assert(allclose(ref, result, 1e-5f, 1e-5f));
+}
+
+ENOKI_TEST(test42_capture) {
+    auto func = [](const Vector2fD &v) {
+        FloatD r = v.x();
+        for (int i = 0; i < 5; ++i)
+            r = sin(r) * v.y() + r * r;
+        return hsum(r * v.y());
+    };
+
+    auto captured = capture<Vector2fD>(func);
+
+    for (int i = 0; i < 3; ++i) {
+        FloatX x = linspace<FloatX>(0.f, 1.f, 10) * float(i + 1),
+               y = linspace<FloatX>(1.f, 2.f, 10);
+
+        /* Reference: regular recording */
+        Vector2fD v(x, y);
+        set_requires_gradient(v);
+        FloatD ref = func(v);
+        backward(ref);
+
+        FloatD result = captured(Vector2fD(x, y));
+        assert(!requires_gradient(result));
+        assert(allclose(detach(result), detach(ref)));
+
+        Vector2fD grad = captured.backward(FloatD(1.f));
+        assert(allclose(detach(grad.x()), gradient(v.x()), 1e-5f, 1e-5f));
+        assert(allclose(detach(grad.y()), gradient(v.y()), 1e-5f, 1e-5f));
+    }
+
+    /* A different sequence of operations is detected */
+    bool fail = false;
+    auto captured2 = capture<FloatD>([&](const FloatD &x) { return fail ? sin(x) * x : x * x; });
+    captured2(FloatD(1.f));
+    fail = true;
+    try {
+        captured2(FloatD(1.f));
+        fail = false;
+    } catch (const std::runtime_error &) { }
+    assert(fail);
+}
+
+ENOKI_TEST(test43_backward_batch) {
+    auto func = [](const FloatD &x, bool use_checkpoint) {
+        FloatD g = gather<FloatD>(x * x, arange<UInt32D>(10) / 2u);
+        Vector3fD r(sin(x) * x, g + x, hsum(x * x));
+        if (use_checkpoint)
+            r = checkpoint([](const Vector3fD &v) { return v * v; }, r);
+        return r;
+    };
+
+    std::vector<Vector3fD> seeds = { Vector3fD(1.f, 0.f, 0.f),
+                                     Vector3fD(0.f, 1.f, 0.f),
+                                     Vector3fD(0.f, 0.f, 1.f),
+                                     Vector3fD(0.5f, 2.f, 0.f) };
+
+    for (bool use_checkpoint : { false, true }) {
+        FloatD x = linspace<FloatD>(0.f, 1.f, 10);
+        set_requires_gradient(x);
+
+        /* Reference: one traversal per seed */
+        std::vector<FloatX> ref;
+        for (const Vector3fD &seed : seeds) {
+            Vector3fD y = func(x, use_checkpoint);
+            set_gradient(y, detach(seed));
+            FloatD::backward_static_(true);
+            ref.push_back(gradient(x));
+        }
+
+        Vector3fD y = func(x, use_checkpoint);
+        std::vector<FloatD> result = backward_batch(y, seeds, x);
+        assert(result.size() == seeds.size());
+        for (size_t k = 0; k < seeds.size(); ++k)
+            assert(allclose(detach(result[k]), ref[k], 1e-5f, 1e-5f));
+    }
+}
+
+ENOKI_TEST(test44_incremental_simplification) {
+    auto run = [](bool simplify) {
+        FloatD::set_graph_simplification_(simplify);
+        FloatD x = linspace<FloatD>(0.f, 1.f, 10);
+        set_requires_gradient(x);
+        FloatD y = x;
+        std::set<uint32_t> indices;
+        for (int i = 0; i < 1000; ++i) {
+            y = y * 0.999f + sin(y) * x * 0.001f;
+            indices.insert(y.index_());
+        }
+        backward(y);
+        FloatD::set_graph_simplification_(true);
+        return std::make_pair(FloatX(gradient(x)), indices.size());
+    };
+
+    auto [ref, slots_ref] = run(false);
+    auto [result, slots] = run(true);
+
+    /* Unreferenced temporaries are collapsed in batches, and their slots recycled */
+    assert(slots_ref == 1000 && slots < 100);
+    assert(allclose(result, ref, 1e-5f, 1e-5f));
+}
+
+ENOKI_TEST(test45_fused_accumulation) {
+    /* Nodes with regular, broadcasted, and special edges */
+    FloatD x = linspace<FloatD>(0.f, 1.f, 10),
+           s = 2.f;
+    set_requires_gradient(x);
+    set_requires_gradient(s);
+
+    FloatD r = gather<FloatD>(x, 9u - arange<UInt32D>(10));
+    FloatD y = x * x * x + x * s + r * 0.5f + x * 3.f + s;
+    backward(y);
+
+    FloatX xv = detach(x);
+    assert(allclose(gradient(x), 3.f * xv * xv + 5.5f, 1e-5f, 1e-5f));
+    assert(allclose(gradient(s), hsum(xv) + 10.f, 1e-5f, 1e-5f));
+}
+
+ENOKI_TEST(test46_sorted_gather) {
+    auto run = [](bool sorted, bool masked) {
+        FloatD::set_sorted_gather_(sorted);
+        Vector3fD v(linspace<FloatD>(0.f, 1.f, 10),
+                    linspace<FloatD>(1.f, 2.f, 10),
+                    linspace<FloatD>(2.f, 3.f, 10));
+        set_requires_gradient(v);
+
+        /* Runs of repeated offsets (including out-of-order runs) */
+        UInt32D idx = (arange<UInt32D>(1000) / 20u * 7u) % 10u;
+        FloatD w = linspace<FloatD>(0.f, 1.f, 1000);
+        mask_t<FloatD> active = true;
+        if (masked)
+            active = w < .7f;
+        Vector3fD r = gather<Vector3fD>(v, idx, active);
+        backward(hsum(r * r * w));
+        FloatD::set_sorted_gather_(false);
+        return Vector3fX(gradient(v));
+    };
+
+    for (bool masked : { false, true }) {
+        Vector3fX ref = run(false, masked),
+                  result = run(true, masked);
+        for (size_t i = 0; i < 3; ++i)
+            assert(allclose(result[i], ref[i], 1e-4f, 1e-4f));
+    }
+}
+
+ENOKI_TEST(test47_vectorize_diff) {
+    auto kernel = [](const auto &v, const auto &s) {
+        return normalize(v) * sin(s * v.x()) + v.y() * s;
+    };
+    auto kernel2 = [](const auto &v, const auto &s) { return v * (s * s); };
+    auto kernel2_backward = [](const Vector3fP &go, const Vector3fP &v, const FloatP &s) {
+        return std::make_tuple(go * (s * s), dot(go, v) * 2.f * s);
+    };
+
+    auto run = [&](int mode) {
+        FloatD x = linspace<FloatD>(0.f, 1.f, 37), s = 2.f;
+        set_requires_gradient(x);
+        set_requires_gradient(s);
+        Vector3fD v(x, x * 2.f, x + 1.f), r;
+
+        switch (mode) {
+            case 0: r = kernel(v, s); break;
+            case 1: r = vectorize_diff(kernel, v, s); break;
+            case 2: r = kernel2(v, s); break;
+            case 3: r = vectorize_diff_custom(kernel2, kernel2_backward, v, s); break;
+        }
+
+        backward(hsum(r.x() + r.y() * 2.f + r.z()));
+        return std::make_tuple(Vector3fX(detach(r)), FloatX(gradient(x)), FloatX(gradient(s)));
+    };
+
+    for (int mode : { 0, 2 }) {
+        auto [r0, gx0, gs0] = run(mode);
+        auto [r, gx, gs] = run(mode + 1);
+        for (size_t i = 0; i < 3; ++i)
+            assert(allclose(r[i], r0[i], 1e-5f, 1e-5f));
+        assert(allclose(gx, gx0, 1e-4f, 1e-4f));
+        assert(allclose(gs, gs0, 1e-4f, 1e-4f));
+    }
+}
+
+/// Fused normalize(): d(v / |v|) = (dv - n * dot(n, dv)) / |v| (a symmetric map)
+struct NormalizeOp : FloatD::Tape::CustomOp {
+    Vector3fX n;
+    FloatX inv_norm;
+
+    Vector3fX apply(const std::vector<FloatX> &grad) const {
+        Vector3fX g;
+        for (size_t i = 0; i < 3; ++i)
+            g[i] = grad[i].empty() ? zero<FloatX>(slices(n)) : grad[i];
+        return (g - n * dot(n, g)) * inv_norm;
+    }
+
+    void backward(const std::vector<FloatX> &grad_out,
+                  std::vector<FloatX> &grad_in) override {
+        Vector3fX g = apply(grad_out);
+        for (size_t i = 0; i < 3; ++i)
+            grad_in[i] = g[i];
+    }
+
+    void forward(const std::vector<FloatX> &grad_in,
+                 std::vector<FloatX> &grad_out) override {
+        Vector3fX g = apply(grad_in);
+        for (size_t i = 0; i < 3; ++i)
+            grad_out[i] = g[i];
+    }
+
+    const char *name() const override { return "normalize"; }
+};
+
+ENOKI_TEST(test48_custom_op) {
+    auto normalize_fused = [](const Vector3fD &v) {
+        auto op = std::make_shared<NormalizeOp>();
+        Vector3fX vx = detach(v);
+        op->inv_norm = rsqrt(squared_norm(vx));
+        op->n = vx * op->inv_norm;
+        return custom(op, Vector3fD(op->n), v);
+    };
+
+    auto run = [&](bool fused, bool fwd) {
+        FloatD x = linspace<FloatD>(0.f, 1.f, 37), s = 2.f;
+        set_requires_gradient(x);
+        set_requires_gradient(s);
+        Vector3fD v(x, x * 2.f, x + s), n = fused ? normalize_fused(v) : normalize(v);
+        FloatD y = n.x() + n.y() * 2.f + n.z() * s;
+
+        if (fwd) {
+            forward(x);
+            return std::make_tuple(FloatX(detach(y)), FloatX(gradient(y)), FloatX());
+        } else {
+            backward(hsum(y));
+            return std::make_tuple(FloatX(detach(y)), FloatX(gradient(x)), FloatX(gradient(s)));
+        }
+    };
+
+    for (bool fwd : { false, true }) {
+        auto [y0, g0, gs0] = run(false, fwd);
+        auto [y1, g1, gs1] = run(true, fwd);
+        assert(allclose(y0, y1, 1e-5f, 1e-5f));
+        assert(allclose(g0, g1, 1e-4f, 1e-4f));
+        assert(gs0.size() == gs1.size());
+        if (!fwd)
+            assert(allclose(gs0, gs1, 1e-4f, 1e-4f));
+    }
+
+    /* A single node (plus one per output) replaces the elementwise graph */
+    FloatD x = linspace<FloatD>(0.f, 1.f, 5);
+    set_requires_gradient(x);
+    Vector3fD n = normalize_fused(Vector3fD(x, x, x));
+    assert(graphviz(n).find("normalize") != std::string::npos);
+}
+
+ENOKI_TEST(test49_profile) {
+    FloatD::set_profiling_(true);
+    FloatD::clear_profile_();
+
+    FloatD x = linspace<FloatD>(0.f, 1.f, 100);
+    set_requires_gradient(x);
+
+    FloatD::push_prefix_("model");
+    FloatD::push_prefix_("encoder");
+    FloatD y = sin(x) * x;
+    FloatD::pop_prefix_();
+    FloatD z = gather<FloatD>(y, arange<UInt32D>(50) * 2u);
+    FloatD::pop_prefix_();
+
+    auto stats = FloatD::profile_();
+    auto &enc = stats["model/encoder"], &model = stats["model"];
+    /* The graph simplification may already have merged the nodes of 'y' */
+    size_t weight_bytes = enc.weight_bytes;
+    assert(enc.nodes_created == 2 && enc.nodes >= 1 && enc.edges >= 1);
+    assert(weight_bytes == enc.edges * 100 * sizeof(Float));
+    assert(model.nodes_created == 1 && model.edges == 1);
+
+    backward(hsum(z));
+    stats = FloatD::profile_();
+    enc = stats["model/encoder"];
+    model = stats["model"];
+    assert(enc.edges == 0 && enc.weight_bytes == 0);
+    assert(enc.weight_bytes_peak == weight_bytes);
+    assert(model.specials == 1 && enc.specials == 0);
+    assert(enc.backward_ms > 0.0 && model.backward_ms > 0.0);
+    assert(enc.forward_ms == 0.0);
+
+    FloatD::set_profiling_(false);
+    FloatD::clear_profile_();
+}
+
+ENOKI_TEST(test50_gradient_pool) {
+    /* Simplification allocates merged edge weights; measure the traversal only */
+    FloatD::set_graph_simplification_(0);
+
+    for (bool parallel : { false, true }) {
+        FloatD::set_parallel_backward_(parallel);
+        FloatD::trim_pool_();
+        FloatX xv = linspace<FloatX>(0.f, 1.f, 1000);
+        size_t pool_size = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            FloatD x = xv;
+            set_requires_gradient(x);
+            FloatD y = sin(x) * x + x * x + hsum(x * x);
+
+            DynamicMallocStats s0 = dynamic_malloc_stats();
+            backward(y);
+            DynamicMallocStats s1 = dynamic_malloc_stats();
+            size_t allocs = (s1.hits + s1.misses) - (s0.hits + s0.misses);
+
+            /* At steady state, gradients are recycled rather than allocated.
+               The only remaining allocation is the scalar seed of backward() */
+            if (i > 1)
+                assert(s1.misses == s0.misses && allocs <= 1);
+
+            FloatX grad = gradient(x);
+            assert(allclose(grad, cos(xv) * xv + sin(xv) + 2002.f * xv, 1e-4f, 1e-4f));
+            xv -= 1e-5f * grad;
+
+            /* The pool retains the same set of buffers in every iteration */
+            if (i > 1)
+                assert(FloatD::pool_size_() == pool_size);
+            pool_size = FloatD::pool_size_();
+        }
+
+        assert(pool_size > 0);
+        FloatD::trim_pool_();
+        assert(FloatD::pool_size_() == 0);
+    }
+
+    FloatD::set_parallel_backward_(false);
+    FloatD::set_graph_simplification_(1);
+}
+
+ENOKI_TEST(test51_hvp) {
+    /* Diagonal Hessian: d^2/dx^2 (x sin(x)) = 2 cos(x) - x sin(x) */
+    FloatX xv = linspace<FloatX>(-1.f, 1.f, 100),
+           vv = linspace<FloatX>(1.f, 2.f, 100);
+    FloatD hv = hvp([](const FloatD &x) { return hsum(sin(x) * x); },
+                    FloatD(xv), FloatD(vv));
+    assert(allclose(detach(hv), (2.f * cos(xv) - xv * sin(xv)) * vv, 1e-5f, 1e-5f));
+
+    /* Scalar tape: d^2/dx^2 (x^3 + log(x)) = 6 x - 1 / x^2 */
+    using FloatS = DiffArray<float>;
+    FloatS hs = hvp([](const FloatS &x) { return x * x * x + log(x); },
+                    FloatS(2.f), FloatS(3.f));
+    assert(std::abs(detach(hs) - 35.25f) < 1e-4f);
+
+    /* Mixed terms, broadcasting and gathers vs. finite differences of gradients */
+    auto func = [](const Vector2fD &p) {
+        FloatD a = p.x() * p.y() + exp(p.y()) / p.x() + atan2(p.y(), p.x()),
+               b = gather<FloatD>(p.y(), arange<UInt32D>(5) / 2u);
+        return hsum(sqrt(a * a + 1.f)) + hsum(b * b * b) * 0.1f;
+    };
+
+    auto grad = [&](const Vector2fX &p) {
+        Vector2fD pd(p);
+        set_requires_gradient(pd);
+        backward(func(pd));
+        return Vector2fX(gradient(pd));
+    };
+
+    Vector2fX p(linspace<FloatX>(1.f, 2.f, 5), linspace<FloatX>(.5f, 1.f, 5)),
+              v(linspace<FloatX>(-1.f, 1.f, 5), full<FloatX>(.5f, 5));
+
+    Vector2fD result = hvp(func, Vector2fD(p), Vector2fD(v));
+    float eps = 1e-3f;
+    Vector2fX ref = (grad(p + eps * v) - grad(p - eps * v)) / (2.f * eps);
+    for (size_t i = 0; i < 2; ++i)
+        assert(allclose(detach(result.coeff(i)), ref.coeff(i), 1e-2f, 1e-2f));
+}
+
+ENOKI_TEST(test52_tape_outlives_scope) {
+    FloatD::Tape tape;
+    FloatD x, y;
+    {
+        TapeScope scope(tape);
+        x = linspace<FloatD>(0.f, 1.f, 10);
+        set_requires_gradient(x);
+        y = x * 3.f;
+    }
+
+    /* Variables keep recording on (and releasing nodes of) their own tape */
+    FloatD z = hsum(y * x);
+    backward(z);
+    assert(allclose(gradient(x), linspace<FloatX>(0.f, 6.f, 10)));
+    z = FloatD();
+    y = FloatD();
+    x = FloatD();
+}
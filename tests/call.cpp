@@ -43,7 +43,11 @@ struct Test {
 
     // Vectorized function (accepts a mask, which is ignored here)
     virtual Int32P func1(Int32P i, TestPMask /* unused */) const { return i + value; }
-    virtual Int32X func1(Int32X i, TestXMask /* unused */) const { return i + value; }
+    virtual Int32X func1(Int32X i, TestXMask /* unused */) const {
+        calls++;
+        lanes += i.size();
+        return i + value;
+    }
 
     // Vectorized function (accepts a mask, which is ignored here)
     virtual void func2(Int32P &i, TestPMask mask) const { i[mask] += value; }
@@ -54,6 +58,9 @@ struct Test {
 
     Ray3fP make_ray(TestPMask) const { return Ray3fP(Vector3f(1, 1, 1), Vector3f(1, 2, 3));}
 
+    /// Statistics about the invocations of the dynamic version of func1()
+    mutable size_t calls = 0, lanes = 0;
+
 protected:
     int32_t value;
 };
@@ -154,3 +161,70 @@ ENOKI_TEST(test03_call_with_structure) {
     assert(all_nested(eq(t, Vector3f(2, 3, 4))));
     delete a;
 }
+
+ENOKI_TEST(test04_call_dynamic_coherent) {
+    Test *a = new Test(10);
+    Test *b = new Test(20);
+    Test *c = new TestChild();
+    const Test *instances[4] = { a, b, nullptr, c };
+
+    size_t size = 3 * TestP::Size + 3;
+    TestX pointers_x;
+    set_slices(pointers_x, size);
+    Int32X index_x = arange<Int32X>(size);
+    for (size_t i = 0; i < size; ++i)
+        slice(pointers_x, i) = instances[(i * 7) % 4];
+
+    auto ref = [&](size_t i, bool active) -> int32_t {
+        const Test *t = instances[(i * 7) % 4];
+        if (!active || t == nullptr)
+            return 0;
+        return (int32_t) i + (t == a ? 10 : (t == b ? 20 : 42));
+    };
+
+    Int32X result_x = pointers_x->func1(index_x);
+    for (size_t i = 0; i < size; ++i)
+        assert(slice(result_x, i) == ref(i, true));
+
+    /* Each instance is invoked once on a dense batch of its own lanes */
+    for (const Test *t : { a, b, c }) {
+        size_t lanes = 0;
+        for (size_t i = 0; i < size; ++i)
+            lanes += slice(pointers_x, i) == t ? 1 : 0;
+        assert(t->calls == 1 && t->lanes == lanes);
+    }
+
+    /* Groups are sorted by pointer, and lanes within a group are in order */
+    auto partitioned = partition(pointers_x);
+    assert(partitioned.size() == 4);
+    size_t total = 0;
+    for (size_t j = 0; j < partitioned.size(); ++j) {
+        const auto &[value, perm] = partitioned[j];
+        assert(j == 0 || partitioned[j - 1].first < value);
+        for (size_t k = 0; k < perm.size(); ++k) {
+            assert(slice(pointers_x, slice(perm, k)) == value);
+            assert(k == 0 || slice(perm, k - 1) < slice(perm, k));
+        }
+        total += perm.size();
+    }
+    assert(total == size);
+
+    TestXMask mask_x = eq(index_x & 1, 0);
+    result_x = pointers_x->func1(index_x, mask_x);
+    for (size_t i = 0; i < size; ++i)
+        assert(slice(result_x, i) == ref(i, (i & 1) == 0));
+
+    /* A single instance is dispatched without any gathering */
+    for (size_t i = 0; i < size; ++i)
+        slice(pointers_x, i) = a;
+    result_x = pointers_x->func1(index_x);
+    assert(result_x == index_x + 10);
+
+    partitioned = partition(pointers_x);
+    assert(partitioned.size() == 1 && partitioned[0].first == a &&
+           partitioned[0].second.size() == size);
+
+    delete a;
+    delete b;
+    delete c;
+}
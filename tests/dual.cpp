@@ -0,0 +1,118 @@
+/*
+    tests/dual.cpp -- tests forward-mode differentiation using dual numbers
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#include "test.h"
+#include <enoki/dual.h>
+
+using Df   = Dual<double>;
+using Df2  = Dual<double, 2>;
+using Pf   = Array<double, 8>;
+using DPf  = Dual<Pf, 2>;
+using V3f  = Array<Df2, 3>;
+
+template <typename T> bool close(const T &a, const T &b, double eps = 1e-6) {
+    return all_nested(abs(a - b) <= eps * (1.0 + abs(b)));
+}
+
+/// Compare the tangents of 'func' against central finite differences
+template <typename T, typename Func> void check_fd(Func func, const T &x) {
+    Dual<T, 2> xd(x);
+    set_tangent(xd, T(1.0), 0);
+    set_tangent(xd, T(2.0), 1);
+    Dual<T, 2> y = func(xd);
+
+    double h = 1e-6;
+    T fd = (func(x + h) - func(x - h)) * (.5 / h);
+    assert(close(primal(y), func(x)));
+    assert(close(tangent(y, 0), fd, 1e-5));
+    assert(close(tangent(y, 1), T(2.0 * fd), 1e-5));
+}
+
+template <typename T> void check_math(const T &x) {
+    check_fd([](auto x) { return sin(x) * cos(x); }, x);
+    check_fd([](auto x) { return tan(x) + exp(x); }, x);
+    check_fd([](auto x) { return log(x) * sqrt(x); }, x);
+    check_fd([](auto x) { return rsqrt(x) + rcp(x); }, x);
+    check_fd([](auto x) { return asin(x) + acos(x * .5) + atan(x); }, x);
+    check_fd([](auto x) { return sinh(x) + cosh(x) + tanh(x); }, x);
+    check_fd([](auto x) { return atan2(x, 1.0 - x); }, x);
+    check_fd([](auto x) { return abs(x - .5) * min(x, .3) + max(x, .6); }, x);
+    check_fd([](auto x) { return select(x > .5, sqr(x), -x); }, x);
+    check_fd([](auto x) { return sincos(x).first * sincosh(x).second; }, x);
+}
+
+ENOKI_TEST(test00_dual_arithmetic) {
+    Df x(3.0);
+    set_tangent(x, 1.0);
+    Df y = x * x + 2.0 * x - 1.0 / x;
+    assert(primal(y) == 9.0 + 6.0 - 1.0 / 3.0);
+    assert(std::abs(tangent(y) - (6.0 + 2.0 + 1.0 / 9.0)) < 1e-12);
+
+    Df z = fmadd(x, x, x) / (x - 1.0);
+    assert(std::abs(tangent(z) - ((7.0 * 2.0 - 12.0) / 4.0)) < 1e-12);
+
+    /* Constants have zero tangents */
+    Df c(5.0);
+    assert(tangent(c) == 0.0);
+    assert(tangent(-x) == -1.0);
+}
+
+ENOKI_TEST(test01_dual_math_scalar) {
+    for (double x : { .1, .4, .7, .9 }) {
+        check_math(x);
+        check_fd([](auto x) { return cbrt(x); }, x);
+        check_fd([](auto x) { return asinh(x) + acosh(x + 1.0) + atanh(x); }, x);
+        check_fd([](auto x) { return pow(x, x + 1.5); }, x);
+    }
+}
+
+ENOKI_TEST(test02_dual_math_packet) {
+    check_math(linspace<Pf>(.1, .9));
+}
+
+ENOKI_TEST(test03_dual_nested) {
+    /* Jacobian of normalize() with respect to the first two components */
+    V3f v(1.0, 2.0, 3.0);
+    set_tangent(v.x(), 1.0, 0);
+    set_tangent(v.y(), 1.0, 1);
+
+    V3f n = normalize(v);
+    Array<double, 3> vp = primal(v);
+    double l = norm(vp);
+
+    Array<double, 3> d0 = tangent(n, 0), d1 = tangent(n, 1);
+    Array<double, 3> e0(1.0, 0.0, 0.0), e1(0.0, 1.0, 0.0);
+    assert(close(d0, e0 / l - vp * vp.x() / (l * l * l)));
+    assert(close(d1, e1 / l - vp * vp.y() / (l * l * l)));
+
+    Df2 dp = dot(v, v);
+    assert(close(tangent(dp, 0), 2.0) && close(tangent(dp, 1), 4.0));
+}
+
+ENOKI_TEST(test04_dual_horizontal) {
+    DPf x(arange<Pf>());
+    set_tangent(x, Pf(1.0), 0);
+    set_tangent(x, arange<Pf>(), 1);
+
+    Df2 s = hsum(x * x);
+    assert(primal(s) == 140.0);
+    assert(tangent(s, 0) == 56.0);
+    assert(tangent(s, 1) == 280.0);
+
+    auto m = x > 3.0;
+    assert(count(m) == 4 && any(m) && !all(m));
+
+    DPf y = x & m;
+    assert(primal(y) == select(arange<Pf>() > 3.0, arange<Pf>(), 0.0));
+    assert(tangent(y, 0) == select(arange<Pf>() > 3.0, Pf(1.0), Pf(0.0)));
+}
@@ -316,3 +316,370 @@ ENOKI_TEST(array_float_04_test09_mask_packet) { test09_packet_from_struct<float,
 ENOKI_TEST(array_float_08_test09_mask_packet) { test09_packet_from_struct<float,   8>();  }
 ENOKI_TEST(array_float_16_test09_mask_packet) { test09_packet_from_struct<float,   16>();  }
 ENOKI_TEST(array_float_32_test09_mask_packet) { test09_packet_from_struct<float,   32>();  }
+
+template <size_t PacketSize> void test10_vectorize_parallel() {
+    using FloatP = Array<float, PacketSize>;
+    using FloatX = DynamicArray<FloatP>;
+
+    size_t thread_count = parallel_thread_count();
+    set_parallel_thread_count(4);
+
+    /* Several work items, including a trailing partial packet */
+    size_t n = 100003;
+    FloatX x = arange<FloatX>(n), y = full<FloatX>(2.f, 1);
+
+    FloatX z = vectorize_parallel_safe(
+        [](auto &&x, auto &&y) { return fmadd(x, y, 1.f); }, x, y);
+
+    assert(z.size() == n && y.size() == n);
+    for (size_t i = 0; i < n; ++i)
+        assert(z.coeff(i) == 2.f * float(i) + 1.f);
+
+    vectorize_parallel([](auto &&z) { z = -z; }, z);
+    assert(z.coeff(n - 1) == -(2.f * float(n - 1) + 1.f));
+
+    /* Exceptions raised by work items propagate to the caller */
+    bool caught = false;
+    try {
+        vectorize_parallel([](auto &&) { throw std::runtime_error("test"); }, z);
+    } catch (const std::runtime_error &) {
+        caught = true;
+    }
+    assert(caught);
+
+    /* Nested loops run serially, including on the calling thread, and the
+       pool refuses to be reconfigured from within a work item */
+    std::atomic<size_t> nested_total { 0 }, rejected { 0 };
+    parallel_for(64, 1, [&](size_t start, size_t end) {
+        parallel_for(100, 10, [&](size_t start2, size_t end2) {
+            nested_total += (end - start) * (end2 - start2);
+        });
+        try {
+            set_parallel_thread_count(2);
+        } catch (const std::runtime_error &) {
+            rejected += end - start;
+        }
+    });
+    assert(nested_total == 6400 && rejected == 64);
+    assert(parallel_thread_count() == 4);
+
+    set_parallel_thread_count(thread_count);
+}
+
+ENOKI_TEST(array_float_04_test10_vectorize_parallel) { test10_vectorize_parallel<4>();  }
+ENOKI_TEST(array_float_16_test10_vectorize_parallel) { test10_vectorize_parallel<16>(); }
+
+template <size_t PacketSize> void test11_lazy() {
+    using FloatP = Array<float, PacketSize>;
+    using FloatX = DynamicArray<FloatP>;
+
+    size_t n = 1001;
+    FloatX a = arange<FloatX>(n), b = linspace<FloatX>(0.f, 1.f, n),
+           c = full<FloatX>(3.f, n), d = full<FloatX>(-1.f, 1);
+
+    FloatX ref = a * b + c * d - 2.f;
+
+    /* The fused expression allocates only the output */
+    int alloc_count = test::alloc_count;
+    FloatX result = lazy(a) * b + c * lazy(d) - 2.f;
+    assert(test::alloc_count == alloc_count + 1);
+    assert(result.size() == n);
+    for (size_t i = 0; i < n; ++i)
+        assert(result.coeff(i) == ref.coeff(i));
+
+    /* In-place updates and expressions referencing the target */
+    result = fmadd(lazy(result), 2.f, lazy(a)) / c;
+    for (size_t i = 0; i < n; ++i)
+        assert(std::abs(result.coeff(i) - (2.f * ref.coeff(i) + float(i)) / 3.f) < 1e-4f);
+
+    d = -sqrt(abs(lazy(d))) + max(lazy(d), c);
+    assert(d.size() == n && d.coeff(0) == 2.f);
+
+    FloatX e = full<FloatX>(2.f, 1);
+    e = min(lazy(e), 1.f);
+    assert(e.size() == 1 && e.coeff(0) == 1.f);
+
+    bool caught = false;
+    try {
+        FloatX f = lazy(a) + zero<FloatX>(n + 1);
+    } catch (const std::runtime_error &) {
+        caught = true;
+    }
+    assert(caught);
+}
+
+ENOKI_TEST(array_float_04_test11_lazy) { test11_lazy<4>();  }
+ENOKI_TEST(array_float_16_test11_lazy) { test11_lazy<16>(); }
+
+ENOKI_TEST(test12_alloc_cache) {
+    using FloatP = Array<float, 4>;
+    using FloatX = DynamicArray<FloatP>;
+
+    FloatX x = arange<FloatX>(1000), y = x + x;
+
+    /* Temporaries are served from the thread-local cache at steady state */
+    DynamicMallocStats stats = dynamic_malloc_stats();
+    for (int i = 0; i < 10; ++i)
+        y = x * 2.f + x;
+    DynamicMallocStats stats2 = dynamic_malloc_stats();
+    assert(stats2.misses == stats.misses);
+    assert(stats2.hits >= stats.hits + 10);
+    assert(y.coeff(999) == 2997.f);
+
+    /* Capacity is unaffected by the size class rounding */
+    FloatX z;
+    set_slices(z, 10);
+    assert(z.capacity() == 12);
+
+    /* Mapped memory with 'dealloc=true' is released using delete[] */
+    FloatP *ptr = new FloatP[3];
+    FloatX w = FloatX::map(ptr, 10, true);
+    w = w + 1.f;
+    assert(w.size() == 10);
+    FloatX v = FloatX::map(new FloatP[3], 10, true);
+    v.resize(100);
+    assert(v.size() == 100);
+
+    /* Cacheable sizes are rounded up to a power of two and recycled */
+    dynamic_malloc_trim();
+    DynamicMallocStats s0 = dynamic_malloc_stats();
+    void *p1 = dynamic_malloc(1000);
+    DynamicMallocStats s1 = dynamic_malloc_stats();
+    assert(s1.used == s0.used + 1024 && s1.cached == s0.cached);
+    dynamic_free(p1, 1000);
+    DynamicMallocStats s2 = dynamic_malloc_stats();
+    assert(s2.used == s0.used && s2.cached == s0.cached + 1024);
+    assert(dynamic_malloc(1024) == p1);
+    dynamic_free(p1, 1024);
+
+    /* Larger regions have their exact size and bypass the cache */
+    size_t large = dynamic_malloc_max_class_size + 4160;
+    assert(dynamic_malloc_size(large) == large);
+    void *p2 = dynamic_malloc(large);
+    DynamicMallocStats s3 = dynamic_malloc_stats();
+    assert(s3.used == s0.used + large && s3.cached == s2.cached);
+    assert(s3.misses == s2.misses + 1 && s3.hits == s2.hits + 1);
+    dynamic_free(p2, large);
+    DynamicMallocStats s4 = dynamic_malloc_stats();
+    assert(s4.used == s0.used && s4.cached == s2.cached);
+
+    /* Trimming releases exactly the memory cached by the calling thread */
+    dynamic_malloc_trim();
+    assert(dynamic_malloc_stats().cached == s0.cached);
+}
+
+template <typename T, size_t PacketSize> void test13_partition() {
+    using TP = Array<T, PacketSize>;
+    using TX = DynamicArray<TP>;
+
+    size_t thread_count = parallel_thread_count();
+    set_parallel_thread_count(4);
+
+    /* Coherent runs and scattered keys, spanning several chunks */
+    size_t n = 100003;
+    TX keys;
+    set_slices(keys, n);
+    for (size_t i = 0; i < n; ++i)
+        keys.coeff(i) = (i / 1000) % 3 == 0 ? T(i % 13) - T(5) : T(i / 4096);
+
+    auto partitioned = partition(keys);
+
+    size_t total = 0;
+    for (size_t j = 0; j < partitioned.size(); ++j) {
+        const auto &[key, perm] = partitioned[j];
+        assert(j == 0 || partitioned[j - 1].first < key);
+        assert(perm.size() > 0);
+        for (size_t k = 0; k < perm.size(); ++k) {
+            assert(keys.coeff(perm.coeff(k)) == key);
+            assert(k == 0 || perm.coeff(k - 1) < perm.coeff(k));
+        }
+        total += perm.size();
+    }
+    assert(total == n);
+
+    /* Degenerate inputs */
+    assert(partition(TX()).empty());
+    partitioned = partition(full<TX>(T(7), 5));
+    assert(partitioned.size() == 1 && partitioned[0].first == T(7) &&
+           partitioned[0].second.size() == 5);
+    for (uint32_t k = 0; k < 5; ++k)
+        assert(partitioned[0].second.coeff(k) == k);
+
+    set_parallel_thread_count(thread_count);
+}
+
+ENOKI_TEST(array_int32_04_test13_partition)  { test13_partition<int32_t, 4>();   }
+ENOKI_TEST(array_int32_16_test13_partition)  { test13_partition<int32_t, 16>();  }
+ENOKI_TEST(array_uint64_08_test13_partition) { test13_partition<uint64_t, 8>();  }
+
+template <typename T, size_t PacketSize> void test14_sort() {
+    using TP      = Array<T, PacketSize>;
+    using TX      = DynamicArray<TP>;
+    using UInt32X = uint32_array_t<TX>;
+    using FloatX  = DynamicArray<Array<float, PacketSize>>;
+
+    size_t thread_count = parallel_thread_count();
+    set_parallel_thread_count(4);
+
+    /* Pseudorandom keys with many duplicates, spanning several chunks */
+    size_t n = 100003;
+    TX keys;
+    set_slices(keys, n);
+    uint64_t state = 1;
+    for (size_t i = 0; i < n; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        int64_t value = (int64_t) (state >> 40) % 5000 - (std::is_signed_v<T> ? 2500 : 0);
+        if constexpr (std::is_floating_point_v<T>)
+            keys.coeff(i) = T(value) * T(0.25);
+        else
+            keys.coeff(i) = T(value) << (sizeof(T) * 8 - 16);
+    }
+
+    std::vector<uint32_t> ref(n);
+    for (uint32_t i = 0; i < n; ++i)
+        ref[i] = i;
+    std::stable_sort(ref.begin(), ref.end(), [&](uint32_t a, uint32_t b) {
+        return keys.coeff(a) < keys.coeff(b);
+    });
+
+    TX sorted = sort(keys);
+    UInt32X index = argsort(keys);
+    TX gathered = gather<TX>(keys, index);
+    assert(sorted.size() == n && index.size() == n);
+    for (size_t i = 0; i < n; ++i) {
+        assert(sorted.coeff(i) == keys.coeff(ref[i]));
+        assert(index.coeff(i) == ref[i]);
+        assert(gathered.coeff(i) == sorted.coeff(i));
+    }
+
+    FloatX values = arange<FloatX>(n);
+    auto [sorted_keys, sorted_values] = sort_by_key(keys, values);
+    for (size_t i = 0; i < n; ++i) {
+        assert(sorted_keys.coeff(i) == sorted.coeff(i));
+        assert(sorted_values.coeff(i) == float(ref[i]));
+    }
+
+    /* Degenerate inputs */
+    assert(sort(TX()).size() == 0);
+    TX one = full<TX>(T(3), 1);
+    assert(sort(one).coeff(0) == T(3) && argsort(one).coeff(0) == 0);
+
+    set_parallel_thread_count(thread_count);
+}
+
+ENOKI_TEST(array_int32_08_test14_sort)  { test14_sort<int32_t, 8>();   }
+ENOKI_TEST(array_uint32_16_test14_sort) { test14_sort<uint32_t, 16>(); }
+ENOKI_TEST(array_int64_08_test14_sort)  { test14_sort<int64_t, 8>();   }
+ENOKI_TEST(array_uint64_04_test14_sort) { test14_sort<uint64_t, 4>();  }
+ENOKI_TEST(array_float_16_test14_sort)  { test14_sort<float, 16>();    }
+ENOKI_TEST(array_double_08_test14_sort) { test14_sort<double, 8>();    }
+
+ENOKI_TEST(test15_sort_float_special) {
+    using FloatX = DynamicArray<Array<float, 4>>;
+    float inf = std::numeric_limits<float>::infinity();
+    FloatX x = FloatX::copy(std::vector<float>{ 1.f, -0.f, -inf, 0.f, inf, -2.f, 0.5f }.data(), 7);
+    FloatX y = sort(x);
+    float ref[] = { -inf, -2.f, -0.f, 0.f, 0.5f, 1.f, inf };
+    for (size_t i = 0; i < 7; ++i)
+        assert(memcpy_cast<uint32_t>(y.coeff(i)) == memcpy_cast<uint32_t>(ref[i]));
+}
+
+template <typename T, size_t PacketSize> void test16_psum() {
+    using TX = DynamicArray<Array<T, PacketSize>>;
+
+    size_t thread_count = parallel_thread_count();
+    set_parallel_thread_count(4);
+
+    /* Small values keep the floating point sums exact; spans several chunks */
+    for (size_t n : { (size_t) 0, (size_t) 1, PacketSize + 1, (size_t) 100003 }) {
+        TX x;
+        set_slices(x, n);
+        for (size_t i = 0; i < n; ++i)
+            x.coeff(i) = T((i * 7) % 5 + 1);
+
+        TX incl = psum(x), excl = psum_exclusive(x);
+        assert(incl.size() == n && excl.size() == n);
+
+        T accum = T(0);
+        for (size_t i = 0; i < n; ++i) {
+            assert(excl.coeff(i) == accum);
+            accum += x.coeff(i);
+            assert(incl.coeff(i) == accum);
+        }
+    }
+
+    set_parallel_thread_count(thread_count);
+}
+
+ENOKI_TEST(array_int32_04_test16_psum)  { test16_psum<int32_t, 4>();   }
+ENOKI_TEST(array_uint32_16_test16_psum) { test16_psum<uint32_t, 16>(); }
+ENOKI_TEST(array_uint64_08_test16_psum) { test16_psum<uint64_t, 8>();  }
+ENOKI_TEST(array_float_08_test16_psum)  { test16_psum<float, 8>();     }
+ENOKI_TEST(array_double_04_test16_psum) { test16_psum<double, 4>();    }
+
+template <typename T, size_t PacketSize> void test17_compress_parallel() {
+    using TX      = DynamicArray<Array<T, PacketSize>>;
+    using MaskX   = mask_t<DynamicArray<Array<float, PacketSize>>>;
+    using UInt32X = uint32_array_t<TX>;
+
+    size_t thread_count = parallel_thread_count();
+    set_parallel_thread_count(4);
+
+    /* Dense and sparse regions spanning several chunks; the size is not a
+       multiple of the packet size */
+    for (size_t n : { (size_t) 0, (size_t) 1, (size_t) 100003 }) {
+        TX x;
+        MaskX mask;
+        set_slices(x, n);
+        set_slices(mask, n);
+        std::vector<uint32_t> ref;
+        for (size_t i = 0; i < n; ++i) {
+            bool active = (i / 5000) % 2 == 0 ? (i % 7 != 3) : (i % 97 == 5);
+            x.coeff(i) = T(i % 1000);
+            mask.coeff(i) = active;
+            if (active)
+                ref.push_back((uint32_t) i);
+        }
+
+        TX y = compress(x, mask);
+        UInt32X index = nonzero(mask);
+        assert(y.size() == ref.size() && index.size() == ref.size());
+        for (size_t i = 0; i < ref.size(); ++i) {
+            assert(y.coeff(i) == T(ref[i] % 1000));
+            assert(index.coeff(i) == ref[i]);
+        }
+    }
+
+    set_parallel_thread_count(thread_count);
+}
+
+ENOKI_TEST(array_int32_04_test17_compress_parallel)  { test17_compress_parallel<int32_t, 4>();   }
+ENOKI_TEST(array_uint64_08_test17_compress_parallel) { test17_compress_parallel<uint64_t, 8>();  }
+ENOKI_TEST(array_float_16_test17_compress_parallel)  { test17_compress_parallel<float, 16>();    }
+ENOKI_TEST(array_double_08_test17_compress_parallel) { test17_compress_parallel<double, 8>();    }
+
+template <size_t PacketSize> void test18_compress_struct() {
+    using FloatP       = Array<float, PacketSize>;
+    using FloatX       = DynamicArray<FloatP>;
+    using GPSCoord2fX  = GPSCoord2<FloatX>;
+    using GPSCoord2f   = GPSCoord2<float>;
+    using Vector2f     = Array<float, 2>;
+
+    size_t n = 3 * PacketSize + 1;
+    GPSCoord2fX coord;
+    set_slices(coord, n);
+    for (size_t i = 0; i < n; ++i)
+        slice(coord, i) =
+            GPSCoord2f(uint64_t(i), Vector2f((float) i, (float) (i * 100)), (i % 3) == 0);
+
+    GPSCoord2fX result = compress(coord, coord.reliable);
+    assert(slices(result) == (n + 2) / 3);
+    for (size_t i = 0; i < slices(result); ++i) {
+        GPSCoord2f value = slice(result, i);
+        assert(value.time == 3 * i && value.reliable);
+        assert(value.pos.x() == (float) (3 * i) && value.pos.y() == (float) (300 * i));
+    }
+}
+
+ENOKI_TEST(array_float_04_test18_compress_struct) { test18_compress_struct<4>();  }
+ENOKI_TEST(array_float_16_test18_compress_struct) { test18_compress_struct<16>(); }
@@ -244,3 +244,28 @@ ENOKI_TEST_ALL(test13_hmax_inner_nested) {
     assert(hmax_inner(x) == y);
     assert(hmax_nested(x) == hmax(y));
 }
+
+ENOKI_TEST_ALL(test14_psum) {
+    Value in[Size], incl[Size], excl[Size];
+    for (size_t i = 0; i < Size; ++i)
+        in[i] = Value((i * 7) % 5 + 1);
+
+    T x = load_unaligned<T>(in);
+    store_unaligned(incl, psum(x));
+    store_unaligned(excl, psum_exclusive(x));
+
+    Value accum = Value(0);
+    for (size_t i = 0; i < Size; ++i) {
+        assert(excl[i] == accum);
+        accum += in[i];
+        assert(incl[i] == accum);
+    }
+
+    /* Nested arrays are scanned along the outer dimension */
+    Array<T, 3> y(x, x + Value(1), x + Value(2)),
+                y_incl = psum(y),
+                y_excl = psum_exclusive(y);
+    assert(y_excl.x() == T(Value(0)) && y_excl.z() == x + x + Value(1));
+    assert(y_incl.x() == x && y_incl.z() == x + x + x + Value(3));
+    assert(psum(Value(3)) == Value(3) && psum_exclusive(Value(3)) == Value(0));
+}
@@ -0,0 +1,199 @@
+/*
+    tests/llvm.cpp -- tests the tracing JIT of the host backend (LLVMArray)
+
+    Enoki is a C++ template library that enables transparent vectorization
+    of numerical kernels using SIMD instruction sets available on current
+    processor architectures.
+
+    Copyright (c) 2019 Wenzel Jakob <wenzel.jakob@epfl.ch>
+
+    All rights reserved. Use of this source code is governed by a BSD-style
+    license that can be found in the LICENSE file.
+*/
+
+#include "test.h"
+#include <enoki/llvm.h>
+
+using FloatL  = LLVMArray<float>;
+using DoubleL = LLVMArray<double>;
+using Int32L  = LLVMArray<int32_t>;
+using UInt32L = LLVMArray<uint32_t>;
+using UInt64L = LLVMArray<uint64_t>;
+using MaskL   = LLVMArray<bool>;
+
+ENOKI_TEST(test01_literals) {
+    FloatL x = 2.5f;
+    Int32L y = -3;
+    MaskL m = true;
+    assert(x.size() == 1 && x.coeff(0) == 2.5f);
+    assert(y.coeff(0) == -3);
+    assert(m.coeff(0));
+
+    FloatL z(1.f, 2.f, 3.f);
+    assert(z.size() == 3 && z.coeff(2) == 3.f);
+}
+
+ENOKI_TEST(test02_arith_fused) {
+    size_t n = 100003;
+    FloatL x = arange<FloatL>(n);
+    FloatL y = fmadd(x, 2.f, 1.f) - x * x / (x + 1.f);
+    UInt32L k = arange<UInt32L>(n);
+    UInt32L l = (k << 3u) ^ (k >> 1u);
+
+    assert(y.size() == n && l.size() == n);
+    const float *py = y.data();
+    assert(py == nullptr);
+    llvm_eval();
+
+    py = y.data();
+    const uint32_t *pl = l.data();
+    for (size_t i = 0; i < n; ++i) {
+        float xi = (float) i,
+              ref = xi * 2.f + 1.f - xi * xi / (xi + 1.f);
+        assert(std::abs(py[i] - ref) <= 1e-6f * std::max(1.f, std::abs(ref)));
+        uint32_t ki = (uint32_t) i;
+        assert(pl[i] == ((ki << 3) ^ (ki >> 1)));
+    }
+}
+
+ENOKI_TEST(test03_math_and_casts) {
+    FloatL x = linspace<FloatL>(-2.f, 2.f, 1001);
+    FloatL y = sqrt(abs(x)) + floor(x) - min(x, 0.5f) + max(x, -0.5f);
+    Int32L i = Int32L(x * 10.f);
+    DoubleL d = DoubleL(x);
+    FloatL r = reinterpret_array<FloatL>(reinterpret_array<UInt32L>(x));
+
+    for (size_t j = 0; j < 1001; ++j) {
+        float xj = x.coeff(j),
+              ref = std::sqrt(std::abs(xj)) + std::floor(xj) -
+                    std::min(xj, 0.5f) + std::max(xj, -0.5f);
+        assert(std::abs(y.coeff(j) - ref) < 1e-6f);
+        assert(i.coeff(j) == (int32_t) (xj * 10.f));
+        assert(d.coeff(j) == (double) xj);
+        assert(r.coeff(j) == xj);
+    }
+}
+
+ENOKI_TEST(test04_masks_and_select) {
+    Int32L x = arange<Int32L>(1000) - 500;
+    MaskL m = x < 0 || eq(x, 100);
+    Int32L y = select(m, -x, x * 2);
+    Int32L z = x & (x > 0);
+
+    assert(count(m) == 501);
+    assert(any(m) && !all(m));
+    for (int j = 0; j < 1000; ++j) {
+        int xj = j - 500;
+        bool mj = xj < 0 || xj == 100;
+        assert(m.coeff((size_t) j) == mj);
+        assert(y.coeff((size_t) j) == (mj ? -xj : 2 * xj));
+        assert(z.coeff((size_t) j) == (xj > 0 ? xj : 0));
+    }
+}
+
+ENOKI_TEST(test05_reductions) {
+    size_t n = 4099;
+    UInt64L x = arange<UInt64L>(n) + 1ull;
+    assert(hsum(x).coeff(0) == n * (n + 1) / 2);
+    assert(hmax(x).coeff(0) == n);
+    assert(hmin(x).coeff(0) == 1);
+
+    FloatL y = FloatL(x) * 0.5f;
+    assert(hsum(y).coeff(0) == 0.25f * (float) (n * (n + 1)));
+}
+
+ENOKI_TEST(test06_gather_scatter) {
+    size_t n = 5000;
+    std::vector<float> src(n), dst(n, 0.f);
+    for (size_t i = 0; i < n; ++i)
+        src[i] = (float) i * 3.f;
+
+    UInt32L idx = (n - 1) - arange<UInt32L>(n);
+    FloatL v = gather<FloatL>(src.data(), idx, idx > 10u);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t k = (uint32_t) (n - 1 - i);
+        assert(v.coeff(i) == (k > 10 ? src[k] : 0.f));
+    }
+
+    scatter(dst.data(), v + 1.f, arange<UInt32L>(n));
+    llvm_eval();
+    for (size_t i = 0; i < n; ++i)
+        assert(dst[i] == v.coeff(i) + 1.f);
+}
+
+ENOKI_TEST(test07_map_copy_compress) {
+    size_t n = 3000;
+    float *buf = (float *) llvm_malloc(n * sizeof(float));
+    for (size_t i = 0; i < n; ++i)
+        buf[i] = (float) i;
+
+    FloatL x = FloatL::map(buf, n, true);
+    FloatL c = compress(x * 2.f, x >= 1000.f && x < 1010.f);
+    assert(c.size() == 10);
+    for (size_t i = 0; i < 10; ++i)
+        assert(c.coeff(i) == 2.f * (1000.f + (float) i));
+
+    std::vector<int32_t> host(n);
+    for (size_t i = 0; i < n; ++i)
+        host[i] = (int32_t) i - 7;
+    Int32L y = Int32L::copy(host.data(), n);
+    assert(hsum(abs(y)).coeff(0) == 28 + (int32_t) ((n - 8) * (n - 7) / 2));
+}
+
+ENOKI_TEST(test08_broadcast_resize) {
+    FloatL x = 3.f;
+    x.resize(2000);
+    FloatL y = x + arange<FloatL>(2000);
+    assert(x.size() == 2000 && y.size() == 2000);
+    for (size_t i = 0; i < 2000; i += 37) {
+        assert(x.coeff(i) == 3.f);
+        assert(y.coeff(i) == 3.f + (float) i);
+    }
+
+    bool caught = false;
+    try {
+        FloatL z = arange<FloatL>(10) + arange<FloatL>(11);
+    } catch (const std::runtime_error &) {
+        caught = true;
+    }
+    assert(caught);
+}
+
+ENOKI_TEST(test09_kernel_cache) {
+    auto kernel = [](float scale) {
+        FloatL x = arange<FloatL>(10000);
+        FloatL y = sin(x * scale) * sin(x * scale) +
+                   cos(x * scale) * cos(x * scale);
+        llvm_eval();
+        return y;
+    };
+
+    FloatL y = kernel(0.1f);
+    size_t count = llvm_kernel_count();
+
+    /* A trace with the same structure is served from the cache */
+    FloatL y2 = kernel(0.2f);
+    assert(llvm_kernel_count() == count);
+
+    for (size_t i = 0; i < 10000; i += 101) {
+        assert(std::abs(y.coeff(i) - 1.f) < 1e-5f);
+        assert(std::abs(y2.coeff(i) - 1.f) < 1e-5f);
+    }
+}
+
+ENOKI_TEST(test10_ref_counting) {
+    FloatL a = arange<FloatL>(100);
+    FloatL b = a * 2.f;
+    a = FloatL();
+    FloatL c = b + 1.f;
+    b = FloatL();
+    assert(c.coeff(99) == 199.f);
+
+    bool caught = false;
+    try {
+        FloatL d = c + FloatL();
+    } catch (const std::runtime_error &) {
+        caught = true;
+    }
+    assert(caught);
+}